@@ -58,6 +58,7 @@ rm -rf $RPM_BUILD_ROOT
 rm -rf $RPM_BUILD_ROOT
 
 mkdir -p $RPM_BUILD_ROOT/usr/sbin
+mkdir -p $RPM_BUILD_ROOT/usr/bin
 mkdir -p $RPM_BUILD_ROOT/home/httpd/{html,cgi-bin}
 mkdir -p $RPM_BUILD_ROOT/var/log/boa
 mkdir -p $RPM_BUILD_ROOT/usr/lib/boa
@@ -67,6 +68,7 @@ mkdir -p $RPM_BUILD_ROOT/etc/boa
 
 install -m755 src/boa $RPM_BUILD_ROOT/usr/sbin/
 install -m755 src/boa_indexer $RPM_BUILD_ROOT/usr/lib/boa/
+install -m755 src/boa_logcat $RPM_BUILD_ROOT/usr/bin/
 install -m644 contrib/rpm/boa.conf $RPM_BUILD_ROOT/etc/boa/
 
 %if is_suse
@@ -115,4 +117,5 @@ touch $RPM_BUILD_ROOT/var/log/boa/{error,access}_log
 
 /usr/sbin/boa
 /usr/lib/boa/boa_indexer
+/usr/bin/boa_logcat
 
@@ -26,17 +26,71 @@
 #include "boa.h"
 #include "access.h"
 
+/*
+ * The Allow/Deny patterns are compiled by access_compile into a trie
+ * of their literal prefixes (everything before the first wildcard).
+ * Walking a filename down the trie turns up the only rules that can
+ * possibly match it, and since the prefix has matched already, fnmatch
+ * only has to look at the rest.  The first rule in boa.conf order that
+ * matches still wins.
+ *
+ * On top of that, the decision for each filename is remembered in
+ * a direct-mapped cache, which access_init empties on reload.
+ */
+
 struct access_node {
     char *pattern;
     enum access_type type;
+    unsigned int prefix_len;    /* length of the literal prefix */
+    int literal;                /* no wildcards at all */
+};
+
+struct prefix_node {
+    unsigned char c;
+    int *rules;                 /* rules whose prefix ends here, in order */
+    unsigned int n_rules;
+    struct prefix_node **children; /* sorted by c */
+    unsigned int n_children;
+};
+
+struct access_cache {
+    char *file;
+    enum access_type type;
 };
 
 static int n_access;
 
 static struct access_node *nodes = NULL;
+static struct prefix_node *prefix_trie = NULL;
+static struct access_cache access_cache[ACCESS_CACHE_SIZE];
 
 static void access_shutdown(void);
 
+static void free_prefix_trie(struct prefix_node *node)
+{
+    unsigned int i;
+
+    if (!node)
+        return;
+    for (i = 0; i < node->n_children; i++)
+        free_prefix_trie(node->children[i]);
+    free(node->children);
+    free(node->rules);
+    free(node);
+}
+
+static void access_cache_clear(void)
+{
+    int i;
+
+    for (i = 0; i < ACCESS_CACHE_SIZE; i++) {
+        if (access_cache[i].file) {
+            free(access_cache[i].file);
+            access_cache[i].file = NULL;
+        }
+    }
+}
+
 static void access_shutdown(void)
 {
     int i;
@@ -54,6 +108,8 @@ static void access_shutdown(void)
 
     nodes = NULL;
     n_access = 0;
+    free_prefix_trie(prefix_trie);
+    prefix_trie = NULL;
 }
 
 void access_init(void)
@@ -61,6 +117,7 @@ void access_init(void)
     if (n_access || nodes) {
         access_shutdown();
     }
+    access_cache_clear();
 }
 
 void access_add(const char *pattern, enum access_type type)
@@ -75,21 +132,136 @@ void access_add(const char *pattern, enum access_type type)
     if (!nodes[n_access].pattern) {
         DIE("strdup of pattern failed!");
     }
+    nodes[n_access].prefix_len = strcspn(pattern, "*?[\\");
+    nodes[n_access].literal = (pattern[nodes[n_access].prefix_len] == '\0');
     ++n_access;
 }                               /* access_add */
 
+static struct prefix_node *find_prefix_child(struct prefix_node *node,
+                                             unsigned char c)
+{
+    int lo = 0, hi = (int) node->n_children - 1, mid;
+
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (node->children[mid]->c == c)
+            return node->children[mid];
+        if (node->children[mid]->c < c)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return NULL;
+}
 
-enum access_type access_allow(const char *file)
+static struct prefix_node *add_prefix_child(struct prefix_node *node,
+                                            unsigned char c)
 {
+    struct prefix_node *child;
+    unsigned int i;
+
+    child = find_prefix_child(node, c);
+    if (child)
+        return child;
+
+    child = calloc(1, sizeof (struct prefix_node));
+    node->children = realloc(node->children, (node->n_children + 1) *
+                             sizeof (struct prefix_node *));
+    if (!child || !node->children) {
+        DIE("out of memory compiling access rules!");
+    }
+    child->c = c;
+    for (i = node->n_children; i > 0 && node->children[i - 1]->c > c; i--)
+        node->children[i] = node->children[i - 1];
+    node->children[i] = child;
+    node->n_children++;
+    return child;
+}
+
+/*
+ * Name: access_compile
+ * Description: Builds the prefix trie for the rules given with
+ * access_add.  Called once the configuration has been read.
+ */
+
+void access_compile(void)
+{
+    struct prefix_node *node;
+    unsigned int j;
     int i;
 
-    /* find first match in allow / deny rules */
+    free_prefix_trie(prefix_trie);
+    prefix_trie = calloc(1, sizeof (struct prefix_node));
+    if (!prefix_trie) {
+        DIE("out of memory compiling access rules!");
+    }
+
     for (i = 0; i < n_access; i++) {
-        if (fnmatch(nodes[i].pattern, file, 0) == 0) {
-            return nodes[i].type;
+        node = prefix_trie;
+        for (j = 0; j < nodes[i].prefix_len; j++)
+            node = add_prefix_child(node,
+                                    (unsigned char) nodes[i].pattern[j]);
+        node->rules = realloc(node->rules,
+                              (node->n_rules + 1) * sizeof (int));
+        if (!node->rules) {
+            DIE("out of memory compiling access rules!");
         }
+        node->rules[node->n_rules++] = i;
     }
+}
+
+/*
+ * Name: access_match
+ * Description: The first rule (in boa.conf order) matching file, or
+ * n_access if there is none.
+ */
+
+static int access_match(const char *file)
+{
+    struct prefix_node *node = prefix_trie;
+    unsigned int pos = 0, k;
+    int best = n_access, rule;
+
+    while (node) {
+        for (k = 0; k < node->n_rules; k++) {
+            rule = node->rules[k];
+            if (rule >= best)
+                break;
+            if (nodes[rule].literal ? file[pos] == '\0' :
+                fnmatch(nodes[rule].pattern + pos, file + pos, 0) == 0) {
+                best = rule;
+                break;
+            }
+        }
+        if (file[pos] == '\0')
+            break;
+        node = find_prefix_child(node, (unsigned char) file[pos++]);
+    }
+    return best;
+}
+
+enum access_type access_allow(const char *file)
+{
+    struct access_cache *entry;
+    unsigned int hash = 2166136261U;
+    const char *p;
+    int rule;
+
+    for (p = file; *p; p++) {
+        hash ^= (unsigned char) *p;
+        hash *= 16777619U;
+    }
+    entry = &access_cache[hash % ACCESS_CACHE_SIZE];
+    if (entry->file && !strcmp(entry->file, file))
+        return entry->type;
+
+    /* find first match in allow / deny rules */
+    rule = access_match(file);
 
+    if (entry->file)
+        free(entry->file);
+    entry->file = strdup(file);
     /* default to allow */
-    return ACCESS_ALLOW;
+    entry->type = (rule < n_access ? nodes[rule].type : ACCESS_ALLOW);
+    return entry->type;
 }                               /* access_allow */
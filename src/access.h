@@ -28,6 +28,7 @@ enum access_type { ACCESS_DENY, ACCESS_ALLOW };
 
 void access_init(void);
 void access_add(const char *pattern, enum access_type);
+void access_compile(void);
 enum access_type access_allow(const char *file);
 
 #endif                          /* _ACCESS_H */
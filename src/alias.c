@@ -29,7 +29,7 @@
 struct alias {
     char *fakename;             /* URI path to file */
     char *realname;             /* Actual path to file */
-    enum ALIAS type;            /* ALIAS, SCRIPTALIAS, REDIRECT */
+    enum ALIAS type;            /* ALIAS, SCRIPTALIAS, REDIRECT, STREAMSCRIPTALIAS */
     unsigned int fake_len;      /* strlen of fakename */
     unsigned int real_len;      /* strlen of realname */
     struct alias *next;
@@ -37,51 +37,50 @@ struct alias {
 
 typedef struct alias alias;
 
-static alias *alias_hashtable[ALIAS_HASHTABLE_SIZE];
-static alias *find_alias(char *uri, unsigned int urilen);
-static int init_script_alias(request * req, alias * current1, unsigned int uri_len);
-
-static unsigned int get_alias_hash_value(const char *file);
-
 /*
- * Name: get_alias_hash_value
- *
- * Description: adds the ASCII values of the file letters
- * and mods by the hashtable size to get the hash value
- * Note: stops at first '/' (or '\0')
+ * The aliases live in a compressed radix trie keyed on fakename.
+ * Each edge is labelled with a run of bytes (pointing into one of the
+ * fakenames, never copied), and the children of a node are kept
+ * sorted by the first byte of their label.  A node carries an alias
+ * if some fakename ends exactly there.  Looking up a URI is a single
+ * walk down from the root, remembering the deepest alias that
+ * matched on the way.
  */
 
-static unsigned int get_alias_hash_value(const char *file)
-{
-    unsigned int hash = 0;
-    unsigned int i = 0;
-    char c;
+struct alias_node {
+    const char *label;          /* bytes on the edge into this node */
+    unsigned int label_len;
+    alias *alias;               /* fakename ending here, or NULL */
+    struct alias_node **children;
+    unsigned int child_count;
+};
 
-    if (file == NULL) {
-        WARN("file sent to get_alias_hash_value is NULL");
-        return 0;
-    } else if (file[0] == '\0') {
-        WARN("file sent to get_alias_hash_value is empty");
-        return 0;
-    }
+typedef struct alias_node alias_node;
 
-    hash = (unsigned int) file[i++];
-    while ((c = file[i++]) && c != '/')
-        hash += (unsigned int) c;
+static alias *alias_list;       /* aliases in alias_trie */
+static alias_node *alias_trie;
+static alias *new_alias_list;   /* read since the last build_alias_trie */
 
-    return hash % ALIAS_HASHTABLE_SIZE;
-}
+static struct {
+    unsigned int aliases;
+    unsigned int nodes;
+    unsigned long lookups;
+    unsigned long steps;        /* nodes visited by all lookups */
+    unsigned int max_depth;
+} alias_stats;
+
+static alias *find_alias(char *uri, unsigned int urilen);
+static int init_script_alias(request * req, alias * current1, unsigned int uri_len);
 
 /*
  * Name: add_alias
  *
- * Description: add an Alias, Redirect, or ScriptAlias to the
- * alias hash table.
+ * Description: add an Alias, Redirect, or ScriptAlias to the list
+ * that build_alias_trie turns into the next alias trie.
  */
 
 void add_alias(const char *fakename, const char *realname, enum ALIAS type)
 {
-    unsigned int hash;
     alias *old, *new;
     unsigned int fakelen, reallen;
 
@@ -96,22 +95,15 @@ void add_alias(const char *fakename, const char *realname, enum ALIAS type)
         DIE("empty values sent to add_alias");
     }
 
-    hash = get_alias_hash_value(fakename);
-
     DEBUG(DEBUG_ALIAS) {
         log_error_time();
-        fprintf(stderr, "%s:%d - Going to add alias: \"%s\" -=> \"%s\" (hash: %u)\n",
-                __FILE__, __LINE__, fakename, realname, hash);
+        fprintf(stderr, "%s:%d - Going to add alias: \"%s\" -=> \"%s\"\n",
+                __FILE__, __LINE__, fakename, realname);
     }
 
-    old = alias_hashtable[hash];
-
-    if (old) {
-        while (old->next) {
-            if (!strcmp(fakename, old->fakename)) /* don't add twice */
-                return;
-            old = old->next;
-        }
+    for (old = new_alias_list; old; old = old->next) {
+        if (!strcmp(fakename, old->fakename)) /* don't add twice */
+            return;
     }
 
     new = (alias *) malloc(sizeof (alias));
@@ -119,11 +111,6 @@ void add_alias(const char *fakename, const char *realname, enum ALIAS type)
         DIE("out of memory adding alias to hash");
     }
 
-    if (old)
-        old->next = new;
-    else
-        alias_hashtable[hash] = new;
-
     new->fakename = strdup(fakename);
     if (!new->fakename) {
         DIE("failed strdup");
@@ -137,20 +124,166 @@ void add_alias(const char *fakename, const char *realname, enum ALIAS type)
     new->real_len = reallen;
 
     new->type = type;
-    new->next = NULL;
+    new->next = new_alias_list;
+    new_alias_list = new;
 
     DEBUG(DEBUG_ALIAS) {
         log_error_time();
         fprintf(stderr,
-                "%s:%d - ADDED alias: \"%s\" -=> \"%s\" hash: %u\n",
-                __FILE__, __LINE__, fakename, realname, hash);
+                "%s:%d - ADDED alias: \"%s\" -=> \"%s\"\n",
+                __FILE__, __LINE__, fakename, realname);
+    }
+}
+
+static alias_node *new_alias_node(const char *label, unsigned int len)
+{
+    alias_node *node;
+
+    node = (alias_node *) calloc(1, sizeof (alias_node));
+    if (!node) {
+        DIE("out of memory adding alias to trie");
+    }
+    node->label = label;
+    node->label_len = len;
+    alias_stats.nodes++;
+    return node;
+}
+
+/*
+ * Name: find_child
+ *
+ * Description: Binary search for the child of node whose label
+ * starts with c.  Returns its index, or, if there is none, -1 - the
+ * index it would have to be inserted at.
+ */
+
+static int find_child(const alias_node * node, unsigned char c)
+{
+    int lo = 0, hi = (int) node->child_count - 1, mid;
+    unsigned char first;
+
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        first = (unsigned char) node->children[mid]->label[0];
+        if (first == c)
+            return mid;
+        if (first < c)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1 - lo;
+}
+
+static void insert_child(alias_node * node, int i, alias_node * child)
+{
+    alias_node **children;
+
+    children = (alias_node **) realloc(node->children,
+                                       (node->child_count + 1) *
+                                       sizeof (alias_node *));
+    if (!children) {
+        DIE("out of memory adding alias to trie");
+    }
+    memmove(children + i + 1, children + i,
+            (node->child_count - i) * sizeof (alias_node *));
+    children[i] = child;
+    node->children = children;
+    node->child_count++;
+}
+
+static void trie_insert(alias_node * root, alias * a)
+{
+    alias_node *node = root, *child, *mid;
+    unsigned int pos = 0, common;
+    int i;
+
+    while (pos < a->fake_len) {
+        i = find_child(node, (unsigned char) a->fakename[pos]);
+        if (i < 0) {
+            child = new_alias_node(a->fakename + pos, a->fake_len - pos);
+            child->alias = a;
+            insert_child(node, -1 - i, child);
+            return;
+        }
+        child = node->children[i];
+        common = 1;
+        while (common < child->label_len && pos + common < a->fake_len &&
+               child->label[common] == a->fakename[pos + common])
+            ++common;
+
+        if (common < child->label_len) {
+            /* split the edge where a->fakename leaves it */
+            mid = new_alias_node(child->label, common);
+            child->label += common;
+            child->label_len -= common;
+            insert_child(mid, 0, child);
+            node->children[i] = mid;
+            child = mid;
+        }
+        node = child;
+        pos += common;
+    }
+    node->alias = a;
+}
+
+static void free_alias_trie(alias_node * node)
+{
+    unsigned int i;
+
+    if (!node)
+        return;
+    for (i = 0; i < node->child_count; ++i)
+        free_alias_trie(node->children[i]);
+    free(node->children);
+    free(node);
+}
+
+static void free_alias_list(alias * a)
+{
+    alias *next;
+
+    while (a) {
+        next = a->next;
+        free(a->fakename);
+        free(a->realname);
+        free(a);
+        a = next;
+    }
+}
+
+/*
+ * Name: build_alias_trie
+ *
+ * Description: Turns the aliases read from the configuration files
+ * into the trie find_alias uses, and only then throws away the old
+ * one, so a reload never leaves requests without aliases.
+ */
+
+void build_alias_trie(void)
+{
+    alias_node *root;
+    alias *a;
+
+    alias_stats.nodes = 0;
+    alias_stats.aliases = 0;
+    root = new_alias_node("", 0);
+    for (a = new_alias_list; a; a = a->next) {
+        trie_insert(root, a);
+        alias_stats.aliases++;
     }
+
+    free_alias_trie(alias_trie);
+    free_alias_list(alias_list);
+    alias_trie = root;
+    alias_list = new_alias_list;
+    new_alias_list = NULL;
 }
 
 /*
  * Name: find_alias
  *
- * Description: Locates uri in the alias hashtable if it exists.
+ * Description: Locates the longest alias matching uri, if there is one.
  *
  * Returns:
  *
@@ -159,8 +292,10 @@ void add_alias(const char *fakename, const char *realname, enum ALIAS type)
 
 static alias *find_alias(char *uri, unsigned int urilen)
 {
-    alias *current;
-    unsigned int hash;
+    alias_node *node = alias_trie, *child;
+    alias *found = NULL;
+    unsigned int pos = 0, depth = 0;
+    int i;
 
     /* Find ScriptAlias, Alias, or Redirect */
 
@@ -169,26 +304,14 @@ static alias *find_alias(char *uri, unsigned int urilen)
         urilen = strlen(uri);
     }
 
-    hash = get_alias_hash_value(uri);
-
     DEBUG(DEBUG_ALIAS) {
         log_error_time();
         fprintf(stderr,
-                "%s:%d - looking for \"%s\" (hash=%u,len=%u)...\n",
-                __FILE__, __LINE__, uri, hash, urilen);
+                "%s:%d - looking for \"%s\" (len=%u)...\n",
+                __FILE__, __LINE__, uri, urilen);
     }
 
-    current = alias_hashtable[hash];
-    while (current) {
-        DEBUG(DEBUG_ALIAS) {
-            log_error_time();
-            fprintf(stderr,
-                    "%s:%d - comparing \"%s\" (request) to \"%s\" (alias): ",
-                    __FILE__, __LINE__, uri, current->fakename);
-        }
-        /* current->fake_len must always be:
-         *  shorter or equal to the uri
-         */
+    while (node) {
         /*
          * when performing matches:
          * If the virtual part of the URL ends in '/', and
@@ -196,26 +319,57 @@ static alias *find_alias(char *uri, unsigned int urilen)
          * Otherwise, we require '/' or '\0' at the end of the URL.
          * We only check if the virtual path does *not* end in '/'
          */
-        if (current->fake_len <= urilen &&
-            !memcmp(uri, current->fakename, current->fake_len) &&
-            (current->fakename[current->fake_len - 1] == '/' ||
-             (current->fakename[current->fake_len - 1] != '/' &&
-              (uri[current->fake_len] == '\0' ||
-               uri[current->fake_len] == '/')))) {
-            DEBUG(DEBUG_ALIAS) {
-                fprintf(stderr, "Got it! (%s)\n", current->realname);
-            }
-            return current;
-        } else {
+        if (node->alias &&
+            (node->alias->fakename[pos - 1] == '/' ||
+             uri[pos] == '\0' || uri[pos] == '/')) {
             DEBUG(DEBUG_ALIAS) {
-                fprintf(stderr, "Don't Got it!\n");
+                log_error_time();
+                fprintf(stderr, "%s:%d - matches \"%s\" (%s)\n",
+                        __FILE__, __LINE__, node->alias->fakename,
+                        node->alias->realname);
             }
+            found = node->alias;
         }
-        current = current->next;
+        if (pos == urilen)
+            break;
+        i = find_child(node, (unsigned char) uri[pos]);
+        if (i < 0)
+            break;
+        child = node->children[i];
+        if (child->label_len > urilen - pos ||
+            memcmp(uri + pos, child->label, child->label_len))
+            break;
+        pos += child->label_len;
+        node = child;
+        depth++;
     }
-    return current;
+
+    alias_stats.lookups++;
+    alias_stats.steps += depth;
+    if (depth > alias_stats.max_depth)
+        alias_stats.max_depth = depth;
+    return found;
 }
 
+/*
+ * Name: alias_show_stats
+ *
+ * Description: Logs the size of the alias trie and how deep lookups
+ * have had to go into it.
+ */
+
+void alias_show_stats(void)
+{
+    log_error_time();
+    fprintf(stderr, "alias trie has %u aliases in %u nodes, "
+            "%lu lookups, %.2f nodes per lookup, max depth %u\n",
+            alias_stats.aliases, alias_stats.nodes, alias_stats.lookups,
+            (alias_stats.lookups ?
+             (double) alias_stats.steps / alias_stats.lookups : 0.0),
+            alias_stats.max_depth);
+}
+
+
 /*
  * Name: translate_uri
  *
@@ -248,7 +402,8 @@ int translate_uri(request * req)
     uri_len = strlen(req->request_uri);
     current = find_alias(req->request_uri, uri_len);
     if (current) {
-        if (current->type == SCRIPTALIAS) /* Script */
+        if (current->type == SCRIPTALIAS ||
+            current->type == STREAMSCRIPTALIAS) /* Script */
             return init_script_alias(req, current, uri_len);
 
         /* not a script alias, therefore begin filling in data */
@@ -421,6 +576,19 @@ int translate_uri(request * req)
 
     /* below we support cgis outside of a ScriptAlias */
     if (strcmp(CGI_MIME_TYPE, get_mime_type(req->pathname)) == 0) { /* cgi */
+        struct stat statbuf;
+
+        /* same checks as init_script_alias, so a missing script
+         * is reported before a POST body is read for it
+         */
+        if (stat(req->pathname, &statbuf) == -1) {
+            send_r_not_found(req);
+            return 0;
+        }
+        if (!S_ISREG(statbuf.st_mode) || access(req->pathname, R_OK|X_OK)) {
+            send_r_forbidden(req);
+            return 0;
+        }
         /* FIXME */
         /* script_name could end up as /cgi-bin/bob/extra_path */
         req->script_name = strdup(req->request_uri);
@@ -521,6 +689,10 @@ static int init_script_alias(request * req, alias * current1, unsigned int uri_l
     else
         req->cgi_type = CGI;
 
+    /* NPH scripts own the socket, so they always get a spooled body */
+    if (current1->type == STREAMSCRIPTALIAS && req->cgi_type == CGI)
+        req->stream_body = 1;
+
     /* start at the beginning of the actual uri...
        (in /cgi-bin/bob, start at the 'b' in bob */
     i = current1->real_len;
@@ -591,7 +763,6 @@ static int init_script_alias(request * req, alias * current1, unsigned int uri_l
 
     /* we have path_info if c == '/'... still have to check for query */
     else if (c == '/') {
-        unsigned int hash;
         alias *current;
         int path_len;
 
@@ -612,36 +783,31 @@ static int init_script_alias(request * req, alias * current1, unsigned int uri_l
         /* now, we have to re-alias the extra path info....
            this sucks.
          */
-        hash = get_alias_hash_value(req->path_info);
-        current = alias_hashtable[hash];
-        while (current && !req->path_translated) {
-            if (!strncmp(req->path_info, current->fakename,
-                         current->fake_len)) {
-                static char buffer[MAX_HEADER_LENGTH + 1];
-
-                if (current->real_len + path_len -
-                    current->fake_len + 1 > sizeof(buffer)) {
-                    log_error_doc(req);
-                    fputs("uri too long!\n", stderr);
-                    send_r_bad_request(req);
-                    return 0;
-                }
+        current = find_alias(req->path_info, path_len);
+        if (current) {
+            static char buffer[MAX_HEADER_LENGTH + 1];
 
-                memcpy(buffer, current->realname, current->real_len);
-                /*
-                strcpy(buffer + current->real_len,
-                &req->path_info[current->fake_len]);
-                */
-                memcpy(buffer + current->real_len,
-                       req->path_info + current->fake_len,
-                       path_len - current->fake_len + 1); /* +1 for NUL */
-                req->path_translated = strdup(buffer);
-                if (!req->path_translated) {
-                    boa_perror(req, "unable to strdup buffer for req->path_translated");
-                    return 0;
-                }
+            if (current->real_len + path_len -
+                current->fake_len + 1 > sizeof(buffer)) {
+                log_error_doc(req);
+                fputs("uri too long!\n", stderr);
+                send_r_bad_request(req);
+                return 0;
+            }
+
+            memcpy(buffer, current->realname, current->real_len);
+            /*
+            strcpy(buffer + current->real_len,
+            &req->path_info[current->fake_len]);
+            */
+            memcpy(buffer + current->real_len,
+                   req->path_info + current->fake_len,
+                   path_len - current->fake_len + 1); /* +1 for NUL */
+            req->path_translated = strdup(buffer);
+            if (!req->path_translated) {
+                boa_perror(req, "unable to strdup buffer for req->path_translated");
+                return 0;
             }
-            current = current->next;
         }
         /* no alias... try userdir */
         if (!req->path_translated && user_dir && req->path_info[1] == '~') {
@@ -690,29 +856,14 @@ static int init_script_alias(request * req, alias * current1, unsigned int uri_l
 }
 
 /*
- * Empties the alias hashtable, deallocating any allocated memory.
+ * Empties the alias trie, deallocating any allocated memory.
  */
 
 void dump_alias(void)
 {
-    int i;
-    alias *temp;
-
-    for (i = 0; i < ALIAS_HASHTABLE_SIZE; ++i) { /* these limits OK? */
-        if (alias_hashtable[i]) {
-            temp = alias_hashtable[i];
-            while (temp) {
-                alias *temp_next;
-
-                if (temp->fakename)
-                    free(temp->fakename);
-                if (temp->realname)
-                    free(temp->realname);
-                temp_next = temp->next;
-                free(temp);
-                temp = temp_next;
-            }
-            alias_hashtable[i] = NULL;
-        }
-    }
+    free_alias_trie(alias_trie);
+    free_alias_list(alias_list);
+    free_alias_list(new_alias_list);
+    alias_trie = NULL;
+    alias_list = new_alias_list = NULL;
 }
@@ -0,0 +1,208 @@
+/*
+ *  Boa, an http server
+ *  Copyright (C) 1995 Paul Phillips <paulp@go2net.com>
+ *  Copyright (C) 1996-2005 Larry Doolittle <ldoolitt@boa.org>
+ *  Copyright (C) 1997-2004 Jon Nelson <jnelson@boa.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 1, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* $Id$ */
+
+/* Writes the binary access log: see binlog.h for the format */
+
+#include "boa.h"
+#include "binlog.h"
+#include <arpa/inet.h>          /* inet_pton */
+
+struct dict_slot {
+    char *s;                    /* NULL for a free slot */
+    unsigned int len;
+    unsigned int id;
+};
+
+/* open addressing, kept at most half full */
+static struct dict_slot dict[BINLOG_DICT_ENTRIES * 2];
+static unsigned int dict_entries;
+static unsigned long block_bytes;
+static time_t block_time;
+static int started;
+
+static unsigned char *put_varint(unsigned char *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char) v;
+    return p;
+}
+
+static unsigned char *put_string(unsigned char *p, const char *s,
+                                 unsigned int len)
+{
+    if (len > BINLOG_MAX_STRING)
+        len = BINLOG_MAX_STRING;
+    p = put_varint(p, len);
+    memcpy(p, s, len);
+    return p + len;
+}
+
+/* a whole record: its length, its type, and body */
+static unsigned char *put_record(unsigned char *p, enum BINLOG_RECORD type,
+                                 const unsigned char *body, unsigned int len)
+{
+    p = put_varint(p, len + 1);
+    *p++ = type;
+    memcpy(p, body, len);
+    return p + len;
+}
+
+static void dict_reset(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof (dict) / sizeof (dict[0]); ++i) {
+        free(dict[i].s);
+        dict[i].s = NULL;
+    }
+    dict_entries = 0;
+}
+
+/*
+ * Writes a ref to s into p.  A string seen for the first time in this
+ * block gets a BINLOG_DEFINE record, at *defs, first.
+ */
+static unsigned char *put_ref(unsigned char *p, unsigned char **defs,
+                              const char *s)
+{
+    unsigned int len, h, i;
+    unsigned char def[BINLOG_DICT_STRING + 8];
+
+    if (!s)
+        return put_varint(p, BINLOG_NONE);
+    len = strlen(s);
+    if (len > BINLOG_DICT_STRING) {
+        p = put_varint(p, BINLOG_LITERAL);
+        return put_string(p, s, len);
+    }
+
+    /* FNV-1a */
+    for (h = 2166136261u, i = 0; i < len; ++i)
+        h = (h ^ (unsigned char) s[i]) * 16777619u;
+    for (i = h & (BINLOG_DICT_ENTRIES * 2 - 1); dict[i].s;
+         i = (i + 1) & (BINLOG_DICT_ENTRIES * 2 - 1)) {
+        if (dict[i].len == len && !memcmp(dict[i].s, s, len))
+            return put_varint(p, BINLOG_DICT + dict[i].id);
+    }
+
+    dict[i].s = malloc(len + 1);
+    if (!dict[i].s) {
+        /* just don't remember it */
+        p = put_varint(p, BINLOG_LITERAL);
+        return put_string(p, s, len);
+    }
+    memcpy(dict[i].s, s, len + 1);
+    dict[i].len = len;
+    dict[i].id = dict_entries++;
+    *defs = put_record(*defs, BINLOG_DEFINE, def,
+                       put_string(def, s, len) - def);
+    return put_varint(p, BINLOG_DICT + dict[i].id);
+}
+
+/*
+ * Name: binlog_access
+ *
+ * Description: log_access for AccessLogBinary.  Everything for one
+ * request (a sync marker if one is due, dictionary entries, the
+ * record) goes out in one piece, through the access log writer
+ * thread if there is one.
+ */
+
+void binlog_access(request * req)
+{
+    static unsigned char out[MAX_LOG_RECORD], body[MAX_LOG_RECORD];
+    unsigned char *o = out, *defs, *b = body;
+    char addr[MAX_LOG_RECORD / 8];
+    unsigned int addr_len;
+    int64_t when;
+    int r;
+
+    /* a new block: the three refs below may each add an entry */
+    if (!started || block_bytes >= BINLOG_SYNC_BYTES ||
+        dict_entries + 3 > BINLOG_DICT_ENTRIES) {
+        dict_reset();
+        block_bytes = 0;
+        block_time = current_time;
+        started = 1;
+        memcpy(o, BINLOG_MAGIC, BINLOG_MAGIC_LEN);
+        o = put_varint(o + BINLOG_MAGIC_LEN, BINLOG_VERSION);
+        o = put_varint(o, (uint64_t) block_time);
+    }
+    defs = o;
+
+    when = (int64_t) current_time - block_time;
+    b = put_varint(b, (uint64_t) ((when << 1) ^ (when >> 63)));
+
+    if (!log_forwarded_for &&
+        inet_pton(AF_INET, req->remote_ip_addr, b + 1) == 1) {
+        *b = 4;
+        b += 5;
+#ifdef INET6
+    } else if (!log_forwarded_for &&
+               inet_pton(AF_INET6, req->remote_ip_addr, b + 1) == 1) {
+        *b = 16;
+        b += 17;
+#endif
+    } else {
+        *b++ = 0;
+        addr_len = format_remote_ip(req, addr, sizeof (addr));
+        b = put_string(b, addr, addr_len);
+    }
+
+    if (vhost_root)
+        b = put_ref(b, &defs, req->host);
+    else if (virtualhost)
+        b = put_ref(b, &defs, req->local_ip_addr);
+    else
+        b = put_varint(b, BINLOG_NONE);
+    b = put_string(b, (req->logline ? req->logline : ""),
+                   (req->logline ? strlen(req->logline) : 0));
+    b = put_varint(b, req->response_status);
+    b = put_varint(b, req->bytes_written);
+    b = put_varint(b, (req->bytes_in ? req->bytes_in :
+                       req->client_stream_pos));
+    b = put_varint(b, (req->time_start ?
+                       current_usec - req->time_start + 1 : 0));
+    b = put_varint(b, (req->time_start && req->time_first_byte ?
+                       req->time_first_byte - req->time_start + 1 : 0));
+    b = put_varint(b, ka_max - req->kacount);
+    *b++ = req->cache_result;
+    b = put_ref(b, &defs, req_header(req, H_REFERER));
+    b = put_ref(b, &defs, req_header(req, H_USER_AGENT));
+
+    o = put_record(defs, BINLOG_ACCESS, body, b - body);
+    block_bytes += o - out;
+
+    r = logring_write((char *) out, o - out);
+    if (r == 0) {
+        fwrite(out, 1, o - out, stdout);
+    } else if (r < 0) {
+        /* the reader never saw this record, and may have missed a sync
+         * marker or dictionary entries with it: start a new block */
+        started = 0;
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ *  Boa, an http server
+ *  Copyright (C) 1995 Paul Phillips <paulp@go2net.com>
+ *  Copyright (C) 1996-2005 Larry Doolittle <ldoolitt@boa.org>
+ *  Copyright (C) 1997-2004 Jon Nelson <jnelson@boa.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 1, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* $Id$ */
+
+#ifndef _BINLOG_H
+#define _BINLOG_H
+
+/*
+ * The binary access log (AccessLogBinary), written by binlog.c and read
+ * by boa_logcat (logcat.c).
+ *
+ * A varint is an unsigned number in 7 bit groups, least significant
+ * first, the high bit set on all but the last byte.  A string is a
+ * varint length and that many bytes.
+ *
+ * The log is a run of blocks, each one starting with a sync marker:
+ *
+ *   BINLOG_MAGIC (8 bytes)  varint version  varint base time (Unix)
+ *
+ * and going on with records, each one a varint length (of what follows
+ * it) and then a type byte:
+ *
+ *   BINLOG_DEFINE  string
+ *     The next dictionary entry: the first in a block is number 0.
+ *   BINLOG_ACCESS
+ *     varint  time - base time, zigzag coded
+ *     byte    address kind: 4 or 16 bytes of address follow, or 0 and
+ *             a string (X-Forwarded-For, or whatever else)
+ *     ref     virtual host
+ *     string  request line, empty if there wasn't one
+ *     varint  status, bytes sent, bytes read
+ *     varint  microseconds taken + 1, and to the first byte + 1
+ *             (0 if not known)
+ *     varint  keepalive requests before this one
+ *     byte    mmap cache: 0 not looked up, 1 hit, 2 miss (CACHE_RESULT)
+ *     ref     Referer
+ *     ref     User-Agent
+ *
+ * A ref is a varint: 0 for none, 1 and a string, or 2 + the number of
+ * a dictionary entry.  The dictionary starts empty in every block, so a
+ * reader can start at any sync marker (say, in the middle of an mmapped
+ * file) and skip any record it doesn't know by its length.
+ */
+
+#define BINLOG_MAGIC "\xb0\x61log\r\n\x1a"
+#define BINLOG_MAGIC_LEN 8
+#define BINLOG_VERSION 1
+
+enum BINLOG_RECORD { BINLOG_DEFINE = 1, BINLOG_ACCESS };
+
+enum BINLOG_REF { BINLOG_NONE, BINLOG_LITERAL, BINLOG_DICT };
+
+#define BINLOG_SYNC_BYTES 65536 /* a sync marker at least this often */
+#define BINLOG_DICT_ENTRIES 4096 /* at most, a new block after that */
+#define BINLOG_DICT_STRING 512  /* longer strings are written out */
+#define BINLOG_MAX_STRING 1024  /* longer strings are cut short */
+
+#endif
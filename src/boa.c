@@ -35,6 +35,7 @@ int sigchld_flag = 0;           /* 1 => signal has happened, needs attention */
 int sigalrm_flag = 0;           /* 1 => signal has happened, needs attention */
 int sigterm_flag = 0;           /* lame duck mode */
 time_t current_time;
+uint64_t current_usec;
 int pending_requests = 0;
 int override_server_port;
 const char *override_server_ip;
@@ -61,7 +62,7 @@ int main(int argc, char *argv[])
     umask(077);
 
     /* but first, update timestamp, because log_error_time uses it */
-    (void) time(&current_time);
+    update_clock();
 
     /* set timezone right away */
     tzset();
@@ -89,7 +90,7 @@ int main(int argc, char *argv[])
     open_logs();
     server_s = create_server_socket();
     init_signals();
-    build_needs_escape();
+    build_escape_table();
 
     /* background ourself */
     if (do_fork) {
@@ -123,6 +124,8 @@ int main(int argc, char *argv[])
         break;
     }
 
+    errlog_init();
+    logring_start();
     drop_privs();
     /* main loop */
     timestamp();
@@ -51,11 +51,14 @@
 #include "compat.h"             /* oh what fun is porting */
 #include "defines.h"
 #include "globals.h"
+#include "probes.h"             /* USDT, if there's sys/sdt.h */
 
 /* alias */
 void add_alias(const char *fakename, const char *realname, enum ALIAS type);
+void build_alias_trie(void);
 int translate_uri(request * req);
 void dump_alias(void);
+void alias_show_stats(void);
 
 /* config */
 void read_config_files(void);
@@ -69,8 +72,9 @@ int process_get(request * req);
 int get_dir(request * req, struct stat *statbuf);
 
 /* hash */
-unsigned get_mime_hash_value(const char *extension);
+void build_mime_table(void);
 char *get_mime_type(const char *filename);
+const char *get_content_type(const char *filename, unsigned int *len);
 char *get_home_dir(const char *name);
 void dump_mime(void);
 void dump_passwd(void);
@@ -79,8 +83,11 @@ void add_mime_type(const char *extension, const char *type);
 
 /* log */
 void open_logs(void);
+void compile_log_format(void);
+unsigned int format_remote_ip(request * req, char *buf, unsigned int len);
 void log_access(request * req);
 void log_error_doc(request * req);
+unsigned int format_error_doc(request * req, char *buf, unsigned int len);
 void boa_perror(request * req, const char *message);
 void log_error_time(void);
 void log_error(const char *mesg);
@@ -92,17 +99,75 @@ void log_error_mesg(const char *file, int line, const char *mesg);
 void log_error_mesg_fatal(const char *file, int line, const char *mesg);
 #endif
 
+/* binlog */
+void binlog_access(request * req);
+
+/* metrics */
+void note_accept(void);
+void note_state(request * req, enum REQ_STATUS was);
+void latency_record(request * req);
+void latency_show_stats(void);
+int init_status(request * req);
+const char *request_state_name(enum REQ_STATUS s);
+
+/* slowlog */
+void open_slow_log(void);
+void slow_trace(request * req);
+void slow_reaped(pid_t pid, int child_status);
+void slow_log(request * req);
+
+/* errlog */
+void errlog_doc(request * req, enum ERRLOG_SITE site, int err);
+void errlog_flush(void);
+void errlog_init(void);
+int errlog_timeout(void);
+void errlog_show_stats(void);
+
+#ifdef SERVER_TIMING
+/* timing */
+int timing_add(const char *v1);
+void timing_clear(void);
+void timing_check(request * req);
+void print_server_timing(request * req);
+#endif
+
+/* logrule */
+int log_rule_add(enum LOG_RULE kind, const char *v1, const char *v2);
+void log_rule_clear(void);
+int log_rule_wanted(request * req);
+void log_rule_show_stats(void);
+
+/* logring */
+void logring_start(void);
+void logring_stop(void);
+int logring_write(const char *rec, unsigned int len);
+void logring_show_stats(void);
+
 /* queue */
 void block_request(request * req);
 void ready_request(request * req);
 void dequeue(request ** head, request * req);
 void enqueue(request ** head, request * req);
 
+/* h2 */
+int h2_preface(request * req);
+int h2_upgrade(request * req);
+int h2_process(request * conn);
+int h2_writing(request * conn);
+int h2_idle(request * conn);
+void h2_refuse(request * req);
+void h2_close(request * conn);
+
 /* read */
 int read_header(request * req);
 int read_body(request * req);
 int write_body(request * req);
 
+/* scan */
+const char *scan_header(const char *p, const char *end);
+const char *scan_uri(const char *uri);
+int normalize_uri(char *uri, char **query_string);
+
 /* request */
 request *new_request(void);
 void get_request(int);
@@ -111,8 +176,12 @@ int process_header_end(request * req);
 int process_header_line(request * req);
 int process_logline(request * req);
 int process_option_line(request * req);
+int add_header_env(request * req);
+struct header_field *find_header(request * req, const char *name,
+                                 unsigned int len);
 void add_accept_header(request * req, const char *mime_type);
 void free_requests(void);
+void free_request(request * req);
 
 /* response */
 const char *http_ver_string(enum HTTP_VERSION ver);
@@ -146,6 +215,7 @@ void send_r_not_implemented(request * req); /* 501 */
 void send_r_bad_gateway(request * req); /* 502 */
 void send_r_service_unavailable(request * req); /* 503 */
 void send_r_bad_version(request * req, const char * version); /* 505 */
+void send_r_http2_required(request * req); /* HTTP/2 GOAWAY */
 
 /* cgi */
 void create_common_env(void);
@@ -153,6 +223,8 @@ void add_to_common_env(char *key, char *value);
 void clear_common_env(void);
 int add_cgi_env(request * req, const char *key, const char *value, int http_prefix);
 int init_cgi(request * req);
+int finish_cgi_body(request * req);
+int discard_cgi_body(request * req);
 
 /* signals */
 void init_signals(void);
@@ -160,11 +232,15 @@ void reset_signals(void);
 void sighup_run(void);
 void sigchld_run(void);
 void sigalrm_run(void);
+int run_timers(void);
 void sigterm_stage1_run(void);
 void sigterm_stage2_run(void);
 
 /* util.c */
 void clean_pathname(char *pathname);
+uint64_t monotonic_usec(void);
+void update_clock(void);
+const char *request_host(request * req);
 char *get_commonlog_time(void);
 void rfc822_time_buf(char *buf, time_t s);
 char *simple_itoa(uint64_t i);
@@ -173,6 +249,7 @@ int month2int(const char *month);
 int modified_since(time_t * mtime, const char *if_modified_since);
 int unescape_uri(char *uri, char **query_string);
 int create_temporary_file(short want_unlink, char *storage, unsigned int size);
+int create_spool_file(off_t size);
 int real_set_block_fd(int fd);
 int real_set_nonblock_fd(int fd);
 char *to_upper(char *str);
@@ -186,6 +263,7 @@ void print_debug_usage(void);
 
 /* buffer */
 int req_write(request * req, const char *msg);
+int req_write_len(request * req, const char *msg, unsigned int msg_len);
 void reset_output_buffer(request * req);
 int req_write_escape_http(request * req, const char *msg);
 int req_write_escape_html(request * req, const char *msg);
@@ -202,6 +280,7 @@ void release_mmap(struct mmap_entry *e);
 
 /* sublog */
 int open_gen_fd(char *spec);
+int parse_cgi_header(request * req);
 int process_cgi_header(request * req);
 
 /* pipe */
@@ -217,6 +296,10 @@ int io_shuffle_sendfile(request * req);
 int bind_server(int sock, char *ip, unsigned int port);
 char *ascii_sockaddr(struct SOCKADDR *s, char *dest, unsigned int len);
 int net_port(struct SOCKADDR *s);
+int ip_acl_add(const char *cidr, int allow);
+void ip_acl_clear(void);
+int ip_acl_allow(struct SOCKADDR *s);
+void ip_acl_show_stats(void);
 
 /* select or poll */
 void loop(int server_s);
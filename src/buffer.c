@@ -23,7 +23,6 @@
 /* $Id: buffer.c,v 1.10.2.14 2005/02/22 14:11:29 jnelson Exp $ */
 
 #include "boa.h"
-#include "escape.h"
 
 
 /*
@@ -35,10 +34,18 @@
 
 int req_write(request * req, const char *msg)
 {
-    unsigned int msg_len;
+    return req_write_len(req, msg, strlen(msg));
+}
 
-    msg_len = strlen(msg);
+/*
+ * Name: req_write_len
+ *
+ * Description: Like req_write, for when the length of msg is known
+ * already.
+ */
 
+int req_write_len(request * req, const char *msg, unsigned int msg_len)
+{
     if (!msg_len || req->status > DONE)
         return req->buffer_end;
 
@@ -67,61 +74,46 @@ void reset_output_buffer(request * req)
 }
 
 /*
- * Name: req_write_escape_http
- * Description: Buffers and "escapes" data before sending to client.
- *  as above, but translates as it copies, into a form suitably
- *  encoded for URLs in HTTP headers.
+ * Name: req_write_escape
+ * Description: Buffers and escapes msg, the way how says.  The whole
+ * of it goes in or, if there isn't room, nothing does and the
+ * connection is shut down.
  * Returns: -1 for error, otherwise how much is stored
  */
-int req_write_escape_http(request * req, const char *msg)
+static int req_write_escape(request * req, const char *msg,
+                            enum ESCAPE how, const char *caller)
 {
-    char c, *dest;
-    const char *inp;
-    int left;
-    int skip = 0;
+    unsigned int len, left;
 
-    inp = msg;
-    dest = req->buffer + req->buffer_end;
-    /* 3 is a guard band, since we don't check the destination pointer
-     * in the middle of a transfer of up to 3 bytes */
+    len = strlen(msg);
     left = BUFFER_SIZE - req->buffer_end;
-    while ((c = *inp++) && left >= 3) {
-        /* Lower the skip character count. */
-        if (skip) skip--;
-        /* If we have a '%', we skip the two follow characters. */
-        if (c == '%') skip = 2;
-
-        if (!skip && needs_escape((unsigned int) c)) {
-            *dest++ = '%';
-            *dest++ = INT_TO_HEX((c >> 4) & 0xf);
-            *dest++ = INT_TO_HEX(c & 0xf);
-            left -= 3;
-        } else {
-            *dest++ = c;
-            left--;
-        }
-    }
-    --inp;
-    req->buffer_end = dest - req->buffer;
-
-#ifdef TESTING
-    if (left < 0) {
-        log_error_time(); /* don't use log_error_doc here */
-        fprintf(stderr, "Overflowed buffer space!\n");
-        chdir("/tmp");
-        abort();
-    }
-#endif
-
-    if (*inp != '\0') {
+    /* only count exactly when the worst case wouldn't fit */
+    if (len * escape_expansion[how] >= left &&
+        escape_length(msg, len, how) >= left) {
         log_error_doc(req);
-        fprintf(stderr, "Ran out of Buffer space! [req_write_escape_http]\n");
+        fprintf(stderr, "Ran out of Buffer space (%u chars left)! [%s]\n",
+                left, caller);
         req->status = DEAD;
         return -1;
     }
+    req->buffer_end = escape_into(req->buffer + req->buffer_end, msg, len,
+                                  how) - req->buffer;
     return req->buffer_end;
 }
 
+/*
+ * Name: req_write_escape_http
+ * Description: Buffers and "escapes" data before sending to client.
+ *  as above, but translates as it copies, into a form suitably
+ *  encoded for URLs in HTTP headers.  Existing %xx escapes are left
+ *  alone.
+ * Returns: -1 for error, otherwise how much is stored
+ */
+int req_write_escape_http(request * req, const char *msg)
+{
+    return req_write_escape(req, msg, ESCAPE_URL, "req_write_escape_http");
+}
+
 /*
  * Name: req_write_escape_html
  * Description: Buffers and "escapes" data before sending to client.
@@ -131,74 +123,7 @@ int req_write_escape_http(request * req, const char *msg)
  */
 int req_write_escape_html(request * req, const char *msg)
 {
-    char c, *dest;
-    const char *inp;
-    int left;
-
-    inp = msg;
-    dest = req->buffer + req->buffer_end;
-    /* 6 is a guard band, since we don't check the destination pointer
-     * in the middle of a transfer of up to 6 bytes
-     */
-    left = BUFFER_SIZE - req->buffer_end;
-    while ((c = *inp++) && left >= 6) {
-        switch (c) {
-        case '>':
-            *dest++ = '&';
-            *dest++ = 'g';
-            *dest++ = 't';
-            *dest++ = ';';
-            left -= 4;
-            break;
-        case '<':
-            *dest++ = '&';
-            *dest++ = 'l';
-            *dest++ = 't';
-            *dest++ = ';';
-            left -= 4;
-            break;
-        case '&':
-            *dest++ = '&';
-            *dest++ = 'a';
-            *dest++ = 'm';
-            *dest++ = 'p';
-            *dest++ = ';';
-            left -= 5;
-            break;
-        case '\"':
-            *dest++ = '&';
-            *dest++ = 'q';
-            *dest++ = 'u';
-            *dest++ = 'o';
-            *dest++ = 't';
-            *dest++ = ';';
-            left -= 6;
-            break;
-        default:
-            *dest++ = c;
-            left--;
-        }
-    }
-    --inp;
-    req->buffer_end = dest - req->buffer;
-
-#ifdef TESTING
-    if (left < 0) {
-        log_error_time(); /* don't use log_error_doc here */
-        fprintf(stderr, "Overflowed buffer space! [req_write_escape_html]\n");
-        chdir("/tmp");
-        abort();
-    }
-#endif
-
-    if (*inp != '\0') {
-        log_error_doc(req);
-        fprintf(stderr, "Ran out of Buffer space (%d chars left)! "
-                "[req_write_escape_html]\n", left);
-        req->status = DEAD;
-        return -1;
-    }
-    return req->buffer_end;
+    return req_write_escape(req, msg, ESCAPE_HTML, "req_write_escape_html");
 }
 
 
@@ -218,6 +143,9 @@ int req_flush(request * req)
     if (req->status > DONE)
         return -2;
 
+    if (req->h2_id)
+        return req->buffer_end; /* h2.c frames it, see stream_send */
+
     if (bytes_to_write) {
         off_t bytes_written;
 
@@ -234,8 +162,7 @@ int req_flush(request * req)
                 if (errno != ECONNRESET && errno != EPIPE)
 #endif
                 {
-                    log_error_doc(req);
-                    perror("buffer flush");
+                    errlog_doc(req, ERRLOG_FLUSH, errno);
                 }
                 req->status = DEAD;
                 req->buffer_end = 0;
@@ -249,7 +176,9 @@ int req_flush(request * req)
                bytes_written, stderr);
         fprintf(stderr, "\" (%d bytes)\n", bytes_written);
 #endif
+        BOA_PROBE3(write, req, req->fd, bytes_written);
         req->buffer_start += bytes_written;
+        note_first_byte(req);
     }
     if (req->buffer_start == req->buffer_end)
         req->buffer_start = req->buffer_end = 0;
@@ -266,41 +195,19 @@ int req_flush(request * req)
  *  could be up to 3 times the size of inp.  If the routine dynamically
  *  allocates the space, the user is responsible for freeing it afterwords
  * Returns: NULL on error, pointer to string otherwise.
- * Note: this function doesn't really belong here, I plopped it here to
- *  work around a "bug" in escape.h (it defines a global, so can't be
- *  used in multiple source files).  Actually, this routine shouldn't
- *  exist anywhere, it's only usage is in get.c's handling of on-the-fly
- *  directory generation, which would be better configured to use a combination
- *  of req_write_escape_http and req_write_escape_html.  That would involve
- *  more work than I'm willing to put in right now, though, so here we are.
  */
 
 char *escape_string(const char *inp, char *buf)
 {
-    int max;
-    char *ix;
-    unsigned char c;
-
-    max = strlen(inp) * 3;
-
-    if (buf == NULL && max)
-        buf = malloc(sizeof (char) * (max + 1));
+    if (buf) {
+        escape_into(buf, inp, strlen(inp), ESCAPE_URI);
+        return buf;
+    }
 
+    buf = escape_alloc(inp, ESCAPE_URI);
     if (buf == NULL) {
         log_error_time();
         perror("malloc");
-        return NULL;
-    }
-
-    ix = buf;
-    while ((c = *inp++) && max > 0) {
-        if (needs_escape((unsigned int) c)) {
-            *ix++ = '%';
-            *ix++ = INT_TO_HEX((c >> 4) & 0xf);
-            *ix++ = INT_TO_HEX(c & 0xf);
-        } else
-            *ix++ = c;
     }
-    *ix = '\0';
     return buf;
 }
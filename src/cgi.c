@@ -233,6 +233,11 @@ static int complete_env(request * req)
     for (i = 0; common_cgi_env[i]; i++)
         req->cgi_env[i] = common_cgi_env[i];
 
+    /* first, as when they were added while the header was read: where
+     * a name repeats, the variables below win */
+    if (!add_header_env(req))
+        return 0;
+
     {
         const char *w;
         switch (req->method) {
@@ -252,8 +257,8 @@ static int complete_env(request * req)
         my_add_cgi_env(req, "REQUEST_METHOD", w);
     }
 
-    if (req->header_host)
-        my_add_cgi_env(req, "HTTP_HOST", req->header_host);
+    if (req_header(req, H_HOST))
+        my_add_cgi_env(req, "HTTP_HOST", req_header(req, H_HOST));
     my_add_cgi_env(req, "SERVER_ADDR", req->local_ip_addr);
     my_add_cgi_env(req, "SERVER_PROTOCOL",
                    http_ver_string(req->http_version));
@@ -277,13 +282,19 @@ static int complete_env(request * req)
     my_add_cgi_env(req, "REMOTE_PORT", simple_itoa(req->remote_port));
 
     if (req->method == M_POST) {
-        if (req->content_type) {
-            my_add_cgi_env(req, "CONTENT_TYPE", req->content_type);
+        if (req_header(req, H_CONTENT_TYPE)) {
+            my_add_cgi_env(req, "CONTENT_TYPE",
+                           req_header(req, H_CONTENT_TYPE));
         } else {
             my_add_cgi_env(req, "CONTENT_TYPE", default_type);
         }
-        if (req->content_length) {
-            my_add_cgi_env(req, "CONTENT_LENGTH", req->content_length);
+        if (req_header(req, H_CONTENT_LENGTH)) {
+            my_add_cgi_env(req, "CONTENT_LENGTH",
+                           req_header(req, H_CONTENT_LENGTH));
+        } else if (req->chunked_body && !req->stream_body) {
+            /* the spooled body is complete by now */
+            my_add_cgi_env(req, "CONTENT_LENGTH",
+                           simple_itoa(req->filesize));
         }
     }
 #ifdef ACCEPT_ON
@@ -389,6 +400,78 @@ static void create_argv(request * req, char **aargv)
     }
 }
 
+/*
+ * Name: init_cgi_output
+ *
+ * Description: Gets the request ready to collect the output of a
+ * freshly started CGI (or directory maker) from req->data_fd.
+ */
+
+static void init_cgi_output(request * req)
+{
+    req->status = PIPE_READ;
+    if (req->cgi_type == CGI) {
+        req->cgi_status = CGI_PARSE; /* got to parse cgi header */
+        /* for cgi_header... I get half the buffer! */
+        req->header_line = req->header_end =
+            (req->buffer + BUFFER_SIZE / 2);
+        req->cgi_scan = req->header_line;
+        req->cgi_content_length = -1;
+    } else {
+        req->cgi_status = CGI_BUFFER;
+        /* I get all the buffer! */
+        req->header_line = req->header_end = req->buffer;
+    }
+
+    /* reset req->filepos for logging (it's used in pipe.c) */
+    /* still don't know why req->filesize might be reset though */
+    req->filepos = 0;
+}
+
+/*
+ * Name: finish_cgi_body
+ *
+ * Description: Called once a streamed POST body (StreamScriptAlias)
+ * has been handed to the CGI, or the CGI stopped reading it.
+ * Closes the CGI's stdin so it sees EOF, and starts reading its output.
+ *
+ * Returns:
+ * 1 - success
+ */
+
+int finish_cgi_body(request * req)
+{
+    if (req->post_data_fd) {
+        close(req->post_data_fd);
+        req->post_data_fd = 0;
+    }
+    init_cgi_output(req);
+    return 1;
+}
+
+/*
+ * Name: discard_cgi_body
+ *
+ * Description: Called when a StreamScriptAlias CGI exits (or closes
+ * its stdin) before it has read the whole body.  The rest of the body
+ * is still read, and dropped: closing the connection with unread data
+ * in it would have the kernel send a reset, which can destroy the
+ * response before the client has seen it.  finish_cgi_body is called
+ * once the body is done, as usual.
+ *
+ * Returns:
+ * 1 - success
+ */
+
+int discard_cgi_body(request * req)
+{
+    close(req->post_data_fd);
+    req->post_data_fd = 0;
+    req->discard_body = 1;
+    req->status = BODY_WRITE;   /* drop what is buffered first */
+    return 1;
+}
+
 /*
  * Name: init_cgi
  *
@@ -397,6 +480,10 @@ static void create_argv(request * req, char **aargv)
  * stdin to data if POST, and execs CGI.
  * stderr remains tied to our log file; is this good?
  *
+ * For StreamScriptAlias POSTs this is called before the body has been
+ * read: stdin is tied to a pipe whose (non-blocking) write end is kept
+ * in req->post_data_fd, and the body is pumped through it afterwards.
+ *
  * Returns:
  * 0 - error or NPH, either way the socket is closed
  * 1 - success
@@ -406,8 +493,15 @@ int init_cgi(request * req)
 {
     int child_pid;
     int pipes[2];
+    int post_pipes[2];
     int use_pipes = 0;
 
+    if (req->h2_id) {
+        /* not over HTTP/2, see h2.c */
+        h2_refuse(req);
+        return 0;
+    }
+
     SQUASH_KA(req);
 
     if (req->cgi_type) {
@@ -447,6 +541,45 @@ int init_cgi(request * req)
         }
     }
 
+    if (req->method == M_POST && req->stream_body) {
+        if (pipe(post_pipes) == -1) {
+            log_error_doc(req);
+            perror("pipe");
+            if (use_pipes) {
+                close(pipes[0]);
+                close(pipes[1]);
+            }
+            return 0;
+        }
+        /* our end must not block, and must not leak into other CGIs,
+         * or this one would never see EOF on its stdin
+         */
+        if (set_nonblock_fd(post_pipes[1]) == -1 ||
+            fcntl(post_pipes[1], F_SETFD, 1) == -1) {
+            log_error_doc(req);
+            perror("cgi-fcntl");
+            close(post_pipes[0]);
+            close(post_pipes[1]);
+            if (use_pipes) {
+                close(pipes[0]);
+                close(pipes[1]);
+            }
+            return 0;
+        }
+        /* the read end is handed to the child just like a tmpfile */
+        req->post_data_fd = post_pipes[0];
+#ifdef F_SETPIPE_SZ
+        /* nothing reads the output until the body is in; a script that
+         * fills its stdout pipe before that stalls until the request
+         * times out, so let the pipe take more.  Failing is harmless:
+         * pipe-max-size may be lower, and then the default stays.
+         */
+        if (use_pipes)
+            fcntl(pipes[0], F_SETPIPE_SZ, CGI_STREAM_PIPE_SIZE);
+#endif
+    }
+
+    timing_begin(req);
     child_pid = fork();
     switch (child_pid) {
     case -1:
@@ -460,6 +593,8 @@ int init_cgi(request * req)
             close(pipes[0]);
             close(pipes[1]);
         }
+        if (req->method == M_POST && req->stream_body)
+            close(post_pipes[1]);
         return 0;
         break;
     case 0:
@@ -543,7 +678,8 @@ int init_cgi(request * req)
         }
         /* tie post_data_fd to POST stdin */
         if (req->method == M_POST) { /* tie stdin to file */
-            lseek(req->post_data_fd, SEEK_SET, 0);
+            if (!req->stream_body)
+                lseek(req->post_data_fd, SEEK_SET, 0);
             dup2(req->post_data_fd, STDIN_FILENO);
             close(req->post_data_fd);
         }
@@ -648,6 +784,10 @@ int init_cgi(request * req)
     default:
         /* parent */
         /* if here, fork was successful */
+        timing_end(req, TIMING_CGI);
+        req->cgi_pid = child_pid;
+        BOA_PROBE3(cgi_fork, req, child_pid, req->pathname);
+        status.cgi_spawns++;
         if (verbose_cgi_logs) {
             log_error_time();
             fprintf(stderr, "Forked child \"%s\" pid %d\n",
@@ -666,21 +806,15 @@ int init_cgi(request * req)
         close(pipes[1]);
         req->data_fd = pipes[0];
 
-        req->status = PIPE_READ;
-        if (req->cgi_type == CGI) {
-            req->cgi_status = CGI_PARSE; /* got to parse cgi header */
-            /* for cgi_header... I get half the buffer! */
-            req->header_line = req->header_end =
-                (req->buffer + BUFFER_SIZE / 2);
-        } else {
-            req->cgi_status = CGI_BUFFER;
-            /* I get all the buffer! */
-            req->header_line = req->header_end = req->buffer;
+        if (req->method == M_POST && req->stream_body) {
+            /* read_header moves us on to BODY_WRITE; the output is
+             * collected once finish_cgi_body closes the child's stdin
+             */
+            req->post_data_fd = post_pipes[1];
+            break;
         }
 
-        /* reset req->filepos for logging (it's used in pipe.c) */
-        /* still don't know why req->filesize might be reset though */
-        req->filepos = 0;
+        init_cgi_output(req);
         break;
     }
 
@@ -21,6 +21,10 @@
 
 #include "boa.h"
 
+/* any off_t below this can take another digit */
+#define OFF_T_TENTH \
+    ((off_t) ((1ULL << (sizeof (off_t) * 8 - 1)) / 10 - 1))
+
 /* process_cgi_header
 
 * returns 0 -=> error or HEAD, close down.
@@ -42,6 +46,91 @@
  MUST NOT supply any HTTP-Fields.
  */
 
+/*
+ * Name: parse_cgi_header
+ *
+ * Description: Parses the lines of the CGI's header that have come in
+ * since last time, starting at req->cgi_scan, so a CGI that writes its
+ * header a few bytes at a time doesn't get it rescanned each time.
+ * Notes where the Status, Location and Content-Type lines are and
+ * what the Content-Length is.
+ *
+ * Returns: 1 once the blank line that ends the header has been seen
+ * (req->cgi_body then points past it), 0 if there's more to come.
+ */
+
+int parse_cgi_header(request * req)
+{
+    char *line, *nl, *end, *colon, *value;
+    unsigned int len;
+    off_t length;
+
+    if (req->cgi_body)
+        return 1;
+
+    line = req->cgi_scan;
+    while ((nl = memchr(line, '\n', req->header_end - line)) != NULL) {
+        end = nl;
+        if (end > line && end[-1] == '\r')
+            --end;
+        if (end == line) {
+            req->cgi_body = nl + 1;
+            req->cgi_scan = req->cgi_body;
+            return 1;
+        }
+
+        colon = memchr(line, ':', end - line);
+        if (colon) {
+            value = colon + 1;
+            while (value < end && (*value == ' ' || *value == '\t'))
+                ++value;
+            len = colon - line;
+            if (len == 6 && !strncasecmp(line, "Status", 6)) {
+                req->cgi_status_line.offset = line - req->buffer;
+                req->cgi_status_line.length = nl + 1 - line;
+            } else if (len == 8 && !strncasecmp(line, "Location", 8)) {
+                req->cgi_location_line.offset = line - req->buffer;
+                req->cgi_location_line.length = nl + 1 - line;
+            } else if (len == 12 && !strncasecmp(line, "Content-Type", 12)) {
+                req->cgi_content_type.offset = value - req->buffer;
+                req->cgi_content_type.length = end - value;
+            } else if (len == 14 &&
+                       !strncasecmp(line, "Content-Length", 14)) {
+                for (length = 0; value < end && isdigit((unsigned char) *value)
+                     && length < OFF_T_TENTH; ++value)
+                    length = length * 10 + (*value - '0');
+                req->cgi_content_length = (value == end ? length : -1);
+            }
+        }
+        line = nl + 1;
+    }
+    req->cgi_scan = line;
+    return 0;
+}
+
+/*
+ * Name: cgi_header_to_front
+ * Description: Moves one line of the CGI's header (one that
+ * parse_cgi_header found) to the front, keeping the others in order.
+ */
+
+static void cgi_header_to_front(request * req, struct slice *line)
+{
+    static char tmp[BUFFER_SIZE];
+    char *start = req->buffer + line->offset;
+    unsigned int before = start - req->header_line;
+
+    if (!before)
+        return;
+    memcpy(tmp, start, line->length);
+    memmove(req->header_line + line->length, req->header_line, before);
+    memcpy(req->header_line, tmp, line->length);
+    if (req->cgi_content_type.length &&
+        req->cgi_content_type.offset < line->offset)
+        req->cgi_content_type.offset += line->length;
+    line->offset = req->header_line - req->buffer;
+}
+
 /* TODO:
  We still need to cycle through the data before the end of the headers,
  line-by-line, and check for any problems with the CGI
@@ -50,52 +139,52 @@
 
 int process_cgi_header(request * req)
 {
-    char *buf;
-    char *c;
+    char *buf, *c;
 
     if (req->cgi_status != CGI_DONE)
         req->cgi_status = CGI_BUFFER;
 
-    buf = req->header_line;
-
-    c = strstr(buf, "\n\r\n");
-    if (c == NULL) {
-        c = strstr(buf, "\n\n");
-        if (c == NULL) {
-            log_error_doc(req);
-            fputs("cgi_header: unable to find LFLF\n", stderr);
+    if (!parse_cgi_header(req)) {
+        log_error_doc(req);
+        fputs("cgi_header: unable to find LFLF\n", stderr);
 #ifdef FASCIST_LOGGING
-            log_error_time();
-            fprintf(stderr, "\"%s\"\n", buf);
+        log_error_time();
+        fprintf(stderr, "\"%s\"\n", req->header_line);
 #endif
-            send_r_bad_gateway(req);
-            return 0;
-        }
+        send_r_bad_gateway(req);
+        return 0;
     }
     if (req->http_version == HTTP09) {
-        if (*(c + 1) == '\r')
-            req->header_line = c + 2;
-        else
-            req->header_line = c + 1;
+        req->header_line = req->cgi_body;
         return 1;
     }
-    if (!strncasecmp(buf, "Status: ", 8)) {
-        req->header_line--;
+    if (req->cgi_status_line.length) {
+        /* "Status: " becomes "HTTP/1.0 ", with one byte to spare
+         * in front of the CGI data */
+        cgi_header_to_front(req, &req->cgi_status_line);
+        buf = req->header_line + 6; /* the ':' */
+        while (buf[1] == ' ' || buf[1] == '\t')
+            ++buf;
+        req->header_line = buf - 8;
         memcpy(req->header_line, "HTTP/1.0 ", 9);
-    } else if (!strncasecmp(buf, "Location: ", 10)) { /* got a location header */
+    } else if (req->cgi_location_line.length) { /* got a location header */
+        cgi_header_to_front(req, &req->cgi_location_line);
+        buf = req->header_line + 9; /* past the ':' */
+        while (*buf == ' ' || *buf == '\t')
+            ++buf;
 #ifdef FASCIST_LOGGING
 
         log_error_time();
         fprintf(stderr, "%s:%d - found Location header \"%s\"\n",
-                __FILE__, __LINE__, buf + 10);
+                __FILE__, __LINE__, buf);
 #endif
 
 
-        if (buf[10] == '/') {   /* virtual path */
+        if (buf[0] == '/') {    /* virtual path */
             log_error_doc(req);
             fprintf(stderr,
                     "server does not support internal redirection: "
-                    "\"%s\"\n", buf + 10);
+                    "\"%.*s\"\n", (int) strcspn(buf, "\r\n"), buf);
             send_r_bad_request(req);
 
             /*
@@ -113,23 +202,23 @@ int process_cgi_header(request * req)
              */
         } else {                /* URL */
             char *c2;
-            c2 = strchr(buf + 10, '\n');
-            /* c2 cannot ever equal NULL here because we already have found one */
 
-            --c2;
-            while (*c2 == '\r')
+            /* end the URL, and the rest of the header before the
+             * line end in front of the blank line */
+            c2 = req->header_line + req->cgi_location_line.length - 1;
+            if (c2[-1] == '\r')
                 --c2;
-            ++c2;
-            /* c2 now points to a '\r' or the '\n' */
-            *c2++ = '\0';       /* end header */
-
-            /* first next header, or is at req->header_end */
-            while ((*c2 == '\n' || *c2 == '\r') && c2 < req->header_end)
-                ++c2;
-            if (c2 == req->header_end)
-                send_r_moved_temp(req, buf + 10, "");
-            else
-                send_r_moved_temp(req, buf + 10, c2);
+            *c2 = '\0';
+            c2 = req->header_line + req->cgi_location_line.length;
+            c = req->cgi_body - 1;
+            if (c > c2 && c[-1] == '\r')
+                --c;
+            if (c > c2)
+                --c;
+            if (c > c2 && c[-1] == '\r')
+                --c;
+            *c = '\0';
+            send_r_moved_temp(req, buf, c2);
         }
         req->status = DONE;
         return 1;
@@ -145,10 +234,7 @@ int process_cgi_header(request * req)
          */
         dest = req->buffer + req->buffer_end;
         if (req->method == M_HEAD) {
-            if (*(c + 1) == '\r')
-                req->header_end = c + 2;
-            else
-                req->header_end = c + 1;
+            req->header_end = req->cgi_body;
             req->cgi_status = CGI_DONE;
         }
         howmuch = req->header_end - req->header_line;
@@ -77,6 +77,10 @@
 #define MAP_OPTIONS MAP_FILE|MAP_PRIVATE /* Linux */
 #endif
 
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON  /* BSD */
+#endif
+
 #include <netdb.h>
 #ifdef INET6
 /* #define S_FAMILY __s_family */
@@ -58,15 +58,26 @@ unsigned int cgi_umask = 027;
 char *pid_file;
 char *cgi_path;
 int single_post_limit = SINGLE_POST_LIMIT_DEFAULT;
+int memory_spool_limit = MEMORY_SPOOL_LIMIT_DEFAULT;
 int conceal_server_identity = 0;
 
 int ka_timeout;
+int http2;
 unsigned int default_timeout;
 unsigned int ka_max;
 
 /* These came from log.c */
 char *error_log_name;
+int error_log_rate = ERRLOG_RATE_DEFAULT;
+char *status_uri;
+int stats_interval;
+int slow_request_threshold;
+char *slow_log_name;
 char *access_log_name;
+int access_log_buffer;
+char *access_log_full;
+char *log_format;
+int access_log_binary;
 char *cgi_log_name;
 
 int use_localtime;
@@ -92,6 +103,9 @@ static void c_add_mime_types_file(char *v1, char *v2, void *t);
 static void c_add_mime_type(char *v1, char *v2, void *t);
 static void c_add_alias(char *v1, char *v2, void *t);
 static void c_add_access(char *v1, char *v2, void *t);
+static void c_add_ip_rule(char *v1, char *v2, void *t);
+static void c_add_log_rule(char *v1, char *v2, void *t);
+static void c_add_server_timing(char *v1, char *v2, void *t);
 
 struct ccommand {
     const char *name;
@@ -109,10 +123,16 @@ static void parse(FILE * f);
 /* Fakery to keep the value passed to action() a void *,
    see usage in table and c_add_alias() below */
 static enum ALIAS script_number = SCRIPTALIAS;
+static enum ALIAS stream_script_number = STREAMSCRIPTALIAS;
 static enum ALIAS redirect_number = REDIRECT;
 static enum ALIAS alias_number = ALIAS;
 static int access_allow_number = ACCESS_ALLOW;
 static int access_deny_number = ACCESS_DENY;
+static int ip_allow_number = 1;
+static int ip_deny_number = 0;
+static enum LOG_RULE log_never_number = LOG_NEVER;
+static enum LOG_RULE log_always_number = LOG_ALWAYS;
+static enum LOG_RULE log_sample_number = LOG_SAMPLE;
 static uid_t current_uid = 0;
 
 /* Help keep the table below compact */
@@ -137,7 +157,20 @@ struct ccommand clist[] = {
     {"ServerRoot", S1A, c_set_string, &server_root},
     {"UseLocaltime", S0A, c_set_unity, &use_localtime},
     {"ErrorLog", S1A, c_set_string, &error_log_name},
+    {"ErrorLogRate", S1A, c_set_int, &error_log_rate},
     {"AccessLog", S1A, c_set_string, &access_log_name},
+    {"AccessLogBuffer", S1A, c_set_int, &access_log_buffer},
+    {"AccessLogFull", S1A, c_set_string, &access_log_full},
+    {"LogFormat", S1A, c_set_string, &log_format},
+    {"AccessLogBinary", S0A, c_set_unity, &access_log_binary},
+    {"StatusURI", S1A, c_set_string, &status_uri},
+    {"StatsInterval", S1A, c_set_int, &stats_interval},
+    {"SlowRequestThreshold", S1A, c_set_int, &slow_request_threshold},
+    {"SlowRequestLog", S1A, c_set_string, &slow_log_name},
+    {"LogNever", S1A, c_add_log_rule, &log_never_number},
+    {"LogAlways", S2A, c_add_log_rule, &log_always_number},
+    {"LogSample", S2A, c_add_log_rule, &log_sample_number},
+    {"ServerTiming", S1A, c_add_server_timing, NULL},
     {"CgiLog", S1A, c_set_string, &cgi_log_name}, /* compatibility with CGILog */
     {"CGILog", S1A, c_set_string, &cgi_log_name},
     {"VerboseCGILogs", S0A, c_set_unity, &verbose_cgi_logs},
@@ -158,20 +191,25 @@ struct ccommand clist[] = {
     {"PidFile", S1A, c_set_string, &pid_file},
     {"KeepAliveMax", S1A, c_set_int, &ka_max},
     {"KeepAliveTimeout", S1A, c_set_int, &ka_timeout},
+    {"HTTP2", S0A, c_set_unity, &http2},
     {"MimeTypes", S1A, c_add_mime_types_file, NULL},
     {"DefaultType", S1A, c_set_string, &default_type},
     {"DefaultCharset", S1A, c_set_string, &default_charset},
     {"AddType", S2A, c_add_mime_type, NULL},
     {"ScriptAlias", S2A, c_add_alias, &script_number},
+    {"StreamScriptAlias", S2A, c_add_alias, &stream_script_number},
     {"Redirect", S2A, c_add_alias, &redirect_number},
     {"Alias", S2A, c_add_alias, &alias_number},
     {"SinglePostLimit", S1A, c_set_int, &single_post_limit},
+    {"MemorySpoolLimit", S1A, c_set_int, &memory_spool_limit},
     {"CGIPath", S1A, c_set_string, &cgi_path},
     {"CGIumask", S1A, c_set_int, &cgi_umask},
     {"MaxConnections", S1A, c_set_int, &max_connections},
     {"ConcealServerIdentity", S0A, c_set_unity, &conceal_server_identity},
     {"Allow", S1A, c_add_access, &access_allow_number},
     {"Deny", S1A, c_add_access, &access_deny_number},
+    {"AllowIP", S1A, c_add_ip_rule, &ip_allow_number},
+    {"DenyIP", S1A, c_add_ip_rule, &ip_deny_number},
 #ifdef USE_SETRLIMIT
     {"CGIRlimitCpu", S2A, c_set_int, &cgi_rlimit_cpu},
     {"CGIRlimitData", S2A, c_set_int, &cgi_rlimit_data},
@@ -381,6 +419,42 @@ static void c_add_access(char *v1, char *v2, void *t)
 #endif                          /* ACCESS_CONTROL */
 }
 
+static void c_add_ip_rule(char *v1, char *v2, void *t)
+{
+    if (!ip_acl_add(v1, *(int *) t)) {
+        fprintf(stderr, "Invalid address or prefix \"%s\" for %s\n",
+                v1, (*(int *) t ? "AllowIP" : "DenyIP"));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void c_add_log_rule(char *v1, char *v2, void *t)
+{
+    static const char *name[] = { "LogNever", "LogAlways", "LogSample" };
+
+    if (!log_rule_add(*(enum LOG_RULE *) t, v1, v2)) {
+        fprintf(stderr, "Invalid %s rule \"%s%s%s\"\n",
+                name[*(enum LOG_RULE *) t], v1, (v2 ? " " : ""),
+                (v2 ? v2 : ""));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void c_add_server_timing(char *v1, char *v2, void *t)
+{
+#ifdef SERVER_TIMING
+    if (!timing_add(v1)) {
+        fprintf(stderr, "Invalid ServerTiming rule \"%s\"\n", v1);
+        exit(EXIT_FAILURE);
+    }
+#else
+    log_error_time();
+    fprintf(stderr,
+            "This version of Boa doesn't support ServerTiming.\n"
+            "Please recompile with --enable-server-timing.\n");
+#endif                          /* SERVER_TIMING */
+}
+
 struct ccommand *lookup_keyword(char *c)
 {
     struct ccommand *p;
@@ -469,7 +543,7 @@ static void parse(FILE * f)
 
         /* look for multiple arguments */
         c = buf;
-        while (!isspace(*c))
+        while (*c && !isspace(*c))
             ++c;
 
         if (*c == '\0') {
@@ -518,6 +592,11 @@ void read_config_files(void)
 #ifdef ACCESS_CONTROL
     access_init();
 #endif                          /* ACCESS_CONTROL */
+    ip_acl_clear();
+    log_rule_clear();
+#ifdef SERVER_TIMING
+    timing_clear();
+#endif
 
     config = fopen(config_file_name, "r");
     if (!config) {
@@ -526,6 +605,10 @@ void read_config_files(void)
     }
     parse(config);
     fclose(config);
+    build_alias_trie();
+#ifdef ACCESS_CONTROL
+    access_compile();
+#endif
 
     if (override_server_port)
         server_port = override_server_port;
@@ -569,6 +652,32 @@ void read_config_files(void)
         exit(EXIT_FAILURE);
     }
 
+    if (memory_spool_limit < 0) {
+        fprintf(stderr, "Invalid value for memory_spool_limit: %d\n",
+                memory_spool_limit);
+        exit(EXIT_FAILURE);
+    }
+
+    if (access_log_full && strcasecmp(access_log_full, "block") &&
+        strcasecmp(access_log_full, "drop") &&
+        strcasecmp(access_log_full, "spill")) {
+        fprintf(stderr, "Invalid value for AccessLogFull: \"%s\" "
+                "(block, drop or spill)\n", access_log_full);
+        exit(EXIT_FAILURE);
+    }
+
+    if (status_uri && status_uri[0] != '/') {
+        fprintf(stderr, "StatusURI must start with /: \"%s\"\n",
+                status_uri);
+        exit(EXIT_FAILURE);
+    }
+
+    if (slow_request_threshold < 0) {
+        fprintf(stderr, "SlowRequestThreshold must not be negative: %d\n",
+                slow_request_threshold);
+        exit(EXIT_FAILURE);
+    }
+
     if (vhost_root && virtualhost) {
         fprintf(stderr, "Both VHostRoot and VirtualHost were enabled, and "
                 "they are mutually exclusive.\n");
@@ -621,4 +730,6 @@ void read_config_files(void)
     if (default_type == NULL) {
         DIE("DefaultType *must* be set!");
     }
+    build_mime_table();
+    compile_log_format();
 }
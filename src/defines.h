@@ -47,17 +47,43 @@
 /***** Change this via the SinglePostLimit configuration value in boa.conf *****/
 #define SINGLE_POST_LIMIT_DEFAULT               1024 * 1024 /* 1 MB */
 
+/***** Change this via the MemorySpoolLimit configuration value in boa.conf *****/
+#define MEMORY_SPOOL_LIMIT_DEFAULT              64 * 1024 /* 64 kB */
+
 /***** Various stuff that you may want to tweak, but probably shouldn't *****/
 
 #define SOCKETBUF_SIZE                          32768
 #define CLIENT_STREAM_SIZE                      8192
 #define BUFFER_SIZE                             4096
+#define SPLICE_SIZE                             65536 /* max bytes per splice(2) */
+#define CGI_STREAM_PIPE_SIZE                    1048576 /* StreamScriptAlias output */
 /* Changed from 1024 to cope with mailman problem.  */
 #define MAX_HEADER_LENGTH			1536
+#define MAX_HEADER_FIELDS                       96
+#define HEADER_INDEX_SIZE                       128 /* power of 2, > fields */
+
+#define MAX_LOG_RECORD                          8192
+#define DEFAULT_LOG_FORMAT "%h - - %t \"%r\" %s %b \"%{Referer}i\" \"%{User-Agent}i\""
+#define LOGRING_MIN_SIZE                        65536 /* AccessLogBuffer */
+#define LOGRING_SPILL_FACTOR                    8
+#define LOGRING_BLOCK_NSEC                      100000 /* 0.1 ms */
+#define ERRLOG_BUFFER_SIZE                      16384
+#define ERRLOG_FLUSH_INTERVAL                   1 /* seconds */
+#define ERRLOG_RATE_DEFAULT                     10 /* per site per second */
+#define MAX_STATUS_CODE                         600 /* counted by StatusURI */
+#define STATUS_RATE_SECONDS                     10 /* accept rate window */
+#define HIST_SUB_BITS                           5 /* 16 buckets per octave */
+#define HIST_MAX_BITS                           32 /* up to 2^32 us */
+#define SLOW_TRACE_STEPS                        16 /* states per request */
+#define SLOW_REAPED                             64 /* CGI exits kept */
 
-#define MIME_HASHTABLE_SIZE			47
-#define ALIAS_HASHTABLE_SIZE                    17
 #define PASSWD_HASHTABLE_SIZE		        47
+#define ACCESS_CACHE_SIZE                       1024
+
+#define H2_MAX_STREAMS                          32 /* per HTTP/2 connection */
+#define H2_FRAME_SIZE                           16384 /* RFC 7540's least */
+#define H2_OUT_SIZE                             16384
+#define H2_TABLE_SIZE                           4096 /* HPACK's, both ways */
 
 #define REQUEST_TIMEOUT				60
 
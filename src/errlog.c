@@ -0,0 +1,228 @@
+/*
+ *  Boa, an http server
+ *  Copyright (C) 1995 Paul Phillips <paulp@go2net.com>
+ *  Copyright (C) 1996-2005 Larry Doolittle <ldoolitt@boa.org>
+ *  Copyright (C) 1997-2004 Jon Nelson <jnelson@boa.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 1, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* $Id$ */
+
+/*
+ * Buffered, rate limited error logging for the per-connection messages
+ * ("connection timed out", "document open", write errors) that come in
+ * floods when something goes wrong on the network side.
+ *
+ * Each place that logs such a message is a site (enum ERRLOG_SITE).  A
+ * site may log ErrorLogRate messages a second; past that they are only
+ * counted, and "suppressed N similar" goes in the log instead.  Lines
+ * are collected in errlog_buf and written with one write() from the
+ * main loop, at most ERRLOG_FLUSH_INTERVAL seconds later, or sooner if
+ * the buffer fills, and from an atexit handler.  So a buffered line can
+ * come out after messages written straight to stderr later on.
+ */
+
+#include "boa.h"
+
+static const char *site_name[ERRLOG_SITES] = {
+    "connection timed out",
+    "buffer flush",
+    "sendfile write",
+    "document open",
+};
+
+static struct {
+    time_t window;              /* the second being counted */
+    unsigned int count;         /* messages logged in it */
+    unsigned long suppressed;   /* not logged, not yet reported */
+    unsigned long total_suppressed;
+} sites[ERRLOG_SITES];
+
+static char errlog_buf[ERRLOG_BUFFER_SIZE];
+static unsigned int errlog_len;
+static int errlog_waiting;      /* anything to write or report */
+static time_t errlog_due;
+static pid_t errlog_pid;        /* not in forked children */
+
+static void errlog_write(void)
+{
+    unsigned int done = 0;
+    int n;
+
+    while (done < errlog_len) {
+        n = write(STDERR_FILENO, errlog_buf + done, errlog_len - done);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            break;              /* nowhere to complain to */
+        }
+        done += n;
+    }
+    errlog_len = 0;
+}
+
+/* appends len bytes to the buffer, writing it out first if need be */
+static void errlog_append(const char *s, unsigned int len)
+{
+    if (errlog_len + len > sizeof (errlog_buf))
+        errlog_write();
+    if (len > sizeof (errlog_buf))
+        len = sizeof (errlog_buf);
+    memcpy(errlog_buf + errlog_len, s, len);
+    errlog_len += len;
+    if (!errlog_waiting) {
+        errlog_waiting = 1;
+        errlog_due = current_time + ERRLOG_FLUSH_INTERVAL;
+    }
+}
+
+/*
+ * Name: errlog_doc
+ *
+ * Description: log_error_doc followed by mesg (and strerror(err), if
+ * err isn't 0), through the buffer, subject to the site's rate limit.
+ */
+
+void errlog_doc(request * req, enum ERRLOG_SITE site, int err)
+{
+    char line[MAX_LOG_RECORD];
+    unsigned int n;
+    int r;
+
+    if (error_log_rate > 0) {
+        if (sites[site].window != current_time) {
+            sites[site].window = current_time;
+            sites[site].count = 0;
+        }
+        if (sites[site].count >= (unsigned) error_log_rate) {
+            sites[site].suppressed++;
+            sites[site].total_suppressed++;
+            if (!errlog_waiting) {
+                errlog_waiting = 1;
+                errlog_due = current_time + ERRLOG_FLUSH_INTERVAL;
+            }
+            return;
+        }
+        sites[site].count++;
+    }
+
+    n = format_error_doc(req, line, sizeof (line) - 1);
+    if (err)
+        r = snprintf(line + n, sizeof (line) - n, "%s: %s\n",
+                     site_name[site], strerror(err));
+    else
+        r = snprintf(line + n, sizeof (line) - n, "%s\n", site_name[site]);
+    if (r < 0 || (unsigned) r >= sizeof (line) - n) {
+        /* cut short, but still a line */
+        n = sizeof (line) - 1;
+        line[n - 1] = '\n';
+    } else {
+        n += r;
+    }
+    errlog_append(line, n);
+}
+
+/*
+ * Name: errlog_flush
+ *
+ * Description: Reports what was suppressed and writes out the buffer.
+ * Called from the main loop when errlog_timeout says it's time, and
+ * before exiting.  A forked child (a CGI that failed to exec) has a
+ * copy of the buffer that the server itself will write; it drops it.
+ */
+
+void errlog_flush(void)
+{
+    char line[256];
+    int i, r;
+
+    if (errlog_pid && getpid() != errlog_pid) {
+        errlog_len = 0;
+        errlog_waiting = 0;
+        return;
+    }
+
+    for (i = 0; i < ERRLOG_SITES; ++i) {
+        if (!sites[i].suppressed)
+            continue;
+        r = snprintf(line, sizeof (line), "%s%s: suppressed %lu similar\n",
+                     get_commonlog_time(), site_name[i],
+                     sites[i].suppressed);
+        if (r > 0)
+            errlog_append(line, ((unsigned) r < sizeof (line) ? r :
+                                 sizeof (line) - 1));
+        sites[i].suppressed = 0;
+    }
+    errlog_write();
+    errlog_waiting = 0;
+}
+
+static void errlog_atexit(void)
+{
+    errlog_flush();
+}
+
+/*
+ * Name: errlog_init
+ *
+ * Description: Sees to it that the buffer is written out however the
+ * server exits.  Called once the server has backgrounded itself.
+ */
+
+void errlog_init(void)
+{
+    errlog_pid = getpid();
+    if (atexit(errlog_atexit) != 0)
+        WARN("atexit errlog");
+}
+
+/*
+ * Name: errlog_timeout
+ *
+ * Description: Flushes if it's time, and returns how many seconds the
+ * main loop may sleep before it next has to call this, or -1 for as
+ * long as it likes.
+ */
+
+int errlog_timeout(void)
+{
+    if (!errlog_waiting)
+        return -1;
+    if (current_time >= errlog_due) {
+        errlog_flush();
+        return -1;
+    }
+    return errlog_due - current_time;
+}
+
+/*
+ * Name: errlog_show_stats
+ * Description: Logs how many messages each site has suppressed.
+ */
+
+void errlog_show_stats(void)
+{
+    int i;
+
+    for (i = 0; i < ERRLOG_SITES; ++i) {
+        if (!sites[i].total_suppressed)
+            continue;
+        log_error_time();
+        fprintf(stderr, "error log: \"%s\": %lu suppressed\n",
+                site_name[i], sites[i].total_suppressed);
+    }
+}
@@ -33,58 +33,202 @@
 #ifdef TEST
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #else
 #include "boa.h"
 #endif
 
 #include "escape.h"
 
-unsigned long
-    _needs_escape[(NEEDS_ESCAPE_BITS + NEEDS_ESCAPE_WORD_LENGTH -
-                   1) / NEEDS_ESCAPE_WORD_LENGTH];
+unsigned char escape_table[256];
 
-void build_needs_escape(void)
+static const unsigned char escape_mask[] = {
+    ESCAPE_BIT_URI,             /* ESCAPE_URL */
+    ESCAPE_BIT_URI,             /* ESCAPE_URI */
+    ESCAPE_BIT_PATH,            /* ESCAPE_PATH */
+    ESCAPE_BIT_HTML,            /* ESCAPE_HTML */
+    ESCAPE_BIT_URI              /* ESCAPE_LOG */
+};
+
+const unsigned char escape_expansion[] = { 3, 3, 3, 6, 4 };
+
+static const char hex_upper[] = "0123456789ABCDEF";
+static const char hex_lower[] = "0123456789abcdef";
+
+/*
+ * Name: build_escape_table
+ * Description: Fills in escape_table.  Must be called before any of
+ * the escaping functions.
+ */
+
+void build_escape_table(void)
 {
-    unsigned int a, b;
     const unsigned char special[] =
         "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
         "abcdefghijklmnopqrstuvwxyz" "0123456789" "-_.!~*'():@&=+$,/?";
     /* 21 Mar 2002 - jnelson - confirm with Apache 1.3.23 that '?'
      * is safe to leave unescaped.
      */
-    unsigned short i, j;
-
-    b = 1;
-    for (a = 0; b != 0; a++)
-        b = b << 1;
-    /* I found $a bit positions available in an unsigned long. */
-    if (a < NEEDS_ESCAPE_WORD_LENGTH) {
-        fprintf(stderr,
-                "NEEDS_ESCAPE_SHIFT configuration error -- "
-                "%d should be <= log2(%d)\n", NEEDS_ESCAPE_SHIFT, a);
-        exit(EXIT_FAILURE);
-    } else if (a >= 2 * NEEDS_ESCAPE_WORD_LENGTH) {
-        /* needs_escape_shift configuration suboptimal */
-    } else {
-        /* Ahh, just right! */ ;
+    unsigned int i;
+
+    for (i = 0; i < sizeof (escape_table); ++i)
+        escape_table[i] = ESCAPE_BIT_URI | ESCAPE_BIT_PATH;
+    for (i = 0; i < sizeof (special) - 1; ++i)
+        escape_table[special[i]] = 0;
+    escape_table['?'] |= ESCAPE_BIT_PATH;
+    escape_table['<'] |= ESCAPE_BIT_HTML;
+    escape_table['>'] |= ESCAPE_BIT_HTML;
+    escape_table['&'] |= ESCAPE_BIT_HTML;
+    escape_table['"'] |= ESCAPE_BIT_HTML;
+}
+
+/* the first byte in [p, end) that mask says to escape, or end */
+static const unsigned char *escape_scan(const unsigned char *p,
+                                        const unsigned char *end,
+                                        unsigned char mask)
+{
+    while (end - p >= 4) {
+        if (escape_table[p[0]] & mask)
+            return p;
+        if (escape_table[p[1]] & mask)
+            return p + 1;
+        if (escape_table[p[2]] & mask)
+            return p + 2;
+        if (escape_table[p[3]] & mask)
+            return p + 3;
+        p += 4;
+    }
+    while (p < end && !(escape_table[*p] & mask))
+        ++p;
+    return p;
+}
+
+static unsigned int html_entity_length(unsigned char c)
+{
+    return (c == '&' ? 5 : c == '"' ? 6 : 4);
+}
+
+/*
+ * Name: escape_length
+ * Description: How many bytes escape_into would write for the len
+ * bytes at inp, not counting the NUL.
+ */
+
+unsigned int escape_length(const char *inp, unsigned int len,
+                           enum ESCAPE how)
+{
+    const unsigned char *p = (const unsigned char *) inp, *end = p + len;
+    const unsigned char *run;
+    unsigned int n = 0;
+
+    while (1) {
+        run = p;
+        p = escape_scan(p, end, escape_mask[how]);
+        n += p - run;
+        if (p == end)
+            break;
+        if (how == ESCAPE_URL && *p == '%') {
+            /* '%' and the byte after it go through as they are */
+            n += (p + 1 < end ? 2 : 1);
+            p += (p + 1 < end ? 2 : 1);
+            continue;
+        }
+        n += (how == ESCAPE_HTML ? html_entity_length(*p) :
+              escape_expansion[how]);
+        ++p;
     }
-    memset(_needs_escape, ~0, sizeof (_needs_escape));
-    for (i = 0; i < sizeof (special) - 1; ++i) {
-        j = special[i];
-        if (j >= NEEDS_ESCAPE_BITS) {
-            /* warning: character $j will be needlessly escaped. */
-        } else {
-            _needs_escape[NEEDS_ESCAPE_INDEX(j)] &= ~NEEDS_ESCAPE_MASK(j);
+    return n;
+}
+
+/*
+ * Name: escape_into
+ *
+ * Description: Escapes the len bytes at inp into dest, which must have
+ * room for escape_length() + 1 bytes (len * escape_expansion[how] + 1
+ * is always enough), and NUL terminates it.  Runs of bytes that need
+ * no escaping are copied with memcpy.
+ * Returns: a pointer to the NUL at the end of dest.
+ */
+
+char *escape_into(char *dest, const char *inp, unsigned int len,
+                  enum ESCAPE how)
+{
+    const unsigned char *p = (const unsigned char *) inp, *end = p + len;
+    const unsigned char *run;
+    unsigned char c;
+
+    while (1) {
+        run = p;
+        p = escape_scan(p, end, escape_mask[how]);
+        if (p > run) {
+            memcpy(dest, run, p - run);
+            dest += p - run;
+        }
+        if (p == end)
+            break;
+        c = *p++;
+        switch (how) {
+        case ESCAPE_URL:
+            if (c == '%') {
+                *dest++ = c;
+                if (p < end)
+                    *dest++ = *p++;
+                break;
+            }
+            /* fall through */
+        case ESCAPE_URI:
+        case ESCAPE_PATH:
+            *dest++ = '%';
+            *dest++ = hex_upper[c >> 4];
+            *dest++ = hex_upper[c & 0xf];
+            break;
+        case ESCAPE_HTML:
+            if (c == '<') {
+                memcpy(dest, "&lt;", 4);
+            } else if (c == '>') {
+                memcpy(dest, "&gt;", 4);
+            } else if (c == '&') {
+                memcpy(dest, "&amp;", 5);
+            } else {
+                memcpy(dest, "&quot;", 6);
+            }
+            dest += html_entity_length(c);
+            break;
+        case ESCAPE_LOG:
+            *dest++ = '\\';
+            *dest++ = 'x';
+            *dest++ = hex_lower[c >> 4];
+            *dest++ = hex_lower[c & 0xf];
+            break;
         }
     }
+    *dest = '\0';
+    return dest;
+}
+
+/*
+ * Name: escape_alloc
+ * Description: Returns a malloc'ed, escaped copy of inp, or NULL if
+ * memory ran out.  The caller frees it.
+ */
+
+char *escape_alloc(const char *inp, enum ESCAPE how)
+{
+    unsigned int len = strlen(inp);
+    char *buf;
+
+    buf = malloc(len * escape_expansion[how] + 1);
+    if (buf)
+        escape_into(buf, inp, len, how);
+    return buf;
 }
 
 #ifdef TEST
 int main(void)
 {
     int i;
-    build_needs_escape();
-    for (i = 0; i <= NEEDS_ESCAPE_BITS; ++i) {
+    build_escape_table();
+    for (i = 0; i < 256; ++i) {
         if (needs_escape(i)) {
             fprintf(stdout, "%3d needs escape.\n", i);
         }
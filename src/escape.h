@@ -22,28 +22,40 @@
 
 /* $Id: escape.h,v 1.18.2.1 2002/10/26 14:42:31 jnelson Exp $ */
 
+#ifndef _ESCAPE_H
+#define _ESCAPE_H
+
 #include "config.h"
 
-/* Highest character number that can possibly be passed through un-escaped */
-#define NEEDS_ESCAPE_BITS 128
+/*
+ * One 256-entry table classifies every byte; each way of escaping
+ * looks at its own bit.
+ */
+#define ESCAPE_BIT_URI   1      /* not allowed as is in a URI */
+#define ESCAPE_BIT_PATH  2      /* ... or in a relative path: also '?' */
+#define ESCAPE_BIT_HTML  4      /* < > & " */
 
-#ifndef NEEDS_ESCAPE_SHIFT
-#define NEEDS_ESCAPE_SHIFT 5    /* 1 << 5 is 32 bits */
-#endif
+extern unsigned char escape_table[256];
 
-#define NEEDS_ESCAPE_WORD_LENGTH (1<<NEEDS_ESCAPE_SHIFT)
+#define needs_escape(c) (escape_table[(unsigned char) (c)] & ESCAPE_BIT_URI)
 
-#define NEEDS_ESCAPE_INDEX(c) ((c)>>NEEDS_ESCAPE_SHIFT)
+enum ESCAPE {
+    ESCAPE_URL,                 /* %XX, but leave existing %XX alone */
+    ESCAPE_URI,                 /* %XX */
+    ESCAPE_PATH,                /* %XX, '?' too */
+    ESCAPE_HTML,                /* &lt; &gt; &amp; &quot; */
+    ESCAPE_LOG                  /* \xnn */
+};
 
-/* Assume variable shift is fast, otherwise this could be a table lookup */
-#define NEEDS_ESCAPE_MASK(c)  (1<<((c)&(NEEDS_ESCAPE_WORD_LENGTH - 1)))
+/* the most bytes one input byte can turn into */
+#define ESCAPE_MAX_EXPANSION 6
+extern const unsigned char escape_expansion[];
 
-/* Newer compilers could use an inline function.
- * This macro works great, as long as you pass unsigned int or unsigned char.
- */
-#define needs_escape(c) ((c)>=NEEDS_ESCAPE_BITS || _needs_escape[NEEDS_ESCAPE_INDEX(c)]&NEEDS_ESCAPE_MASK(c))
+void build_escape_table(void);
+unsigned int escape_length(const char *inp, unsigned int len,
+                           enum ESCAPE how);
+char *escape_into(char *dest, const char *inp, unsigned int len,
+                  enum ESCAPE how);
+char *escape_alloc(const char *inp, enum ESCAPE how);
 
-extern unsigned long
-    _needs_escape[(NEEDS_ESCAPE_BITS + NEEDS_ESCAPE_WORD_LENGTH -
-                   1) / NEEDS_ESCAPE_WORD_LENGTH];
-void build_needs_escape(void);
+#endif
@@ -58,6 +58,7 @@ int init_get(request * req)
     struct stat statbuf;
     volatile off_t bytes_free;
 
+    timing_begin(req);
     data_fd = open(req->pathname, O_RDONLY|O_LARGEFILE);
     saved_errno = errno;        /* might not get used */
 
@@ -142,9 +143,8 @@ int init_get(request * req)
 #endif
 
     if (data_fd == -1) {
-        log_error_doc(req);
-        errno = saved_errno;
-        perror("document open");
+        timing_end(req, TIMING_OPEN);
+        errlog_doc(req, ERRLOG_OPEN, saved_errno);
 
         if (saved_errno == ENOENT)
             send_r_not_found(req);
@@ -163,6 +163,7 @@ int init_get(request * req)
 #endif
 
     fstat(data_fd, &statbuf);
+    timing_end(req, TIMING_OPEN);
 
     if (S_ISDIR(statbuf.st_mode)) { /* directory */
         close(data_fd);         /* close dir */
@@ -273,15 +274,16 @@ int init_get(request * req)
      */
 
     /*
-    if (req->headers[H_IF_UNMODIFIED_SINCE] &&
+    if (req_header(req, H_IF_UNMODIFIED_SINCE) &&
         modified_since(&(statbuf.st_mtime),
-                       req->headers[H_IF_UNMODIFIED_SINCE])) {
+                       req_header(req, H_IF_UNMODIFIED_SINCE))) {
         send_r_precondition_failed(req);
         return 0;
     } else
     */
-    if (req->if_modified_since &&
-        !modified_since(&(statbuf.st_mtime), req->if_modified_since)) {
+    if (req_header(req, H_IF_MODIFIED_SINCE) &&
+        !modified_since(&(statbuf.st_mtime),
+                        req_header(req, H_IF_MODIFIED_SINCE))) {
         send_r_not_modified(req);
         close(data_fd);
         return 0;
@@ -353,14 +355,24 @@ int init_get(request * req)
          * and stopping there -- all to avoid the cost
          * of a mmap.  Oddly, it was *slower* in benchmarks.
          */
+        timing_begin(req);
         req->mmap_entry_var = find_mmap(data_fd, &statbuf);
+        timing_end(req, TIMING_CACHE);
         if (req->mmap_entry_var == NULL) {
+            req->cache_result = CACHE_MISS;
             req->data_fd = data_fd;
             req->status = IOSHUFFLE;
         } else {
+            /* someone else had it mapped already */
+            req->cache_result = (req->mmap_entry_var->use_count > 1 ?
+                                 CACHE_HIT : CACHE_MISS);
             req->data_mem = req->mmap_entry_var->mmap;
             close(data_fd);             /* close data file */
         }
+        if (req->cache_result == CACHE_HIT)
+            BOA_PROBE3(cache_hit, req, req->pathname, statbuf.st_size);
+        else
+            BOA_PROBE3(cache_miss, req, req->pathname, statbuf.st_size);
     }
 
     if (!req->ranges) {
@@ -521,6 +533,7 @@ int process_get(request * req)
         }
     }
 
+    BOA_PROBE3(write, req, req->fd, bytes_written);
     req->bytes_written += bytes_written;
     req->ranges->start += bytes_written;
 
@@ -708,7 +721,7 @@ static int index_directory(request * req, char *dest_filename)
     FILE *fdstream;
     struct dirent *dirbuf;
     off_t bytes = 0;
-    char *escname = NULL;
+    char *escname = NULL, *htmlname;
 
     if (chdir(req->pathname) == -1) {
         if (errno == EACCES || errno == EPERM) {
@@ -755,14 +768,15 @@ static int index_directory(request * req, char *dest_filename)
             continue;
         }
 
-        /* FIXME: ought to use (as-yet unwritten) html_escape_string */
         escname = escape_string(dirbuf->d_name, NULL);
-        if (escname != NULL) {
+        htmlname = escape_alloc(dirbuf->d_name, ESCAPE_HTML);
+        if (escname != NULL && htmlname != NULL) {
             bytes += fprintf(fdstream, " <A HREF=\"%s\">%s</A>\n",
-                             escname, dirbuf->d_name);
-            free(escname);
-            escname = NULL;
+                             escname, htmlname);
         }
+        free(escname);
+        free(htmlname);
+        escname = NULL;
     }
     closedir(request_dir);
     bytes += fprintf(fdstream, "</PRE>\n\n</BODY>\n</HTML>\n");
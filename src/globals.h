@@ -39,6 +39,7 @@ enum REQ_STATUS { READ_HEADER, ONE_CR, ONE_LF, TWO_CR,
     WRITE,
     PIPE_READ, PIPE_WRITE,
     IOSHUFFLE,
+    HTTP2,
     DONE,
     TIMED_OUT,
     DEAD
@@ -81,7 +82,7 @@ enum RESPONSE_CODE { R_CONTINUE = 100,
                      R_BAD_VERSION };
 
 /************* ALIAS TYPES (aliasp->type) ***************/
-enum ALIAS { ALIAS, SCRIPTALIAS, REDIRECT };
+enum ALIAS { ALIAS, SCRIPTALIAS, REDIRECT, STREAMSCRIPTALIAS };
 
 /*********** KEEPALIVE CONSTANTS (req->keepalive) *******/
 enum KA_STATUS { KA_INACTIVE, KA_ACTIVE, KA_STOPPED };
@@ -89,9 +90,39 @@ enum KA_STATUS { KA_INACTIVE, KA_ACTIVE, KA_STOPPED };
 /********* CGI STATUS CONSTANTS (req->cgi_status) *******/
 enum CGI_STATUS { CGI_PARSE, CGI_BUFFER, CGI_DONE };
 
+/******* CHUNKED BODY DECODER (req->chunk_state) ********/
+enum CHUNK_STATE { CHUNK_SIZE_START, CHUNK_SIZE, CHUNK_SIZE_WS, CHUNK_EXT,
+                   CHUNK_SIZE_LF, CHUNK_DATA, CHUNK_DATA_CR, CHUNK_DATA_LF,
+                   CHUNK_TRAILER, CHUNK_TRAILER_LINE, CHUNK_TRAILER_LF,
+                   CHUNK_END_LF, CHUNK_DONE };
+
+/******** MMAP CACHE LOOKUP (req->cache_result) *********/
+enum CACHE_RESULT { CACHE_NONE, CACHE_HIT, CACHE_MISS };
+
+/****** ACCESS LOG RULES (LogNever etc., logrule.c) ******/
+enum LOG_RULE { LOG_NEVER, LOG_ALWAYS, LOG_SAMPLE };
+
+/****** RATE LIMITED ERROR LOG MESSAGES (errlog.c) ******/
+enum ERRLOG_SITE { ERRLOG_TIMEOUT, ERRLOG_FLUSH, ERRLOG_SENDFILE,
+                   ERRLOG_OPEN, ERRLOG_SITES };
+
+/******** LATENCY HISTOGRAMS (metrics.c) ********/
+enum LATENCY_PHASE { LAT_HEADER, LAT_INIT, LAT_FIRST_BYTE, LAT_WRITE,
+                     LAT_IOSHUFFLE, LAT_PIPE_READ, LAT_TOTAL, LAT_PHASES };
+
+/******** SERVER-TIMING PHASES (timing.c) ********/
+enum TIMING_PHASE { TIMING_TRANSLATE, TIMING_OPEN, TIMING_CACHE, TIMING_CGI,
+                    TIMING_PHASES };
+
 /************** CGI TYPE (req->is_cgi) ******************/
 enum CGI_TYPE { NPH = 1, CGI };
 
+/********** KNOWN REQUEST HEADERS (req->headers) ********/
+enum HEADER { H_ACCEPT, H_CONNECTION, H_CONTENT_LENGTH, H_CONTENT_TYPE,
+              H_EXPECT, H_HOST, H_IF_MODIFIED_SINCE, H_RANGE, H_REFERER,
+              H_TRANSFER_ENCODING, H_USER_AGENT, H_X_FORWARDED_FOR,
+              H_COUNT };
+
 /**************** STRUCTURES ****************************/
 struct range {
     unsigned long start;
@@ -101,6 +132,28 @@ struct range {
 
 typedef struct range Range;
 
+/* a piece of req->client_stream; length 0 means "not there" */
+struct slice {
+    unsigned short offset;
+    unsigned short length;
+};
+
+/* a state the request went into, for the slow request log */
+struct slow_step {
+    enum REQ_STATUS status;
+    uint64_t at;                /* current_usec */
+    off_t bytes_in;             /* req->bytes_in then */
+    size_t bytes_out;           /* req->bytes_written then */
+    unsigned int blocks;        /* req->blocks then */
+};
+
+/* a header line: the name, and the value without leading blanks */
+struct header_field {
+    struct slice name;
+    struct slice value;
+    unsigned char next;         /* 1 + index of the next with this name, or 0 */
+};
+
 struct mmap_entry {
     dev_t dev;
     ino_t ino;
@@ -109,6 +162,8 @@ struct mmap_entry {
     off_t len;
 };
 
+struct h2_conn;                 /* h2.c */
+
 struct request {                /* pending requests */
     enum REQ_STATUS status;
     enum KA_STATUS keepalive;   /* keepalive status */
@@ -119,6 +174,14 @@ struct request {                /* pending requests */
     enum CGI_TYPE cgi_type;
     enum CGI_STATUS cgi_status;
 
+    /* the CGI's response header, see parse_cgi_header */
+    char *cgi_scan;             /* first line not parsed yet */
+    char *cgi_body;             /* just past the blank line, once seen */
+    struct slice cgi_status_line; /* whole lines, in req->buffer */
+    struct slice cgi_location_line;
+    struct slice cgi_content_type; /* the value */
+    off_t cgi_content_length;   /* -1 if the CGI didn't say */
+
     /* should pollfd_id be zeroable or no ? */
 #ifdef HAVE_POLL
     int pollfd_id;
@@ -144,30 +207,66 @@ struct request {                /* pending requests */
     int buffer_start;           /* where the buffer starts */
     int buffer_end;             /* where the buffer ends */
 
-    char *if_modified_since;    /* If-Modified-Since */
     time_t last_modified;       /* Last-modified: */
 
     /* CGI vars */
     int cgi_env_index;          /* index into array */
 
-    /* Agent and referer for logfiles */
-    char *header_host;
-    char *header_user_agent;
-    char *header_referer;
+    /* values of the headers we know, see req_header() */
+    struct slice headers[H_COUNT];
+    /* all of them, see find_header(): 1 + index into header_fields,
+     * by hash of the name */
+    unsigned char header_index[HEADER_INDEX_SIZE];
+    int header_count;
     char *header_ifrange;
-    char *header_forwarded_for; /* X-Forwarded-For or NULL.  */
-    char *host;                 /* what we end up using for 'host', no matter the contents of header_host */
+    char *host;                 /* what we end up using for 'host', no matter the contents of Host: */
 
-    int post_data_fd;           /* fd for post data tmpfile */
+    int post_data_fd;           /* fd for post data tmpfile, or CGI stdin pipe */
+    int stream_body;            /* POST body is fed to a running CGI */
+    int discard_body;           /* ...which quit reading it */
+    int chunked_body;           /* POST body has chunked transfer-coding */
+    int expect_continue;        /* Expect: 100-continue */
+    enum CHUNK_STATE chunk_state;
+    off_t chunk_left;           /* bytes left in the current chunk */
 
     char *path_info;            /* env variable */
     char *path_translated;      /* env variable */
     char *script_name;          /* env variable */
     char *query_string;         /* env variable */
-    char *content_type;         /* env variable */
-    char *content_length;       /* env variable */
 
     struct mmap_entry *mmap_entry_var;
+    enum CACHE_RESULT cache_result;
+    int no_log;                 /* keep out of the access log */
+
+    /* for LogFormat; times are current_usec */
+    uint64_t time_start;        /* started reading the request */
+    uint64_t time_first_byte;   /* first byte of the response went out */
+    off_t bytes_in;             /* request line, headers and body */
+
+    /* for the latency histograms (metrics.c), also current_usec */
+    uint64_t time_header;       /* the header was complete */
+    uint64_t time_init;         /* taken by init_get, init_cgi... */
+    uint64_t state_since;       /* status last changed */
+    uint64_t state_usec[3];     /* in WRITE, IOSHUFFLE, PIPE_READ */
+    int states_seen;            /* a bit for each of those */
+
+    /* for the slow request log (slowlog.c) */
+    unsigned int blocks;        /* times the request blocked */
+    int slow_steps;             /* in slow_trace */
+    int slow_lost;              /* steps past SLOW_TRACE_STEPS */
+    pid_t cgi_pid;
+
+#ifdef SERVER_TIMING
+    int server_timing;          /* send Server-Timing (timing_check) */
+    uint64_t timing_mark;       /* timing_begin */
+    uint64_t timing[TIMING_PHASES]; /* usec taken + 1, 0 if not done */
+#endif
+
+    /* for HTTP/2 (h2.c): a connection has h2, its streams h2_id */
+    struct h2_conn *h2;
+    unsigned int h2_id;
+    int h2_window;              /* the stream's send window */
+    int h2_flags;
 
     /* everything **above** this line is zeroed in sanitize_request */
     /* this may include 'fd' */
@@ -188,7 +287,9 @@ struct request {                /* pending requests */
     char buffer[BUFFER_SIZE + 1]; /* generic I/O buffer */
     char request_uri[MAX_HEADER_LENGTH + 1]; /* uri */
     char client_stream[CLIENT_STREAM_SIZE]; /* data from client - fit or be hosed */
+    struct header_field header_fields[MAX_HEADER_FIELDS]; /* header_count of them */
     char *cgi_env[CGI_ENV_MAX + 4]; /* CGI environment */
+    struct slow_step slow_trace[SLOW_TRACE_STEPS]; /* slow_steps of them */
 
 #ifdef ACCEPT_ON
     char accept[MAX_ACCEPT_LENGTH]; /* Accept: fields */
@@ -200,9 +301,40 @@ struct request {                /* pending requests */
 
 typedef struct request request;
 
+/* the response has started: see req->time_first_byte */
+#define note_first_byte(req) do { if (!(req)->time_first_byte) \
+        (req)->time_first_byte = current_usec; } while (0)
+
+/* time a phase of the request for its Server-Timing header */
+#ifdef SERVER_TIMING
+#define timing_begin(req) do { if ((req)->server_timing) \
+        (req)->timing_mark = monotonic_usec(); } while (0)
+#define timing_end(req, phase) do { if ((req)->server_timing) \
+        (req)->timing[phase] = monotonic_usec() - (req)->timing_mark + 1; \
+    } while (0)
+#else
+#define timing_begin(req)
+#define timing_end(req, phase)
+#endif
+
+/* NUL-terminated value of a header_field */
+#define header_value(req, field) ((req)->client_stream + (field)->value.offset)
+
+/* NUL-terminated value of a known header, or NULL */
+#define req_header(req, h) ((req)->headers[h].length ? \
+                            (req)->client_stream + (req)->headers[h].offset : \
+                            (char *) NULL)
+
 struct status {
     long requests;
     long errors;
+    long connections;           /* accepted */
+    long cgi_spawns;
+    long mmap_hits;
+    long mmap_misses;
+    off_t mmap_bytes;           /* mapped right now */
+    uint64_t bytes_sent;        /* response bodies */
+    long responses[MAX_STATUS_CODE]; /* by status code */
 };
 
 extern struct status status;
@@ -225,6 +357,15 @@ extern int max_fd;
 /* global server variables */
 
 extern char *access_log_name;
+extern int access_log_buffer;
+extern char *access_log_full;
+extern char *log_format;
+extern int access_log_binary;
+extern int error_log_rate;
+extern char *status_uri;
+extern int stats_interval;
+extern int slow_request_threshold;
+extern char *slow_log_name;
 extern char *error_log_name;
 extern char *cgi_log_name;
 extern int cgi_log_fd;
@@ -254,9 +395,11 @@ extern const char *tempdir;
 extern char *cgi_path;
 extern short common_cgi_env_count;
 extern int single_post_limit;
+extern int memory_spool_limit;
 extern int conceal_server_identity;
 
 extern int ka_timeout;
+extern int http2;
 extern int unsigned default_timeout;
 extern int unsigned ka_max;
 
@@ -273,6 +416,7 @@ extern int verbose_cgi_logs;
 
 extern int backlog;
 extern time_t current_time;
+extern uint64_t current_usec;    /* monotonic, see update_clock() */
 
 extern int virtualhost;
 extern char *vhost_root;
@@ -0,0 +1,2035 @@
+/*
+ *  Boa, an http server
+ *  Copyright (C) 1995 Paul Phillips <paulp@go2net.com>
+ *  Copyright (C) 1996-2005 Larry Doolittle <ldoolitt@boa.org>
+ *  Copyright (C) 1997-2004 Jon Nelson <jnelson@boa.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 1, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* $Id$ */
+
+/*
+ * HTTP2
+ *
+ * HTTP/2 over cleartext TCP (h2c, RFC 7540 with RFC 7541 for the
+ * headers), for documents.  A client gets here by starting with the
+ * connection preface ("PRI * HTTP/2.0", see process_logline) or by
+ * asking to upgrade a GET or HEAD (h2_upgrade, from header_end).  The
+ * connection's request then stays in the queues with status HTTP2 and
+ * h2_process does the rest: it reads and answers frames, makes a
+ * request of its own for each new stream, and interleaves the
+ * responses.
+ *
+ * A stream is an ordinary struct request that never sees the queues.
+ * Its header block is written out as the HTTP/1 request it stands for
+ * ("GET /path HTTP/2.0", a line for each field, :authority as Host)
+ * and run through read_header, so translate_uri, init_get, Range and
+ * the rest go on as they always have; req_flush just leaves the
+ * response in req->buffer.  stream_send turns that into a HEADERS
+ * frame and DATA frames, and the document into DATA frames copied from
+ * the mmapped file or, for big files, sent by sendfile after their
+ * frame header.  Each stream gets a frame per turn, within the flow
+ * control windows.
+ *
+ * The frame buffers, in and out, are only kept while the connection
+ * has something to read or write (h2_buffers); an idle one is down to
+ * its HPACK tables.  A stream costs what an HTTP/1.1 request does.
+ *
+ * CGIs (so also POST) are refused with RST_STREAM(HTTP_1_1_REQUIRED),
+ * and the client asks again over HTTP/1.1.  There's no server push,
+ * priorities are ignored and response headers aren't Huffman coded.
+ */
+
+#include "boa.h"
+#include <stddef.h>             /* for offsetof */
+#include <netinet/tcp.h>        /* TCP_NODELAY */
+
+/* frame types */
+enum { H2_DATA, H2_HEADERS, H2_PRIORITY, H2_RST_STREAM, H2_SETTINGS,
+    H2_PUSH_PROMISE, H2_PING, H2_GOAWAY, H2_WINDOW_UPDATE, H2_CONTINUATION
+};
+
+/* frame flags */
+#define H2_END_STREAM           0x1
+#define H2_ACK                  0x1
+#define H2_END_HEADERS          0x4
+#define H2_PADDED               0x8
+#define H2_PRIORITY_FLAG        0x20
+
+/* error codes */
+enum { H2_NO_ERROR, H2_PROTOCOL_ERROR, H2_INTERNAL_ERROR,
+    H2_FLOW_CONTROL_ERROR, H2_SETTINGS_TIMEOUT, H2_STREAM_CLOSED,
+    H2_FRAME_SIZE_ERROR, H2_REFUSED_STREAM, H2_CANCEL,
+    H2_COMPRESSION_ERROR, H2_CONNECT_ERROR, H2_ENHANCE_YOUR_CALM,
+    H2_INADEQUATE_SECURITY, H2_HTTP_1_1_REQUIRED
+};
+
+/* SETTINGS parameters */
+#define H2_HEADER_TABLE_SIZE    1
+#define H2_ENABLE_PUSH          2
+#define H2_MAX_CONCURRENT_STREAMS 3
+#define H2_INITIAL_WINDOW_SIZE  4
+#define H2_MAX_FRAME_SIZE       5
+#define H2_MAX_HEADER_LIST_SIZE 6
+
+/* req->h2_flags */
+#define H2_HEADERS_SENT         1
+#define H2_REFUSED              2 /* by init_cgi, see h2_refuse */
+
+#define H2_IN_SIZE (H2_FRAME_SIZE + 9) /* a whole frame */
+#define H2_CONTROL_ROOM 64      /* in out, for the answer to a frame */
+#define H2_DATA_MIN 1024        /* smaller DATA frames wait for room */
+#define H2_WINDOW_DEFAULT 65535
+#define H2_WINDOW_MAX 0x7fffffff
+#define H2_STREAM_ID 0x7fffffff /* less the reserved bit */
+
+static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+#define PREFACE_LEN (sizeof (preface) - 1)
+#define PREFACE_LINE 16         /* "PRI * HTTP/2.0\r\n" */
+
+/******************************* HPACK *******************************/
+
+#define HPACK_STATIC 61
+#define HPACK_ENTRIES (H2_TABLE_SIZE / 32) /* 32 bytes overhead each */
+
+static const struct {
+    const char *name;
+    const char *value;
+} hpack_static[HPACK_STATIC] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"},
+    {":path", "/"}, {":path", "/index.html"}, {":scheme", "http"},
+    {":scheme", "https"}, {":status", "200"}, {":status", "204"},
+    {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"}, {"accept-language", ""},
+    {"accept-ranges", ""}, {"accept", ""},
+    {"access-control-allow-origin", ""}, {"age", ""}, {"allow", ""},
+    {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""},
+    {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""},
+    {"content-type", ""}, {"cookie", ""}, {"date", ""}, {"etag", ""},
+    {"expect", ""}, {"expires", ""}, {"from", ""}, {"host", ""},
+    {"if-match", ""}, {"if-modified-since", ""}, {"if-none-match", ""},
+    {"if-range", ""}, {"if-unmodified-since", ""},
+    {"last-modified", ""}, {"link", ""}, {"location", ""},
+    {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""},
+    {"refresh", ""}, {"retry-after", ""}, {"server", ""},
+    {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""},
+    {"via", ""}, {"www-authenticate", ""}
+};
+
+/*
+ * The Huffman code of RFC 7541, Appendix B, is canonical: it is all
+ * in how many codes there are of each length, and the symbols in
+ * order of code.  EOS (256) is the 30 bit code of all ones.
+ */
+static const short huff_count[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+    0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+
+static const short huff_symbol[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+    45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+    95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+    58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+    106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+    88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+    0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+    167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+    132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+    173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+    151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+    183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+    171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+    255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+    246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+    6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+    249, 10, 13, 22, 256
+};
+
+/* the dynamic table: entries oldest first, their names and values
+ * one after another in data */
+struct hpack_entry {
+    unsigned short offset;
+    unsigned short name_len;
+    unsigned short value_len;
+};
+
+struct hpack_table {
+    struct hpack_entry entry[HPACK_ENTRIES]; /* a ring */
+    unsigned int oldest;
+    unsigned int count;
+    unsigned int size;          /* as RFC 7541 counts it */
+    unsigned int max;
+    unsigned int start;         /* the part of data in use */
+    unsigned int end;
+    char data[H2_TABLE_SIZE];
+};
+
+struct hpack_field {
+    const char *name;           /* NULL if it was too long to keep */
+    const char *value;
+    unsigned int name_len;
+    unsigned int value_len;
+};
+
+/* where hpack_field decodes literal strings; a request can't be
+ * longer than CLIENT_STREAM_SIZE anyway */
+static char hpack_name[CLIENT_STREAM_SIZE];
+static char hpack_value[CLIENT_STREAM_SIZE];
+
+struct h2_conn {
+    request *stream[H2_MAX_STREAMS]; /* open ones, oldest first */
+    int streams;
+    unsigned int last_stream;   /* the highest the client opened */
+    unsigned int preface;       /* how much of it has been seen */
+    int settings_seen;
+    int goaway;                 /* sent one, no new streams */
+    int peer_goaway;            /* got one, no new streams */
+    int closing;                /* close once out is written */
+
+    int initial_window;         /* the client's SETTINGS */
+    int send_window;            /* the connection's, for DATA out */
+    int recv_window;            /* the connection's, for DATA in */
+    int table_update;           /* the encoder's size changed... */
+    unsigned int table_low;     /* ...and went as low as this */
+
+    /* a header block coming in CONTINUATION frames, at in[0] */
+    unsigned int block_stream;
+    unsigned int block_len;
+
+    /* the last frame in out, whose payload sendfile sends */
+    request *send_stream;
+    unsigned int send_left;
+    int send_end;
+
+    struct hpack_table decoder;
+    struct hpack_table encoder;
+
+    /* everything **above** this line is zeroed in h2_start */
+    unsigned int in_pos;
+    unsigned int in_len;
+    unsigned int out_start;
+    unsigned int out_len;
+    unsigned char *in;          /* H2_IN_SIZE, then out: h2_buffers */
+    unsigned char *out;
+};
+
+/*
+ * Name: huff_decode
+ * Description: Decodes len bytes of Huffman code into out, which has
+ * room for room bytes.  The code being canonical, it goes a bit at a
+ * time with huff_count and huff_symbol, like zlib's puff.
+ * Returns: the length, -1 if the code is malformed, -2 if it won't
+ * fit.
+ */
+
+static int huff_decode(const unsigned char *in, unsigned int len,
+                       char *out, unsigned int room)
+{
+    unsigned int i, n = 0;
+    int b, bit, code = 0, first = 0, index = 0, bits = 0, ones = 1;
+
+    for (i = 0; i < len; ++i) {
+        for (b = 7; b >= 0; --b) {
+            bit = (in[i] >> b) & 1;
+            code |= bit;
+            ones &= bit;
+            ++bits;
+            if (code - huff_count[bits] < first) {
+                int symbol = huff_symbol[index + code - first];
+
+                if (symbol == 256)
+                    return -1;  /* EOS */
+                if (n == room)
+                    return -2;
+                out[n++] = symbol;
+                code = first = index = bits = 0;
+                ones = 1;
+            } else {
+                index += huff_count[bits];
+                first = (first + huff_count[bits]) << 1;
+                code <<= 1;
+            }
+        }
+    }
+    /* padding is the start of EOS, and less than a byte */
+    if (bits > 7 || !ones)
+        return -1;
+    return n;
+}
+
+/*
+ * Name: hpack_int
+ * Description: Decodes an integer with a prefix bits prefix at *pp,
+ * and moves *pp past it.
+ * Returns: 1, or 0 if it's cut short or too big.
+ */
+
+static int hpack_int(const unsigned char **pp, const unsigned char *end,
+                     int prefix, unsigned int *value)
+{
+    const unsigned char *p = *pp;
+    unsigned int max = (1U << prefix) - 1, v, b, shift = 0;
+
+    if (p == end)
+        return 0;
+    v = *p++ & max;
+    if (v == max) {
+        do {
+            if (p == end || shift > 21)
+                return 0;       /* nothing here goes past 2^28 */
+            b = *p++;
+            v += (b & 127) << shift;
+            shift += 7;
+        } while (b & 128);
+    }
+    *pp = p;
+    *value = v;
+    return 1;
+}
+
+/*
+ * Name: hpack_string
+ * Description: Decodes a string literal at *pp into out (room bytes),
+ * and moves *pp past it.
+ * Returns: the length, -1 if it's malformed, -2 if it won't fit.
+ */
+
+static int hpack_string(const unsigned char **pp, const unsigned char *end,
+                        char *out, unsigned int room)
+{
+    const unsigned char *p = *pp;
+    unsigned int len;
+    int huffman;
+
+    if (p == end)
+        return -1;
+    huffman = *p & 0x80;
+    if (!hpack_int(&p, end, 7, &len) || len > (unsigned) (end - p))
+        return -1;
+    *pp = p + len;
+    if (huffman)
+        return huff_decode(p, len, out, room);
+    if (len > room)
+        return -2;
+    memcpy(out, p, len);
+    return len;
+}
+
+static void hpack_evict(struct hpack_table *t, unsigned int max)
+{
+    struct hpack_entry *e;
+
+    while (t->size > max) {
+        e = &t->entry[t->oldest];
+        t->size -= e->name_len + e->value_len + 32;
+        t->start = e->offset + e->name_len + e->value_len;
+        t->oldest = (t->oldest + 1) % HPACK_ENTRIES;
+        if (--t->count == 0)
+            t->start = t->end = 0;
+    }
+}
+
+static void hpack_add(struct hpack_table *t, const char *name,
+                      unsigned int name_len, const char *value,
+                      unsigned int value_len)
+{
+    struct hpack_entry *e;
+    unsigned int len = name_len + value_len, i;
+
+    if (len + 32 > t->max) {
+        hpack_evict(t, 0);      /* what a big entry does */
+        return;
+    }
+    hpack_evict(t, t->max - len - 32);
+    if (t->end + len > H2_TABLE_SIZE) {
+        /* there's room, but it's at the front */
+        memmove(t->data, t->data + t->start, t->end - t->start);
+        for (i = 0; i < t->count; ++i)
+            t->entry[(t->oldest + i) % HPACK_ENTRIES].offset -= t->start;
+        t->end -= t->start;
+        t->start = 0;
+    }
+    e = &t->entry[(t->oldest + t->count) % HPACK_ENTRIES];
+    e->offset = t->end;
+    e->name_len = name_len;
+    e->value_len = value_len;
+    memcpy(t->data + t->end, name, name_len);
+    memcpy(t->data + t->end + name_len, value, value_len);
+    t->end += len;
+    t->size += len + 32;
+    t->count++;
+}
+
+/* index 1 is the first static entry, HPACK_STATIC + 1 the newest
+ * dynamic one; returns 0 for an index that isn't there */
+static int hpack_get(struct hpack_table *t, unsigned int index,
+                     struct hpack_field *f)
+{
+    struct hpack_entry *e;
+
+    if (index == 0)
+        return 0;
+    if (index <= HPACK_STATIC) {
+        f->name = hpack_static[index - 1].name;
+        f->name_len = strlen(f->name);
+        f->value = hpack_static[index - 1].value;
+        f->value_len = strlen(f->value);
+        return 1;
+    }
+    index -= HPACK_STATIC;
+    if (index > t->count)
+        return 0;
+    e = &t->entry[(t->oldest + t->count - index) % HPACK_ENTRIES];
+    f->name = t->data + e->offset;
+    f->name_len = e->name_len;
+    f->value = t->data + e->offset + e->name_len;
+    f->value_len = e->value_len;
+    return 1;
+}
+
+/*
+ * Name: hpack_field
+ * Description: Decodes the next field of the header block at *pp,
+ * keeping the dynamic table t up to date, and moves *pp past it.
+ * Table size updates are only allowed before the first field.
+ * The field is good until the next call.
+ * Returns: 1 for a field, 0 at the end of the block, -1 if the block
+ * is malformed (a COMPRESSION_ERROR).
+ */
+
+static int hpack_field(struct hpack_table *t, const unsigned char **pp,
+                       const unsigned char *end, struct hpack_field *f,
+                       int first)
+{
+    const unsigned char *p = *pp;
+    unsigned int index;
+    int n, indexing;
+
+    while (p < end && (*p & 0xe0) == 0x20) {
+        if (!first || !hpack_int(&p, end, 5, &index) ||
+            index > H2_TABLE_SIZE)
+            return -1;
+        t->max = index;
+        hpack_evict(t, index);
+    }
+    *pp = p;
+    if (p == end)
+        return 0;
+
+    if (*p & 0x80) {
+        if (!hpack_int(&p, end, 7, &index) || !hpack_get(t, index, f))
+            return -1;
+        *pp = p;
+        return 1;
+    }
+
+    /* a literal, with incremental indexing or not */
+    indexing = (*p & 0xc0) == 0x40;
+    if (!hpack_int(&p, end, indexing ? 6 : 4, &index))
+        return -1;
+    if (index) {
+        if (!hpack_get(t, index, f))
+            return -1;
+        /* adding the field could evict the entry it names */
+        memcpy(hpack_name, f->name, f->name_len);
+        f->name = hpack_name;
+    } else {
+        n = hpack_string(&p, end, hpack_name, sizeof (hpack_name));
+        if (n == -1)
+            return -1;
+        f->name = (n < 0 ? NULL : hpack_name);
+        f->name_len = (n < 0 ? 0 : n);
+    }
+    n = hpack_string(&p, end, hpack_value, sizeof (hpack_value));
+    if (n == -1)
+        return -1;
+    f->value = (n < 0 ? NULL : hpack_value);
+    f->value_len = (n < 0 ? 0 : n);
+
+    if (indexing) {
+        if (f->name && f->value)
+            hpack_add(t, f->name, f->name_len, f->value, f->value_len);
+        else
+            hpack_evict(t, 0);  /* it was bigger than the table */
+    }
+    *pp = p;
+    return 1;
+}
+
+static unsigned char *hpack_put_int(unsigned char *p, unsigned int v,
+                                    int prefix, int flags)
+{
+    unsigned int max = (1U << prefix) - 1;
+
+    if (v < max) {
+        *p++ = flags | v;
+        return p;
+    }
+    *p++ = flags | max;
+    for (v -= max; v >= 128; v >>= 7)
+        *p++ = 128 | (v & 127);
+    *p++ = v;
+    return p;
+}
+
+static unsigned char *hpack_put_string(unsigned char *p, const char *s,
+                                       unsigned int len)
+{
+    p = hpack_put_int(p, len, 7, 0);
+    memcpy(p, s, len);
+    return p + len;
+}
+
+/*
+ * Name: hpack_put
+ * Description: Encodes a field at p: as an index if one of the tables
+ * has it, or else as a literal, which goes in the dynamic table t if
+ * indexing is set.
+ * Returns: the end of what it wrote, at most 8 bytes more than the
+ * name and value.
+ */
+
+static unsigned char *hpack_put(struct hpack_table *t, unsigned char *p,
+                                const char *name, unsigned int name_len,
+                                const char *value, unsigned int value_len,
+                                int indexing)
+{
+    struct hpack_entry *e;
+    const char *s;
+    unsigned int i, name_index = 0;
+
+    for (i = 0; i < HPACK_STATIC; ++i) {
+        s = hpack_static[i].name;
+        if (strncmp(s, name, name_len) || s[name_len] != '\0')
+            continue;
+        s = hpack_static[i].value;
+        if (!strncmp(s, value, value_len) && s[value_len] == '\0')
+            return hpack_put_int(p, i + 1, 7, 0x80);
+        if (!name_index)
+            name_index = i + 1;
+    }
+    for (i = 1; i <= t->count; ++i) {
+        e = &t->entry[(t->oldest + t->count - i) % HPACK_ENTRIES];
+        if (e->name_len != name_len ||
+            memcmp(t->data + e->offset, name, name_len))
+            continue;
+        if (e->value_len == value_len &&
+            !memcmp(t->data + e->offset + name_len, value, value_len))
+            return hpack_put_int(p, HPACK_STATIC + i, 7, 0x80);
+        if (!name_index)
+            name_index = HPACK_STATIC + i;
+    }
+
+    if (indexing && name_len + value_len + 32 <= t->max) {
+        p = hpack_put_int(p, name_index, 6, 0x40);
+        hpack_add(t, name, name_len, value, value_len);
+    } else {
+        p = hpack_put_int(p, name_index, 4, 0);
+    }
+    if (!name_index)
+        p = hpack_put_string(p, name, name_len);
+    return hpack_put_string(p, value, value_len);
+}
+
+/****************************** FRAMES *******************************/
+
+static unsigned char *put32(unsigned char *p, unsigned int v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+    return p + 4;
+}
+
+static unsigned int get32(const unsigned char *p)
+{
+    return (unsigned int) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static unsigned char *frame_head(unsigned char *p, unsigned int len,
+                                 int type, int flags, unsigned int id)
+{
+    p[0] = len >> 16;
+    p[1] = len >> 8;
+    p[2] = len;
+    p[3] = type;
+    p[4] = flags;
+    return put32(p + 5, id);
+}
+
+/* how much more out will take, having moved what's left to the front */
+static unsigned int out_room(struct h2_conn *h2)
+{
+    if (h2->out_start) {
+        memmove(h2->out, h2->out + h2->out_start,
+                h2->out_len - h2->out_start);
+        h2->out_len -= h2->out_start;
+        h2->out_start = 0;
+    }
+    return H2_OUT_SIZE - h2->out_len;
+}
+
+/* a frame with a small payload; the caller has seen to the room
+ * (H2_CONTROL_ROOM), and nothing is waiting for sendfile */
+static void h2_queue(struct h2_conn *h2, int type, int flags,
+                     unsigned int id, const unsigned char *payload,
+                     unsigned int len)
+{
+    unsigned char *p;
+
+    p = frame_head(h2->out + h2->out_len, len, type, flags, id);
+    if (len)
+        memcpy(p, payload, len);
+    h2->out_len += 9 + len;
+}
+
+static void h2_rst(struct h2_conn *h2, unsigned int id, unsigned int code)
+{
+    unsigned char payload[4];
+
+    put32(payload, code);
+    h2_queue(h2, H2_RST_STREAM, 0, id, payload, 4);
+}
+
+static void h2_goaway(struct h2_conn *h2, unsigned int code)
+{
+    unsigned char payload[8];
+
+    put32(put32(payload, h2->last_stream), code);
+    h2_queue(h2, H2_GOAWAY, 0, 0, payload, 8);
+    h2->goaway = 1;
+}
+
+/* a connection error: say why, and close once it's been said */
+static void h2_error(request * conn, unsigned int code, const char *why)
+{
+    struct h2_conn *h2 = conn->h2;
+
+    if (h2->closing)
+        return;
+    log_error_doc(conn);
+    fprintf(stderr, "HTTP/2 connection error %u: %s\n", code, why);
+    h2_goaway(h2, code);
+    h2->closing = 1;
+}
+
+/***************************** STREAMS *******************************/
+
+static request *h2_stream(struct h2_conn *h2, unsigned int id)
+{
+    int i;
+
+    for (i = 0; i < h2->streams; ++i)
+        if (h2->stream[i]->h2_id == id)
+            return h2->stream[i];
+    return NULL;
+}
+
+/*
+ * Name: stream_free
+ * Description: Takes stream s off the connection and gives it to
+ * free_request, to be logged; its status says how it ended.
+ */
+
+static void stream_free(request * conn, request * s)
+{
+    struct h2_conn *h2 = conn->h2;
+    int i;
+
+    for (i = 0; i < h2->streams; ++i) {
+        if (h2->stream[i] == s) {
+            memmove(h2->stream + i, h2->stream + i + 1,
+                    (h2->streams - i - 1) * sizeof (request *));
+            h2->streams--;
+            break;
+        }
+    }
+    s->buffer_start = s->buffer_end = 0;
+    free_request(s);
+}
+
+/* abandon stream s with RST_STREAM(code) */
+static void stream_reset(request * conn, request * s, unsigned int code)
+{
+    h2_rst(conn->h2, s->h2_id, code);
+    s->status = DEAD;
+    stream_free(conn, s);
+}
+
+static void stream_setup(request * conn, request * s, unsigned int id)
+{
+    s->h2_id = id;
+    s->h2_window = conn->h2->initial_window;
+    s->fd = conn->fd;
+    s->time_start = current_usec;
+    s->http_version = HTTP11;   /* for an answer before the request line */
+    s->remote_port = conn->remote_port;
+    memcpy(s->remote_ip_addr, conn->remote_ip_addr,
+           sizeof (s->remote_ip_addr));
+    memcpy(s->local_ip_addr, conn->local_ip_addr,
+           sizeof (s->local_ip_addr));
+}
+
+/* adds to the request s is made of, keeping room for the last CRLF */
+static int stream_add(request * s, const char *data, unsigned int len)
+{
+    if (s->client_stream_pos + len > CLIENT_STREAM_SIZE - 2)
+        return 0;
+    memcpy(s->client_stream + s->client_stream_pos, data, len);
+    s->client_stream_pos += len;
+    return 1;
+}
+
+/*
+ * Name: stream_run
+ * Description: Puts stream s on the connection, once read_header has
+ * made what it can of its request (if parse is set; otherwise it has
+ * its answer already).
+ */
+
+static void stream_run(request * conn, request * s, int parse)
+{
+    struct h2_conn *h2 = conn->h2;
+    int r = 0;
+
+    if (parse) {
+        memcpy(s->client_stream + s->client_stream_pos, "\r\n", 2);
+        s->client_stream_pos += 2;
+        r = read_header(s);
+    }
+    if (!r) {
+        /* the answer is in s->buffer */
+        if (s->status != DEAD)
+            s->status = DONE;
+    } else if (s->status != WRITE && s->status != IOSHUFFLE) {
+        log_error_doc(s);
+        fprintf(stderr, "HTTP/2 stream in state %s\n",
+                request_state_name(s->status));
+        s->status = DEAD;
+    }
+    h2->stream[h2->streams++] = s;
+}
+
+/* names of the fields an HTTP/2 request mustn't have */
+static const char *const hop_by_hop[] = {
+    "connection", "keep-alive", "proxy-connection", "transfer-encoding",
+    "upgrade", NULL
+};
+
+/* ...and of response fields that are new each time, so not indexed */
+static const char *const volatile_fields[] = {
+    "content-length", "content-range", "date", "last-modified", "location",
+    NULL
+};
+
+static int name_in(const char *name, unsigned int len,
+                   const char *const *list)
+{
+    for (; *list; ++list)
+        if (!strncmp(*list, name, len) && (*list)[len] == '\0')
+            return 1;
+    return 0;
+}
+
+/* lower case token characters (RFC 7230, 3.2.6) */
+static int name_ok(const char *name, unsigned int len)
+{
+    unsigned int i;
+    char c;
+
+    if (!len)
+        return 0;
+    for (i = 0; i < len; ++i) {
+        c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+              strchr("!#$%&'*+-.^_`|~", c)) || c == '\0')
+            return 0;
+    }
+    return 1;
+}
+
+/* a path for the request line: no spaces, nothing read_header refuses */
+static int path_ok(const char *path)
+{
+    if (*path != '/')
+        return 0;
+    for (; *path; ++path)
+        if (*path <= ' ' || *path > '~')
+            return 0;
+    return 1;
+}
+
+static int value_ok(const char *value, unsigned int len)
+{
+    return !memchr(value, '\0', len) && !memchr(value, '\r', len) &&
+        !memchr(value, '\n', len);
+}
+
+enum { P_METHOD, P_SCHEME, P_PATH, P_AUTHORITY, P_COUNT };
+static const char *const pseudo_name[P_COUNT + 1] = {
+    ":method", ":scheme", ":path", ":authority", NULL
+};
+
+/*
+ * Name: h2_build
+ * Description: Decodes a request's header block into the
+ * client_stream of new stream s, as the HTTP/1 request it stands for.
+ * The pseudo-header fields wait in s->buffer for the request line.
+ * Returns: 1 if it's ready for read_header, 2 if s has its answer
+ * already, 0 if the request is malformed (a stream error) and -1 if
+ * the block is (a connection error).
+ */
+
+static int h2_build(struct h2_conn *h2, request * s,
+                    const unsigned char *p, const unsigned char *end)
+{
+    struct hpack_field f;
+    struct {
+        unsigned int offset, length;
+    } pseudo[P_COUNT];
+    const char *method = NULL, *path = NULL;
+    unsigned int used = 0, i;
+    int r, fields = 0, seen = 0, started = 0;
+    int malformed = 0, refused = 0, too_big = 0;
+
+    while ((r = hpack_field(&h2->decoder, &p, end, &f, !fields++)) >= 0) {
+        if (malformed || refused || too_big) {
+            if (r == 0)
+                break;
+            continue;           /* the table has to keep up */
+        }
+        if (r && (!f.name || !f.value)) {
+            too_big = 1;
+            continue;
+        }
+        if (r && !value_ok(f.value, f.value_len)) {
+            malformed = 1;
+            continue;
+        }
+        if (r && f.name_len && f.name[0] == ':') {
+            for (i = 0; pseudo_name[i]; ++i)
+                if (!strncmp(pseudo_name[i], f.name, f.name_len) &&
+                    pseudo_name[i][f.name_len] == '\0')
+                    break;
+            if (started || i == P_COUNT || seen & (1 << i)) {
+                malformed = 1;  /* late, unknown or repeated */
+            } else if (used + f.value_len >= BUFFER_SIZE) {
+                too_big = 1;
+            } else {
+                seen |= 1 << i;
+                pseudo[i].offset = used;
+                pseudo[i].length = f.value_len;
+                memcpy(s->buffer + used, f.value, f.value_len);
+                used += f.value_len;
+                s->buffer[used++] = '\0';
+            }
+            continue;
+        }
+
+        if (!started) {
+            /* the request line, now the pseudo-header fields are in */
+            started = 1;
+            if (!(seen & 1 << P_METHOD)) {
+                malformed = 1;
+            } else {
+                method = s->buffer + pseudo[P_METHOD].offset;
+                path = (seen & 1 << P_PATH ?
+                        s->buffer + pseudo[P_PATH].offset : "");
+                if (strcmp(method, "GET") && strcmp(method, "HEAD"))
+                    refused = 1;
+                else if (!(seen & 1 << P_SCHEME) || !path_ok(path))
+                    malformed = 1;
+            }
+            if (malformed || refused)
+                continue;
+            too_big = !stream_add(s, method, strlen(method)) ||
+                !stream_add(s, " ", 1) ||
+                !stream_add(s, path, strlen(path)) ||
+                !stream_add(s, " HTTP/2.0\r\n", 11);
+            if (seen & 1 << P_AUTHORITY)
+                too_big |= !stream_add(s, "Host: ", 6) ||
+                    !stream_add(s, s->buffer + pseudo[P_AUTHORITY].offset,
+                                pseudo[P_AUTHORITY].length) ||
+                    !stream_add(s, "\r\n", 2);
+        }
+        if (r == 0)
+            break;
+
+        if (!name_ok(f.name, f.name_len) ||
+            name_in(f.name, f.name_len, hop_by_hop) ||
+            (f.name_len == 2 && !memcmp(f.name, "te", 2) &&
+             (f.value_len != 8 || memcmp(f.value, "trailers", 8)))) {
+            malformed = 1;
+            continue;
+        }
+        too_big |= !stream_add(s, f.name, f.name_len) ||
+            !stream_add(s, ": ", 2) ||
+            !stream_add(s, f.value, f.value_len) ||
+            !stream_add(s, "\r\n", 2);
+    }
+    if (r < 0)
+        return -1;
+    if (malformed)
+        return 0;
+
+    if (refused) {
+        /* no CGIs over HTTP/2, and so no request bodies */
+        s->client_stream_pos = 0;
+        stream_add(s, method, strlen(method));
+        stream_add(s, " ", 1);
+        stream_add(s, path, strlen(path));
+        stream_add(s, " HTTP/2.0", 9);
+        s->client_stream[s->client_stream_pos] = '\0';
+        s->logline = s->client_stream;
+        h2_refuse(s);
+        return 2;
+    }
+    if (too_big) {
+        log_error_doc(s);
+        fputs("HTTP/2 request too big\n", stderr);
+        send_r_bad_request(s);
+        return 2;
+    }
+    return 1;
+}
+
+/*
+ * Name: h2_headers
+ * Description: A complete header block has come in on stream id:
+ * start the stream, or refuse it, or (trailers, or a stream we won't
+ * take) just keep the decoder's table up to date.
+ */
+
+static void h2_headers(request * conn, unsigned int id,
+                       const unsigned char *block, unsigned int len)
+{
+    struct h2_conn *h2 = conn->h2;
+    const unsigned char *p = block, *end = block + len;
+    struct hpack_field f;
+    request *s = NULL;
+    int r, fields = 0;
+
+    if (id <= h2->last_stream || h2->goaway || h2->peer_goaway ||
+        h2->streams == H2_MAX_STREAMS || !(s = new_request())) {
+        while ((r = hpack_field(&h2->decoder, &p, end, &f,
+                                !fields++)) > 0);
+        if (r < 0) {
+            h2_error(conn, H2_COMPRESSION_ERROR, "bad header block");
+        } else if (id > h2->last_stream) {
+            h2->last_stream = id;
+            if (!h2->goaway && !h2->peer_goaway)
+                h2_rst(h2, id, H2_REFUSED_STREAM);
+        }
+        return;
+    }
+
+    h2->last_stream = id;
+    stream_setup(conn, s, id);
+    r = h2_build(h2, s, p, end);
+    if (r <= 0) {
+        enqueue(&request_free, s); /* there's nothing to log */
+        if (r < 0)
+            h2_error(conn, H2_COMPRESSION_ERROR, "bad header block");
+        else
+            h2_rst(h2, id, H2_PROTOCOL_ERROR);
+        return;
+    }
+    status.requests++;
+    stream_run(conn, s, r == 1);
+    s->bytes_in = len;
+}
+
+/*
+ * Name: h2_settings
+ * Description: Takes the client's settings, from a SETTINGS frame or
+ * the HTTP2-Settings header.
+ * Returns: 0, or the code for a connection error.
+ */
+
+static unsigned int h2_settings(struct h2_conn *h2, const unsigned char *p,
+                                unsigned int len)
+{
+    unsigned int value;
+    int i, delta;
+
+    for (; len >= 6; p += 6, len -= 6) {
+        value = get32(p + 2);
+        switch (p[0] << 8 | p[1]) {
+        case H2_HEADER_TABLE_SIZE:
+            if (value > H2_TABLE_SIZE)
+                value = H2_TABLE_SIZE;
+            if (value != h2->encoder.max) {
+                /* the next header block starts by saying so */
+                if (!h2->table_update || value < h2->table_low)
+                    h2->table_low = value;
+                h2->table_update = 1;
+                h2->encoder.max = value;
+                hpack_evict(&h2->encoder, value);
+            }
+            break;
+        case H2_ENABLE_PUSH:
+            if (value > 1)
+                return H2_PROTOCOL_ERROR;
+            break;
+        case H2_INITIAL_WINDOW_SIZE:
+            if (value > H2_WINDOW_MAX)
+                return H2_FLOW_CONTROL_ERROR;
+            delta = (int) value - h2->initial_window;
+            for (i = 0; i < h2->streams; ++i) {
+                if (delta > 0 &&
+                    h2->stream[i]->h2_window > H2_WINDOW_MAX - delta)
+                    return H2_FLOW_CONTROL_ERROR;
+                h2->stream[i]->h2_window += delta;
+            }
+            h2->initial_window = value;
+            break;
+        case H2_MAX_FRAME_SIZE:
+            /* ours are never bigger than the smallest allowed */
+            if (value < 16384 || value > 16777215)
+                return H2_PROTOCOL_ERROR;
+            break;
+        default:
+            break;              /* the rest don't matter to a server */
+        }
+    }
+    return 0;
+}
+
+/*
+ * Name: h2_frame
+ * Description: Acts on a frame from the client.  Anything that goes
+ * back is small, and there is H2_CONTROL_ROOM for it in out.
+ */
+
+static void h2_frame(request * conn, int type, int flags, unsigned int id,
+                     unsigned char *p, unsigned int len)
+{
+    struct h2_conn *h2 = conn->h2;
+    unsigned char payload[4];
+    unsigned int pad = 0, value;
+    request *s;
+
+    if (h2->block_stream &&
+        (type != H2_CONTINUATION || id != h2->block_stream)) {
+        h2_error(conn, H2_PROTOCOL_ERROR, "frame inside a header block");
+        return;
+    }
+    if (!h2->settings_seen && type != H2_SETTINGS) {
+        h2_error(conn, H2_PROTOCOL_ERROR, "no SETTINGS after the preface");
+        return;
+    }
+
+    switch (type) {
+    case H2_DATA:
+        if (!id || id > h2->last_stream) {
+            h2_error(conn, H2_PROTOCOL_ERROR, "DATA on an idle stream");
+            return;
+        }
+        if ((flags & H2_PADDED) && (len == 0 || p[0] >= len)) {
+            h2_error(conn, H2_PROTOCOL_ERROR, "bad padding");
+            return;
+        }
+        /* no request bodies are taken, but the window stays open */
+        h2->recv_window -= len;
+        if (h2->recv_window < 0) {
+            h2_error(conn, H2_FLOW_CONTROL_ERROR, "DATA past the window");
+            return;
+        }
+        if (h2->recv_window < H2_WINDOW_DEFAULT / 2) {
+            put32(payload, H2_WINDOW_DEFAULT - h2->recv_window);
+            h2_queue(h2, H2_WINDOW_UPDATE, 0, 0, payload, 4);
+            h2->recv_window = H2_WINDOW_DEFAULT;
+        }
+        break;
+
+    case H2_HEADERS:
+        if (!(id & 1)) {
+            h2_error(conn, H2_PROTOCOL_ERROR, "HEADERS on a server stream");
+            return;
+        }
+        if (flags & H2_PADDED) {
+            if (!len) {
+                h2_error(conn, H2_PROTOCOL_ERROR, "bad padding");
+                return;
+            }
+            pad = *p++;
+            len--;
+        }
+        if (flags & H2_PRIORITY_FLAG) {
+            if (len < 5) {
+                h2_error(conn, H2_FRAME_SIZE_ERROR, "short HEADERS");
+                return;
+            }
+            p += 5;
+            len -= 5;
+        }
+        if (pad > len) {
+            h2_error(conn, H2_PROTOCOL_ERROR, "bad padding");
+            return;
+        }
+        len -= pad;
+        if (flags & H2_END_HEADERS) {
+            h2_headers(conn, id, p, len);
+        } else {
+            memmove(h2->in, p, len);
+            h2->block_stream = id;
+            h2->block_len = len;
+        }
+        break;
+
+    case H2_PRIORITY:
+        if (!id) {
+            h2_error(conn, H2_PROTOCOL_ERROR, "PRIORITY on stream 0");
+            return;
+        }
+        if (len != 5) {
+            s = h2_stream(h2, id);
+            if (s)
+                stream_reset(conn, s, H2_FRAME_SIZE_ERROR);
+            else
+                h2_rst(h2, id, H2_FRAME_SIZE_ERROR);
+        }
+        break;
+
+    case H2_RST_STREAM:
+        if (len != 4) {
+            h2_error(conn, H2_FRAME_SIZE_ERROR, "bad RST_STREAM");
+            return;
+        }
+        if (!id || id > h2->last_stream) {
+            h2_error(conn, H2_PROTOCOL_ERROR, "RST_STREAM on an idle stream");
+            return;
+        }
+        s = h2_stream(h2, id);
+        if (s) {
+            s->status = DEAD;
+            stream_free(conn, s);
+        }
+        break;
+
+    case H2_SETTINGS:
+        if (id) {
+            h2_error(conn, H2_PROTOCOL_ERROR, "SETTINGS on a stream");
+            return;
+        }
+        if (flags & H2_ACK) {
+            if (len)
+                h2_error(conn, H2_FRAME_SIZE_ERROR, "bad SETTINGS ACK");
+            return;
+        }
+        if (len % 6) {
+            h2_error(conn, H2_FRAME_SIZE_ERROR, "bad SETTINGS");
+            return;
+        }
+        value = h2_settings(h2, p, len);
+        if (value) {
+            h2_error(conn, value, "bad SETTINGS");
+            return;
+        }
+        h2->settings_seen = 1;
+        h2_queue(h2, H2_SETTINGS, H2_ACK, 0, NULL, 0);
+        break;
+
+    case H2_PUSH_PROMISE:
+        h2_error(conn, H2_PROTOCOL_ERROR, "PUSH_PROMISE from a client");
+        return;
+
+    case H2_PING:
+        if (id || len != 8) {
+            h2_error(conn, (id ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR),
+                     "bad PING");
+            return;
+        }
+        if (!(flags & H2_ACK))
+            h2_queue(h2, H2_PING, H2_ACK, 0, p, 8);
+        break;
+
+    case H2_GOAWAY:
+        if (id || len < 8) {
+            h2_error(conn, (id ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR),
+                     "bad GOAWAY");
+            return;
+        }
+        h2->peer_goaway = 1;    /* finish what's open, then close */
+        break;
+
+    case H2_WINDOW_UPDATE:
+        if (len != 4) {
+            h2_error(conn, H2_FRAME_SIZE_ERROR, "bad WINDOW_UPDATE");
+            return;
+        }
+        value = get32(p) & H2_WINDOW_MAX;
+        if (!id) {
+            if (!value || (h2->send_window > 0 &&
+                           value > (unsigned) (H2_WINDOW_MAX -
+                                               h2->send_window))) {
+                h2_error(conn, (value ? H2_FLOW_CONTROL_ERROR :
+                                H2_PROTOCOL_ERROR), "bad WINDOW_UPDATE");
+                return;
+            }
+            h2->send_window += value;
+        } else if ((s = h2_stream(h2, id)) != NULL) {
+            if (!value || (s->h2_window > 0 &&
+                           value > (unsigned) (H2_WINDOW_MAX -
+                                               s->h2_window)))
+                stream_reset(conn, s, (value ? H2_FLOW_CONTROL_ERROR :
+                                       H2_PROTOCOL_ERROR));
+            else
+                s->h2_window += value;
+        } else if (id > h2->last_stream) {
+            h2_error(conn, H2_PROTOCOL_ERROR,
+                     "WINDOW_UPDATE on an idle stream");
+            return;
+        }
+        break;
+
+    case H2_CONTINUATION:
+        if (!h2->block_stream) {
+            h2_error(conn, H2_PROTOCOL_ERROR, "CONTINUATION out of place");
+            return;
+        }
+        memmove(h2->in + h2->block_len, p, len);
+        h2->block_len += len;
+        if (flags & H2_END_HEADERS) {
+            h2->block_stream = 0;
+            h2_headers(conn, id, h2->in, h2->block_len);
+            h2->block_len = 0;
+        }
+        break;
+
+    default:
+        break;                  /* unknown types are ignored */
+    }
+}
+
+/*
+ * Name: h2_input
+ * Description: Goes through the frames in h2->in, for as long as out
+ * has room for what they need back.
+ */
+
+static void h2_input(request * conn)
+{
+    struct h2_conn *h2 = conn->h2;
+    unsigned char *p;
+    unsigned int avail, len;
+
+    while (!h2->closing && out_room(h2) >= H2_CONTROL_ROOM) {
+        p = h2->in + h2->in_pos;
+        avail = h2->in_len - h2->in_pos;
+        if (h2->preface < PREFACE_LEN) {
+            len = PREFACE_LEN - h2->preface;
+            if (len > avail)
+                len = avail;
+            if (!len)
+                break;
+            if (memcmp(p, preface + h2->preface, len)) {
+                h2_error(conn, H2_PROTOCOL_ERROR, "no connection preface");
+                break;
+            }
+            h2->preface += len;
+            h2->in_pos += len;
+            continue;
+        }
+        if (avail < 9)
+            break;
+        len = p[0] << 16 | p[1] << 8 | p[2];
+        if (len > H2_FRAME_SIZE) {
+            h2_error(conn, H2_FRAME_SIZE_ERROR, "frame too big");
+            break;
+        }
+        if (avail < 9 + len) {
+            if (h2->block_len + 9 + len > H2_IN_SIZE)
+                h2_error(conn, H2_ENHANCE_YOUR_CALM, "header block too big");
+            break;
+        }
+        h2->in_pos += 9 + len;
+        h2_frame(conn, p[3], p[4], get32(p + 5) & H2_STREAM_ID, p + 9, len);
+    }
+
+    /* keep the header block being put together, and what's unread */
+    if (h2->in_pos > h2->block_len) {
+        memmove(h2->in + h2->block_len, h2->in + h2->in_pos,
+                h2->in_len - h2->in_pos);
+        h2->in_len -= h2->in_pos - h2->block_len;
+        h2->in_pos = h2->block_len;
+    }
+}
+
+/* a stream's document still to send (but not what's in its buffer) */
+static int body_pending(request * s)
+{
+    return s->method != M_HEAD && s->ranges &&
+        (s->status == WRITE || s->status == IOSHUFFLE);
+}
+
+/*
+ * Name: flow
+ * Description: How much of left bytes of stream s can go in the next
+ * DATA frame, with room bytes for it in out.
+ */
+
+static unsigned int flow(struct h2_conn *h2, request * s, off_t left,
+                         unsigned int room)
+{
+    off_t chunk = left;
+
+    if (chunk > H2_FRAME_SIZE)
+        chunk = H2_FRAME_SIZE;
+    if (chunk > s->h2_window)
+        chunk = s->h2_window;
+    if (chunk > h2->send_window)
+        chunk = h2->send_window;
+    if (chunk <= 0)
+        return 0;
+    if (chunk > room) {
+        if (room < H2_DATA_MIN)
+            return 0;           /* wait for out to drain */
+        chunk = room;
+    }
+    return chunk;
+}
+
+/* the DATA frame header for len bytes of stream s */
+static unsigned char *data_head(struct h2_conn *h2, request * s,
+                                unsigned int len, int end)
+{
+    unsigned char *p;
+
+    p = frame_head(h2->out + h2->out_len, len, H2_DATA,
+                   (end ? H2_END_STREAM : 0), s->h2_id);
+    h2->out_len += 9;
+    s->h2_window -= len;
+    h2->send_window -= len;
+    return p;
+}
+
+/*
+ * Name: stream_headers
+ * Description: Turns the HTTP/1 header that send_r_* and friends left
+ * in the stream's buffer into a HEADERS frame.
+ * Returns: as for stream_send.
+ */
+
+static int stream_headers(request * conn, request * s, unsigned int room)
+{
+    struct h2_conn *h2 = conn->h2;
+    char *line, *next, *eol, *colon, *value;
+    char *end = s->buffer + s->buffer_end;
+    unsigned char *start, *p;
+    unsigned int head;
+    int last;
+
+    for (next = s->buffer; next + 3 < end && memcmp(next, "\r\n\r\n", 4);
+         ++next);
+    line = memchr(s->buffer, ' ', end - s->buffer);
+    if (next + 3 >= end || !line || line + 4 > next ||
+        !isdigit((unsigned char) line[1]) ||
+        !isdigit((unsigned char) line[2]) ||
+        !isdigit((unsigned char) line[3])) {
+        log_error_doc(s);
+        fputs("HTTP/2 stream has no response header\n", stderr);
+        stream_reset(conn, s, H2_INTERNAL_ERROR);
+        return -1;
+    }
+    head = next + 4 - s->buffer;
+    if (room < 9 + 16 + 2 * head)
+        return 0;
+
+    start = p = h2->out + h2->out_len + 9;
+    if (h2->table_update) {
+        if (h2->table_low < h2->encoder.max)
+            p = hpack_put_int(p, h2->table_low, 5, 0x20);
+        p = hpack_put_int(p, h2->encoder.max, 5, 0x20);
+        h2->table_update = 0;
+    }
+    p = hpack_put(&h2->encoder, p, ":status", 7, line + 1, 3, 1);
+
+    end = s->buffer + head - 2; /* the blank line */
+    for (line = memchr(s->buffer, '\n', head) + 1; line < end;
+         line = next + 1) {
+        next = memchr(line, '\n', end + 1 - line);
+        eol = (next[-1] == '\r' ? next - 1 : next);
+        colon = memchr(line, ':', eol - line);
+        if (!colon || colon == line)
+            continue;
+        for (value = line; value < colon; ++value)
+            *value = tolower((unsigned char) *value);
+        if (name_in(line, colon - line, hop_by_hop))
+            continue;
+        for (value = colon + 1; value < eol && (*value == ' ' ||
+                                                *value == '\t'); ++value);
+        p = hpack_put(&h2->encoder, p, line, colon - line, value,
+                      eol - value,
+                      !name_in(line, colon - line, volatile_fields));
+    }
+
+    last = (head == (unsigned) s->buffer_end && !body_pending(s));
+    frame_head(h2->out + h2->out_len, p - start, H2_HEADERS,
+               H2_END_HEADERS | (last ? H2_END_STREAM : 0), s->h2_id);
+    h2->out_len += 9 + (p - start);
+    s->h2_flags |= H2_HEADERS_SENT;
+    note_first_byte(s);
+    if (last) {
+        s->status = DONE;
+        stream_free(conn, s);
+        return -1;
+    }
+    s->buffer_start = head;
+    if (s->buffer_start == s->buffer_end)
+        s->buffer_start = s->buffer_end = 0;
+    return 1;
+}
+
+/*
+ * Name: stream_copy
+ * Description: memcpy from a mapped document, which SIGBUS may cut
+ * short if the file shrank.  It's on its own so that no variable of
+ * stream_send's lives across the setjmp.
+ * Returns: 1, or 0 if there was a SIGBUS.
+ */
+
+static int stream_copy(unsigned char *to, const char *from,
+                       unsigned int len)
+{
+    if (setjmp(env) == 0) {
+        handle_sigbus = 1;
+        memcpy(to, from, len);
+        handle_sigbus = 0;
+        return 1;
+    }
+    handle_sigbus = 0;
+    return 0;
+}
+
+/*
+ * Name: stream_send
+ * Description: Queues the next frame of stream s: its header, what's
+ * in its buffer, or a piece of the document, as much as the flow
+ * control windows and the room in out allow.
+ * Returns: 1 if it queued something, 0 if the stream has to wait, -1
+ * if the stream is done with.
+ */
+
+static int stream_send(request * conn, request * s)
+{
+    struct h2_conn *h2 = conn->h2;
+    unsigned int room = out_room(h2), chunk;
+    off_t left;
+    int end;
+
+    if (room < 9 + H2_CONTROL_ROOM)
+        return 0;
+    room -= 9;
+
+    if (s->h2_flags & H2_REFUSED) {
+        h2_rst(h2, s->h2_id, H2_HTTP_1_1_REQUIRED);
+        s->status = DONE;
+        stream_free(conn, s);
+        return -1;
+    }
+    if (s->status == DEAD) {
+        stream_reset(conn, s, H2_INTERNAL_ERROR);
+        return -1;
+    }
+    if (!(s->h2_flags & H2_HEADERS_SENT))
+        return stream_headers(conn, s, room + 9);
+
+    if (s->buffer_start < s->buffer_end) {
+        /* what came after the header, or a multipart boundary */
+        left = s->buffer_end - s->buffer_start;
+        chunk = flow(h2, s, left, room);
+        if (!chunk)
+            return 0;
+        end = (chunk == left && !body_pending(s));
+        memcpy(data_head(h2, s, chunk, end), s->buffer + s->buffer_start,
+               chunk);
+        h2->out_len += chunk;
+        s->buffer_start += chunk;
+        if (s->buffer_start == s->buffer_end)
+            s->buffer_start = s->buffer_end = 0;
+    } else if (body_pending(s)) {
+        left = s->ranges->stop - s->ranges->start + 1;
+        if (left <= 0) {
+            complete_response(s);
+            return 1;
+        }
+#ifdef HAVE_SENDFILE
+        if (s->data_fd) {
+            /* just the frame header here, h2_flush sends the rest */
+            chunk = flow(h2, s, left, H2_FRAME_SIZE);
+            if (!chunk)
+                return 0;
+            end = (chunk == left && !s->ranges->next &&
+                   !(s->response_status == R_PARTIAL_CONTENT &&
+                     s->numranges > 1));
+            data_head(h2, s, chunk, end);
+            h2->send_stream = s;
+            h2->send_left = chunk;
+            h2->send_end = end;
+            return 1;
+        }
+#endif
+        chunk = flow(h2, s, left, room);
+        if (!chunk)
+            return 0;
+        end = (chunk == left && !s->ranges->next &&
+               !(s->response_status == R_PARTIAL_CONTENT &&
+                 s->numranges > 1));
+        if (s->data_fd) {
+            ssize_t n = pread(s->data_fd, h2->out + h2->out_len + 9,
+                              chunk, s->ranges->start);
+
+            if (n != (ssize_t) chunk) {
+                log_error_doc(s);
+                perror("HTTP/2 pread");
+                stream_reset(conn, s, H2_INTERNAL_ERROR);
+                return -1;
+            }
+        } else if (!stream_copy(h2->out + h2->out_len + 9,
+                                s->data_mem + s->ranges->start, chunk)) {
+            log_error_doc(s);
+            fprintf(stderr, "%sGot SIGBUS in memcpy!\n",
+                    get_commonlog_time());
+            stream_reset(conn, s, H2_INTERNAL_ERROR);
+            return -1;
+        }
+        data_head(h2, s, chunk, end);
+        h2->out_len += chunk;
+        s->ranges->start += chunk;
+        s->bytes_written += chunk;
+        if (chunk == left)
+            complete_response(s);
+    } else {
+        /* all sent, but without END_STREAM */
+        data_head(h2, s, 0, 1);
+        end = 1;
+    }
+
+    if (end) {
+        s->status = DONE;
+        stream_free(conn, s);
+        return -1;
+    }
+    return 1;
+}
+
+/*
+ * Name: h2_schedule
+ * Description: Fills out with frames from the streams, a frame from
+ * each in turn, until out is full, the windows are shut or sendfile
+ * has to take over.
+ */
+
+static void h2_schedule(request * conn)
+{
+    struct h2_conn *h2 = conn->h2;
+    int i, r, busy;
+
+    /* after an upgrade, not before the client is ready for it:
+     * some can't take a window's worth along with the 101 */
+    if (!h2->settings_seen)
+        return;
+
+    do {
+        busy = 0;
+        for (i = 0; i < h2->streams && !h2->send_left && !h2->closing;) {
+            r = stream_send(conn, h2->stream[i]);
+            if (r >= 0)
+                ++i;            /* otherwise the next one moved up */
+            if (r)
+                busy = 1;
+        }
+    } while (busy && !h2->send_left && !h2->closing);
+}
+
+/*
+ * Name: h2_flush
+ * Description: Writes out, then the payload of its last frame if that
+ * is for sendfile.
+ * Returns: 1 if it's all gone, 0 if the socket is full, -1 for an
+ * error.  *progress is set if anything was written.
+ */
+
+static int h2_flush(request * conn, int *progress)
+{
+    struct h2_conn *h2 = conn->h2;
+    ssize_t n;
+
+    while (h2->out_start < h2->out_len) {
+        n = write(conn->fd, h2->out + h2->out_start,
+                  h2->out_len - h2->out_start);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EWOULDBLOCK || errno == EAGAIN)
+                return 0;
+#ifdef QUIET_DISCONNECT
+            if (errno != ECONNRESET && errno != EPIPE)
+#endif
+            {
+                errlog_doc(conn, ERRLOG_FLUSH, errno);
+            }
+            return -1;
+        }
+        BOA_PROBE3(write, conn, conn->fd, n);
+        h2->out_start += n;
+        *progress = 1;
+    }
+    h2->out_start = h2->out_len = 0;
+
+#ifdef HAVE_SENDFILE
+    while (h2->send_left) {
+        request *s = h2->send_stream;
+        off_t offset = s->ranges->start;
+
+        n = sendfile(conn->fd, s->data_fd, &offset, h2->send_left);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EWOULDBLOCK || errno == EAGAIN)
+                return 0;
+#ifdef QUIET_DISCONNECT
+            if (errno != ECONNRESET && errno != EPIPE)
+#endif
+            {
+                errlog_doc(s, ERRLOG_SENDFILE, errno);
+            }
+            return -1;
+        } else if (n == 0) {
+            /* the file got shorter, and the frame can't be finished */
+            log_error_doc(s);
+            fputs("HTTP/2 sendfile hit the end of the file\n", stderr);
+            return -1;
+        }
+        BOA_PROBE3(sendfile, s, conn->fd, n);
+        s->ranges->start = offset;
+        s->bytes_written += n;
+        h2->send_left -= n;
+        *progress = 1;
+    }
+    if (h2->send_stream) {
+        request *s = h2->send_stream;
+
+        h2->send_stream = NULL;
+        if (s->ranges->stop + 1 <= s->ranges->start)
+            complete_response(s);
+        if (h2->send_end) {
+            s->status = DONE;
+            stream_free(conn, s);
+        }
+    }
+#endif
+    return 1;
+}
+
+/*************************** THE CONNECTION ***************************/
+
+/*
+ * Name: h2_buffers
+ * Description: Gives the connection its in and out, if it gave them
+ * back (h2_process does, when idle).
+ * Returns: 1, or 0 if there was no memory for them.
+ */
+
+static int h2_buffers(struct h2_conn *h2)
+{
+    if (!h2->in) {
+        h2->in = (unsigned char *) malloc(H2_IN_SIZE + H2_OUT_SIZE);
+        if (!h2->in) {
+            log_error_time();
+            perror("malloc for HTTP/2 buffers");
+            return 0;
+        }
+        h2->out = h2->in + H2_IN_SIZE;
+    }
+    return 1;
+}
+
+/*
+ * Name: h2_start
+ * Description: Makes req an HTTP/2 connection: greeting (the 101 of
+ * an upgrade) and our SETTINGS go out first, and what the client sent
+ * after its request is HTTP/2 already.
+ * Returns: 1, or 0 if there was no memory for it.
+ */
+
+static int h2_start(request * req, const char *greeting)
+{
+    struct h2_conn *h2;
+    unsigned char settings[12];
+    unsigned int len;
+
+    h2 = (struct h2_conn *) malloc(sizeof (struct h2_conn));
+    if (!h2) {
+        log_error_time();
+        perror("malloc for HTTP/2 connection");
+        return 0;
+    }
+    memset(h2, 0, offsetof(struct h2_conn, in_pos));
+    h2->decoder.max = h2->encoder.max = H2_TABLE_SIZE;
+    h2->initial_window = h2->send_window = h2->recv_window =
+        H2_WINDOW_DEFAULT;
+    h2->in_pos = h2->out_start = h2->out_len = 0;
+    h2->in = NULL;
+    if (!h2_buffers(h2)) {
+        free(h2);
+        return 0;
+    }
+
+    if (greeting) {
+        len = strlen(greeting);
+        memcpy(h2->out, greeting, len);
+        h2->out_len = len;
+    }
+    settings[0] = 0;
+    settings[1] = H2_MAX_CONCURRENT_STREAMS;
+    put32(settings + 2, H2_MAX_STREAMS);
+    settings[6] = 0;
+    settings[7] = H2_MAX_HEADER_LIST_SIZE;
+    put32(settings + 8, CLIENT_STREAM_SIZE);
+    h2_queue(h2, H2_SETTINGS, 0, 0, settings, sizeof (settings));
+
+    len = req->client_stream_pos - req->parse_pos;
+    memcpy(h2->in, req->client_stream + req->parse_pos, len);
+    h2->in_len = len;
+    req->client_stream_pos = req->parse_pos;
+
+    /* frames are small and interleaved, don't let them wait */
+    len = 1;
+    if (setsockopt(req->fd, IPPROTO_TCP, TCP_NODELAY, (void *) &len,
+                   sizeof (len)) == -1) {
+        log_error_doc(req);
+        perror("setsockopt: unable to set TCP_NODELAY");
+    }
+
+    req->h2 = h2;
+    req->status = HTTP2;
+    SQUASH_KA(req);
+    return 1;
+}
+
+/*
+ * Name: h2_preface
+ * Description: Called by process_logline for "PRI * HTTP/2.0", the
+ * start of the connection preface.  Without HTTP2, the client is told
+ * to use HTTP/1.1.
+ * Returns: 1 if the connection is HTTP/2 now, 0 if it is to be closed.
+ */
+
+int h2_preface(request * req)
+{
+    if (!http2 || !h2_start(req, NULL)) {
+        send_r_http2_required(req);
+        return 0;
+    }
+    req->h2->preface = PREFACE_LINE;
+    status.requests--;          /* its streams are counted instead */
+    return 1;
+}
+
+/* is token in the comma separated list of any of the lines of field? */
+static int has_token(request * req, struct header_field *field,
+                     const char *token)
+{
+    unsigned int len = strlen(token);
+    const char *p;
+
+    for (; field; field = (field->next ?
+                           &req->header_fields[field->next - 1] : NULL)) {
+        p = header_value(req, field);
+        while (*p) {
+            while (*p == ' ' || *p == '\t' || *p == ',')
+                ++p;
+            if (!strncasecmp(p, token, len) &&
+                (p[len] == '\0' || p[len] == ',' || p[len] == ' ' ||
+                 p[len] == '\t'))
+                return 1;
+            while (*p && *p != ',')
+                ++p;
+        }
+    }
+    return 0;
+}
+
+/* fields of an upgrade request that aren't for its stream 1 */
+static int upgrade_only(const char *name, unsigned int len, int absolute)
+{
+    static const char *const fields[] = {
+        "Connection", "Upgrade", "HTTP2-Settings", "Keep-Alive", NULL
+    };
+    const char *const *f;
+
+    if (absolute && len == 4 && !strncasecmp(name, "Host", 4))
+        return 1;
+    for (f = fields; *f; ++f)
+        if (strlen(*f) == len && !strncasecmp(name, *f, len))
+            return 1;
+    return 0;
+}
+
+/* base64url, as in HTTP2-Settings; returns the length or -1 */
+static int base64url_decode(const char *in, unsigned char *out,
+                            unsigned int room)
+{
+    unsigned int bits = 0, n = 0;
+    int nbits = 0, v;
+
+    for (; *in && *in != '='; ++in) {
+        if (*in >= 'A' && *in <= 'Z')
+            v = *in - 'A';
+        else if (*in >= 'a' && *in <= 'z')
+            v = *in - 'a' + 26;
+        else if (*in >= '0' && *in <= '9')
+            v = *in - '0' + 52;
+        else if (*in == '-')
+            v = 62;
+        else if (*in == '_')
+            v = 63;
+        else
+            return -1;
+        bits = (bits << 6 | v) & 0xfff;
+        nbits += 6;
+        if (nbits >= 8) {
+            if (n == room)
+                return -1;
+            nbits -= 8;
+            out[n++] = bits >> nbits;
+        }
+    }
+    return n;
+}
+
+/*
+ * Name: h2_upgrade
+ * Description: Called by header_end.  A GET or HEAD asking to upgrade
+ * to h2c (RFC 7540, 3.2) gets 101 Switching Protocols, and goes on as
+ * stream 1 of the HTTP/2 connection that follows.
+ * Returns: 1 if it did, 0 if req is to go on as HTTP/1.1.
+ */
+
+int h2_upgrade(request * req)
+{
+    struct header_field *field, *settings;
+    struct slice *host = &req->headers[H_HOST];
+    unsigned char buf[96];      /* 16 settings */
+    unsigned int code;
+    request *s;
+    int len, i, ok, absolute = 0;
+
+    if (req->h2_id || req->http_version != HTTP11 ||
+        (req->method != M_GET && req->method != M_HEAD) ||
+        req->headers[H_CONTENT_LENGTH].length ||
+        req->headers[H_TRANSFER_ENCODING].length)
+        return 0;
+    settings = find_header(req, "HTTP2-Settings", 14);
+    if (!settings || settings->next ||
+        !has_token(req, find_header(req, "Upgrade", 7), "h2c") ||
+        !has_token(req, find_header(req, "Connection", 10), "Upgrade"))
+        return 0;
+    len = base64url_decode(header_value(req, settings), buf, sizeof (buf));
+    if (len < 0 || len % 6)
+        return 0;
+
+    /* the request again, for stream 1 */
+    s = new_request();
+    if (!s)
+        return 0;
+    ok = stream_add(s, (req->method == M_HEAD ? "HEAD " : "GET "),
+                    (req->method == M_HEAD ? 5 : 4)) &&
+        stream_add(s, req->request_uri, strlen(req->request_uri)) &&
+        stream_add(s, " HTTP/2.0\r\n", 11);
+    if (host->length && host->offset < strlen(req->logline)) {
+        /* from an absolute URI, Host fields don't count */
+        absolute = 1;
+        ok = ok && stream_add(s, "Host: ", 6) &&
+            stream_add(s, req->client_stream + host->offset,
+                       host->length) && stream_add(s, "\r\n", 2);
+    }
+    for (i = 0; i < req->header_count && ok; ++i) {
+        field = &req->header_fields[i];
+        if (upgrade_only(req->client_stream + field->name.offset,
+                         field->name.length, absolute))
+            continue;
+        ok = stream_add(s, req->client_stream + field->name.offset,
+                        field->name.length) &&
+            stream_add(s, ": ", 2) &&
+            stream_add(s, header_value(req, field), field->value.length) &&
+            stream_add(s, "\r\n", 2);
+    }
+    if (!ok || !h2_start(req, "HTTP/1.1 101 Switching Protocols" CRLF
+                         "Connection: Upgrade" CRLF "Upgrade: h2c" CRLF
+                         CRLF)) {
+        enqueue(&request_free, s);
+        return 0;
+    }
+
+    code = h2_settings(req->h2, buf, len);
+    if (code) {
+        h2_error(req, code, "bad HTTP2-Settings");
+        enqueue(&request_free, s);
+        return 1;
+    }
+    req->h2->last_stream = 1;
+    stream_setup(req, s, 1);
+    s->time_start = req->time_start;
+    stream_run(req, s, 1);
+    return 1;
+}
+
+/*
+ * Name: h2_refuse
+ * Description: Called by init_cgi for a stream: there are no CGIs
+ * over HTTP/2, the client is to ask again over HTTP/1.1.
+ */
+
+void h2_refuse(request * req)
+{
+    reset_output_buffer(req);
+    req->h2_flags |= H2_REFUSED;
+    req->response_status = R_BAD_VERSION;
+}
+
+/*
+ * Name: h2_process
+ * Description: Does what there is to do on an HTTP/2 connection:
+ * writes, reads, acts on the frames and queues more from the streams.
+ *
+ * Return values:
+ *  -1: blocked, on writing if h2_writing says so, or else on reading
+ *   0: closed, or to be closed
+ *   1: more to do
+ */
+
+int h2_process(request * conn)
+{
+    struct h2_conn *h2 = conn->h2;
+    int progress = 0, r;
+    ssize_t n;
+
+    if (!h2_buffers(h2)) {
+        conn->status = DEAD;
+        return 0;
+    }
+    r = h2_flush(conn, &progress);
+    if (r < 0) {
+        conn->status = DEAD;
+        return 0;
+    } else if (r == 0) {
+        return (progress ? 1 : -1);
+    } else if (h2->closing) {
+        return 0;
+    }
+
+    if (sigterm_flag && !h2->goaway)
+        h2_goaway(h2, H2_NO_ERROR); /* the open streams will finish */
+
+    if (h2->in_len < H2_IN_SIZE) {
+        n = read(conn->fd, h2->in + h2->in_len, H2_IN_SIZE - h2->in_len);
+        if (n == 0) {
+            return 0;           /* the client is gone */
+        } else if (n > 0) {
+            h2->in_len += n;
+            conn->bytes_in += n;
+            progress = 1;
+        } else if (errno != EINTR && errno != EAGAIN &&
+                   errno != EWOULDBLOCK) {
+#ifdef QUIET_DISCONNECT
+            if (errno != ECONNRESET)
+#endif
+            {
+                log_error_doc(conn);
+                perror("HTTP/2 read");
+            }
+            conn->status = DEAD;
+            return 0;
+        }
+    }
+
+    h2_input(conn);
+    h2_schedule(conn);
+    if ((h2->goaway || h2->peer_goaway) && !h2->streams && !h2->block_stream)
+        h2->closing = 1;
+
+    r = h2_flush(conn, &progress);
+    if (r < 0) {
+        conn->status = DEAD;
+        return 0;
+    } else if (r > 0 && h2->closing) {
+        return 0;
+    }
+    if (r > 0 && !h2->streams && !h2->block_stream && !h2->in_len) {
+        /* nothing to answer, nothing half read: wait without them */
+        free(h2->in);
+        h2->in = h2->out = NULL;
+    }
+    return (progress ? 1 : -1);
+}
+
+/* is the connection waiting to write, rather than to read? */
+int h2_writing(request * conn)
+{
+    return conn->h2->out_start < conn->h2->out_len || conn->h2->send_left;
+}
+
+/* ...or waiting for nothing in particular, so it may time out */
+int h2_idle(request * conn)
+{
+    return !conn->h2->streams && !conn->h2->block_stream &&
+        !h2_writing(conn);
+}
+
+/*
+ * Name: h2_close
+ * Description: Called by free_request for the connection: the streams
+ * still open go first.  One that times out idle is told so.
+ */
+
+void h2_close(request * conn)
+{
+    struct h2_conn *h2 = conn->h2;
+    request *s;
+
+    if (conn->status == TIMED_OUT && !h2->goaway && !h2_writing(conn) &&
+        h2_buffers(h2)) {
+        h2_goaway(h2, H2_NO_ERROR);
+        if (write(conn->fd, h2->out, h2->out_len) == -1) {
+            /* it was only polite */
+        }
+    }
+    while (h2->streams) {
+        s = h2->stream[h2->streams - 1];
+        if (s->status < TIMED_OUT)
+            s->status = (conn->status == TIMED_OUT ? TIMED_OUT : DEAD);
+        stream_free(conn, s);
+    }
+    free(h2->in);
+    free(h2);
+    conn->h2 = NULL;
+}
@@ -29,12 +29,16 @@
 #endif
 
 /*
- * There are two hash tables used, each with a key/value pair
- * stored in a hash_struct.  They are:
+ * magic 32 bit FNV1a hash constants, also used by mime_hash
  *
- * mime_hashtable:
- *     key = file extension
- *   value = mime type
+ * See: http://www.isthe.com/chongo/tech/comp/fnv/index.html
+ */
+#define OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+
+/*
+ * The mime types have their own table, see build_mime_table.
+ * passwd_hashtable stores key/value pairs in hash_structs:
  *
  * passwd_hashtable:
  *     key = username
@@ -50,9 +54,30 @@ struct _hash_struct_ {
 
 typedef struct _hash_struct_ hash_struct;
 
-static hash_struct *mime_hashtable[MIME_HASHTABLE_SIZE];
 static hash_struct *passwd_hashtable[PASSWD_HASHTABLE_SIZE];
-void add_mime_type(const char *extension, const char *type);
+
+/*
+ * The mime types are collected in mime_list while the configuration
+ * is read.  build_mime_table then puts them into an open addressing
+ * table with at least twice as many slots as there are extensions,
+ * so a lookup is one or two probes however big mime.types is, and
+ * writes out each type's Content-Type header line once and for all.
+ */
+
+struct mime_type {
+    char *extension;
+    unsigned int ext_len;
+    char *type;
+    char *header;               /* "Content-Type: type[; charset=...]" CRLF */
+    unsigned int header_len;
+};
+
+static struct mime_type *mime_list;
+static unsigned int mime_count, mime_alloc;
+static struct mime_type **mime_table;
+static unsigned int mime_mask;  /* table size - 1 */
+static struct mime_type default_mime;
+
 static unsigned get_homedir_hash_value(const char *name);
 
 #ifdef WANT_ICKY_HASH
@@ -148,13 +173,6 @@ static unsigned djb2_hash(const char *str)
     return hash;
 }
 #else
-/*
- * magic 32 bit FNV1a hash constants
- *
- * See: http://www.isthe.com/chongo/tech/comp/fnv/index.html
- */
-#define OFFSET_BASIS 2166136261U
-#define FNV_PRIME 16777619U
 /*
  *
  * hash.c:152: warning: width of integer constant may change on other systems with -traditional
@@ -323,26 +341,10 @@ void hash_show_stats(void)
     int total = 0;
     int count;
 
-    for (i = 0; i < MIME_HASHTABLE_SIZE; ++i) { /* these limits OK? */
-        if (mime_hashtable[i]) {
-            count = 0;
-            temp = mime_hashtable[i];
-            while (temp) {
-                temp = temp->next;
-                ++count;
-            }
-#ifdef NOISY_SIGALRM
-            log_error_time();
-            fprintf(stderr, "mime_hashtable[%d] has %d entries\n",
-                    i, count);
-#endif
-            total += count;
-        }
-    }
     log_error_time();
-    fprintf(stderr, "mime_hashtable has %d total entries\n", total);
+    fprintf(stderr, "mime table has %u entries in %u slots\n",
+            mime_count, (mime_table ? mime_mask + 1 : 0));
 
-    total = 0;
     for (i = 0; i < PASSWD_HASHTABLE_SIZE; ++i) { /* these limits OK? */
         if (passwd_hashtable[i]) {
             temp = passwd_hashtable[i];
@@ -372,75 +374,180 @@ void hash_show_stats(void)
 /*******************************************************************/
 /*******************************************************************/
 
+static unsigned mime_hash(const char *extension, unsigned int len)
+{
+    unsigned int hash = OFFSET_BASIS;
+
+    while (len--) {
+        hash ^= (unsigned char) *extension++;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
 /*
  * Name: add_mime_type
- * Description: Adds a key/value pair to the mime_hashtable
+ * Description: Adds an extension/type pair to the mime_list
  */
 
 void add_mime_type(const char *extension, const char *type)
 {
-    unsigned int hash;
+    struct mime_type *m;
 
-    hash = get_mime_hash_value(extension);
-    if (hash_insert(mime_hashtable, hash, extension, type) == NULL)
-	DIE("Failed to hash_insert mime type.");
+    if (extension == NULL || extension[0] == '\0' ||
+        type == NULL || type[0] == '\0') {
+        log_error_time();
+        fprintf(stderr, "Attempt to add an empty mime type! "
+                "[add_mime_type]!\n");
+        return;
+    }
+
+    if (mime_count == mime_alloc) {
+        mime_alloc = (mime_alloc ? mime_alloc * 2 : 64);
+        m = (struct mime_type *) realloc(mime_list,
+                                         mime_alloc * sizeof (*m));
+        if (m == NULL)
+            DIE("Failed to grow the mime type list.");
+        mime_list = m;
+    }
+
+    m = &mime_list[mime_count];
+    m->extension = strdup(extension);
+    m->type = strdup(type);
+    if (m->extension == NULL || m->type == NULL)
+        DIE("Failed to strdup mime type.");
+    m->ext_len = strlen(extension);
+    m->header = NULL;
+    ++mime_count;
 }
 
 /*
- * Name: get_mime_hash_value
- *
- * Description: adds the ASCII values of the file extension letters
- * and mods by the hashtable size to get the hash value
+ * Name: make_content_type
+ * Description: Fills in the Content-Type header line for m->type
  */
 
-unsigned get_mime_hash_value(const char *extension)
+static void make_content_type(struct mime_type *m)
 {
-    return boa_hash(extension) % MIME_HASHTABLE_SIZE;
+    int charset = (default_charset != NULL &&
+                   strncasecmp(m->type, "text", 4) == 0);
+
+    m->header = strconcat("Content-Type: ", m->type,
+                          (charset ? "; charset=" : ""),
+                          (charset ? default_charset : ""), CRLF, NULL);
+    if (m->header == NULL)
+        DIE("Failed to build Content-Type header.");
+    m->header_len = strlen(m->header);
 }
 
 /*
- * Name: get_mime_type
- *
- * Description: Returns the mime type for a supplied filename.
- * Returns default type if not found.
+ * Name: build_mime_table
+ * Description: Sizes the lookup table to the number of mime types read,
+ * and fills it.  An extension listed twice keeps its first type.
  */
 
-char *get_mime_type(const char *filename)
+void build_mime_table(void)
 {
-    char *extension;
-    hash_struct *current;
+    unsigned int i, size, slot;
+    struct mime_type *m;
+
+    size = 16;
+    while (size < mime_count * 2)
+        size *= 2;
+    mime_table = (struct mime_type **) calloc(size, sizeof (*mime_table));
+    if (mime_table == NULL)
+        DIE("Failed to allocate the mime type table.");
+    mime_mask = size - 1;
+
+    for (i = 0; i < mime_count; ++i) {
+        m = &mime_list[i];
+        slot = mime_hash(m->extension, m->ext_len) & mime_mask;
+        while (mime_table[slot] && strcmp(mime_table[slot]->extension,
+                                          m->extension))
+            slot = (slot + 1) & mime_mask;
+        if (mime_table[slot])
+            continue;           /* don't add extension twice */
+        make_content_type(m);
+        mime_table[slot] = m;
+    }
 
-    unsigned int hash;
+    default_mime.type = default_type;
+    make_content_type(&default_mime);
+}
+
+/*
+ * Name: find_mime_type
+ *
+ * Description: Returns the mime_type for a supplied filename, going by
+ * what follows the last '.' of its last path component.
+ * Returns default_mime if not found.
+ */
+
+static const struct mime_type *find_mime_type(const char *filename)
+{
+    const char *end, *extension;
+    unsigned int len, slot;
+    struct mime_type *m;
 
     if (filename == NULL) {
         log_error_time();
         fprintf(stderr,
                 "Attempt to hash NULL string! [get_mime_type]\n");
-        return default_type;
+        return &default_mime;
     } else if (filename[0] == '\0') {
         log_error_time();
         fprintf(stderr,
                 "Attempt to hash empty string! [get_mime_type]\n");
-        return default_type;
+        return &default_mime;
     }
 
-    extension = strrchr(filename, '.');
+    end = filename + strlen(filename);
+    for (extension = end; extension > filename; --extension) {
+        if (extension[-1] == '.' || extension[-1] == '/')
+            break;
+    }
 
-    /* remember, extension points to the *last* '.' in the filename,
-     * which may be NULL or look like:
-     *  foo.bar
-     *  foo. (in which case extension[1] == '\0')
-     */
-    /* extension[0] *can't* be NIL */
-    if (!extension || extension[1] == '\0')
-        return default_type;
+    /* no '.' at all, "foo/bar", or "foo." */
+    if (extension == filename || extension[-1] != '.' || extension == end)
+        return &default_mime;
 
-    /* make sure we hash on the 'bar' not the '.bar' */
-    ++extension;
+    if (mime_table == NULL)
+        return &default_mime;
 
-    hash = get_mime_hash_value(extension);
-    current = hash_find(mime_hashtable, extension, hash);
-    return (current ? current->value : default_type);
+    len = end - extension;
+    slot = mime_hash(extension, len) & mime_mask;
+    while ((m = mime_table[slot]) != NULL) {
+        if (m->ext_len == len && !memcmp(m->extension, extension, len))
+            return m;
+        slot = (slot + 1) & mime_mask;
+    }
+    return &default_mime;
+}
+
+/*
+ * Name: get_mime_type
+ *
+ * Description: Returns the mime type for a supplied filename.
+ * Returns default type if not found.
+ */
+
+char *get_mime_type(const char *filename)
+{
+    return find_mime_type(filename)->type;
+}
+
+/*
+ * Name: get_content_type
+ *
+ * Description: Returns the whole Content-Type header line (CRLF
+ * included) for a supplied filename, and its length in *len.
+ */
+
+const char *get_content_type(const char *filename, unsigned int *len)
+{
+    const struct mime_type *m = find_mime_type(filename);
+
+    *len = m->header_len;
+    return m->header;
 }
 
 /*
@@ -492,7 +599,22 @@ char *get_home_dir(const char *name)
 
 void dump_mime(void)
 {
-    hash_clear(mime_hashtable, MIME_HASHTABLE_SIZE);
+    unsigned int i;
+
+    for (i = 0; i < mime_count; ++i) {
+        free(mime_list[i].extension);
+        free(mime_list[i].type);
+        if (mime_list[i].header)
+            free(mime_list[i].header);
+    }
+    free(mime_list);
+    free(mime_table);
+    if (default_mime.header)
+        free(default_mime.header);
+    mime_list = NULL;
+    mime_table = NULL;
+    mime_count = mime_alloc = mime_mask = 0;
+    default_mime.header = NULL;
 }
 
 void dump_passwd(void)
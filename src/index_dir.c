@@ -33,9 +33,6 @@
 #define MAX_FILE_LENGTH                         MAXNAMLEN
 #define MAX_PATH_LENGTH                         PATH_MAX
 
-#define INT_TO_HEX(x) \
-  ((((x)-10)>=0)?('A'+((x)-10)):('0'+(x)))
-
 #include "escape.h"
 
 char *html_escape_string(const char *inp, char *dest,
@@ -53,54 +50,14 @@ void send_error(int error);
 char *html_escape_string(const char *inp, char *dest,
                          const unsigned int len)
 {
-    int max;
-    char *buf;
-    unsigned char c;
-
-    max = len * 6;
-
-    if (dest == NULL && max)
-        dest = malloc(sizeof (unsigned char) * (max + 1));
+    if (dest == NULL && len)
+        dest = malloc(len * escape_expansion[ESCAPE_HTML] + 1);
 
     if (dest == NULL)
         return NULL;
 
-    buf = dest;
-    while ((c = *inp++)) {
-        switch (c) {
-        case '>':
-            *dest++ = '&';
-            *dest++ = 'g';
-            *dest++ = 't';
-            *dest++ = ';';
-            break;
-        case '<':
-            *dest++ = '&';
-            *dest++ = 'l';
-            *dest++ = 't';
-            *dest++ = ';';
-            break;
-        case '&':
-            *dest++ = '&';
-            *dest++ = 'a';
-            *dest++ = 'm';
-            *dest++ = 'p';
-            *dest++ = ';';
-            break;
-        case '\"':
-            *dest++ = '&';
-            *dest++ = 'q';
-            *dest++ = 'u';
-            *dest++ = 'o';
-            *dest++ = 't';
-            *dest++ = ';';
-            break;
-        default:
-            *dest++ = c;
-        }
-    }
-    *dest = '\0';
-    return buf;
+    escape_into(dest, inp, len, ESCAPE_HTML);
+    return dest;
 }
 
 
@@ -111,44 +68,30 @@ char *html_escape_string(const char *inp, char *dest,
  *  NULL when the program starts, it will attempt to dynamically allocate
  *  the space that it needs, otherwise it will assume that the user
  *  has already allocated enough space for the variable buf, which
- *  could be up to 3 times the size of inp.  If the routine dynamically
- *  allocates the space, the user is responsible for freeing it afterwords
+ *  could be up to 3 times the size of inp, plus 2.  If the routine
+ *  dynamically allocates the space, the user is responsible for freeing
+ *  it afterwords.  A name with a ':' in it (past the first character)
+ *  gets a "./" in front, so it isn't taken for a URL scheme.
  * Returns: NULL on error, pointer to string otherwise.
  */
 
 char *http_escape_string(const char *inp, char *buf,
                          const unsigned int len)
 {
-    int max;
-    char *index_c;
-    unsigned char c;
-    int found_a_colon = 0;
-
-    max = len * 3;
+    char *dest;
 
-    if (buf == NULL && max)
-        buf = malloc(sizeof (unsigned char) * (max + 1));
+    if (buf == NULL && len)
+        buf = malloc(len * escape_expansion[ESCAPE_PATH] + 3);
 
     if (buf == NULL)
         return NULL;
 
-    index_c = buf;
-    while ((c = *inp++)) {
-        if (c == ':' && !found_a_colon && index_c > buf) {
-            found_a_colon = 1;
-            memmove(buf + 2, buf, (index_c - buf));
-            *buf = '.';
-            *(buf + 1) = '/';
-            index_c += 2;
-            *index_c++ = ':';
-        } else if (needs_escape((unsigned int) c) || c == '?') {
-            *index_c++ = '%';
-            *index_c++ = INT_TO_HEX((c >> 4) & 0xf);
-            *index_c++ = INT_TO_HEX(c & 0xf);
-        } else
-            *index_c++ = c;
+    dest = buf;
+    if (len > 1 && memchr(inp + 1, ':', len - 1)) {
+        *dest++ = '.';
+        *dest++ = '/';
     }
-    *index_c = '\0';
+    escape_into(dest, inp, len, ESCAPE_PATH);
 
     return buf;
 }
@@ -207,9 +150,9 @@ int index_directory(char *dir, char *title)
     int numdir;
     struct dirent **array;
     struct stat statbuf;
-    char http_filename[MAX_FILE_LENGTH * 3];
-    char html_filename[MAX_FILE_LENGTH * 6];
-    char escaped_filename[MAX_FILE_LENGTH * 18]; /* *both* http and html escape */
+    char http_filename[MAX_FILE_LENGTH * 3 + 3];
+    char html_filename[MAX_FILE_LENGTH * 6 + 1];
+    char escaped_filename[MAX_FILE_LENGTH * 18 + 19]; /* *both* http and html escape */
     int i;
 
     if (chdir(dir) == -1) {
@@ -369,7 +312,7 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    build_needs_escape();
+    build_escape_table();
 
     if (argv[2] == NULL)
         index_directory(argv[1], argv[1]);
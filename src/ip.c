@@ -44,7 +44,7 @@ globals.h:
     */
 
 #include "boa.h"
-#include <arpa/inet.h>          /* inet_ntoa */
+#include <arpa/inet.h>          /* inet_ntoa, inet_pton */
 
 /* Binds to the existing server_s, based on the configuration string
    in server_ip.  IPv6 version doesn't pay attention to server_ip yet.  */
@@ -137,3 +137,240 @@ int net_port(struct SOCKADDR *s)
 #endif
     return p;
 }
+
+/*
+ * AllowIP / DenyIP
+ *
+ * The rules are kept in a path-compressed binary trie over 128 bit
+ * keys; IPv4 addresses and prefixes are stored as IPv4-mapped IPv6
+ * (::ffff:a.b.c.d), which is also how an INET6 build sees IPv4
+ * clients.  The most specific (longest) matching prefix decides, and
+ * an address no rule covers is allowed.
+ */
+
+struct ip_rule {
+    char *text;                 /* as given in boa.conf */
+    int allow;
+    unsigned long hits;
+};
+
+struct ip_node {
+    unsigned char key[16];
+    unsigned int bits;          /* prefix length of key */
+    int rule;                   /* index into ip_rules, or -1 */
+    struct ip_node *child[2];
+};
+
+static struct ip_rule *ip_rules;
+static int n_ip_rules;
+static struct ip_node *ip_trie;
+
+#define KEY_BIT(key, n) (((key)[(n) >> 3] >> (7 - ((n) & 7))) & 1)
+
+/* number of leading bits a and b have in common, at most max */
+static unsigned int common_bits(const unsigned char *a,
+                                const unsigned char *b, unsigned int max)
+{
+    unsigned int n = 0;
+
+    while (n < max && a[n >> 3] == b[n >> 3] && n + 8 <= max)
+        n += 8;
+    while (n < max && KEY_BIT(a, n) == KEY_BIT(b, n))
+        n++;
+    return n;
+}
+
+static struct ip_node *new_ip_node(const unsigned char *key,
+                                   unsigned int bits, int rule)
+{
+    struct ip_node *node = calloc(1, sizeof (struct ip_node));
+
+    if (!node) {
+        DIE("out of memory adding IP rule");
+    }
+    memcpy(node->key, key, sizeof (node->key));
+    node->bits = bits;
+    node->rule = rule;
+    return node;
+}
+
+static void ip_trie_insert(struct ip_node **slot, const unsigned char *key,
+                           unsigned int bits, int rule)
+{
+    struct ip_node *node, *glue;
+    unsigned int common;
+
+    while ((node = *slot) != NULL) {
+        common = common_bits(key, node->key,
+                             (bits < node->bits ? bits : node->bits));
+        if (common == node->bits) {
+            if (common == bits) {
+                if (node->rule == -1)
+                    node->rule = rule; /* otherwise the first one wins */
+                return;
+            }
+            slot = &node->child[KEY_BIT(key, common)];
+            continue;
+        }
+        /* key leaves node's prefix at bit 'common' */
+        glue = new_ip_node(key, common, -1);
+        glue->child[KEY_BIT(node->key, common)] = node;
+        *slot = glue;
+        if (common == bits) {
+            glue->rule = rule;
+            return;
+        }
+        slot = &glue->child[KEY_BIT(key, common)];
+    }
+    *slot = new_ip_node(key, bits, rule);
+}
+
+static void free_ip_trie(struct ip_node *node)
+{
+    if (node) {
+        free_ip_trie(node->child[0]);
+        free_ip_trie(node->child[1]);
+        free(node);
+    }
+}
+
+/*
+ * Name: ip_acl_add
+ * Description: Adds an AllowIP (allow = 1) or DenyIP rule for
+ * "address[/prefix length]", IPv4 or IPv6.
+ * Returns 0 if the rule can't be parsed.
+ */
+
+int ip_acl_add(const char *cidr, int allow)
+{
+    unsigned char key[16];
+    char addr[BOA_NI_MAXHOST > 64 ? BOA_NI_MAXHOST : 64];
+    const char *slash;
+    unsigned int bits, max, offset;
+    char *end;
+    struct ip_rule *rules;
+
+    slash = strchr(cidr, '/');
+    if (slash == NULL)
+        slash = cidr + strlen(cidr);
+    if ((size_t) (slash - cidr) >= sizeof (addr))
+        return 0;
+    memcpy(addr, cidr, slash - cidr);
+    addr[slash - cidr] = '\0';
+
+    memset(key, 0, sizeof (key));
+    if (inet_pton(AF_INET, addr, key + 12) == 1) {
+        key[10] = key[11] = 0xff;
+        max = 32;
+        offset = 96;
+    } else if (inet_pton(AF_INET6, addr, key) == 1) {
+        max = 128;
+        offset = 0;
+    } else {
+        return 0;
+    }
+
+    bits = max;
+    if (*slash == '/') {
+        errno = 0;
+        bits = strtoul(slash + 1, &end, 10);
+        if (errno || end == slash + 1 || *end != '\0' || bits > max)
+            return 0;
+    }
+    bits += offset;
+
+    rules = realloc(ip_rules, (n_ip_rules + 1) * sizeof (struct ip_rule));
+    if (!rules) {
+        DIE("out of memory adding IP rule");
+    }
+    ip_rules = rules;
+    ip_rules[n_ip_rules].text = strdup(cidr);
+    if (!ip_rules[n_ip_rules].text) {
+        DIE("out of memory adding IP rule");
+    }
+    ip_rules[n_ip_rules].allow = allow;
+    ip_rules[n_ip_rules].hits = 0;
+
+    ip_trie_insert(&ip_trie, key, bits, n_ip_rules);
+    ++n_ip_rules;
+    return 1;
+}
+
+/*
+ * Name: ip_acl_clear
+ * Description: Forgets all AllowIP/DenyIP rules, before a reload.
+ */
+
+void ip_acl_clear(void)
+{
+    int i;
+
+    free_ip_trie(ip_trie);
+    ip_trie = NULL;
+    for (i = 0; i < n_ip_rules; ++i)
+        free(ip_rules[i].text);
+    free(ip_rules);
+    ip_rules = NULL;
+    n_ip_rules = 0;
+}
+
+/*
+ * Name: ip_acl_allow
+ * Description: Returns 0 if a DenyIP rule is the most specific one for
+ * the client address s, 1 otherwise.  Works on the raw address that
+ * accept() returned, so nothing has been allocated for the connection
+ * yet.
+ */
+
+int ip_acl_allow(struct SOCKADDR *s)
+{
+    unsigned char key[16];
+    struct ip_node *node;
+    int rule = -1;
+
+    if (ip_trie == NULL)
+        return 1;
+
+    memset(key, 0, sizeof (key));
+    if (((struct sockaddr *) s)->sa_family == AF_INET) {
+        key[10] = key[11] = 0xff;
+        memcpy(key + 12, &((struct sockaddr_in *) s)->sin_addr, 4);
+#ifdef INET6
+    } else if (((struct sockaddr *) s)->sa_family == AF_INET6) {
+        memcpy(key, &((struct sockaddr_in6 *) s)->sin6_addr, 16);
+#endif
+    } else {
+        return 1;
+    }
+
+    for (node = ip_trie; node; node = node->child[KEY_BIT(key, node->bits)]) {
+        if (common_bits(key, node->key, node->bits) != node->bits)
+            break;
+        if (node->rule != -1)
+            rule = node->rule;
+        if (node->bits == 128)
+            break;
+    }
+
+    if (rule == -1)
+        return 1;
+    ip_rules[rule].hits++;
+    return ip_rules[rule].allow;
+}
+
+/*
+ * Name: ip_acl_show_stats
+ * Description: Logs how often each AllowIP/DenyIP rule has decided.
+ */
+
+void ip_acl_show_stats(void)
+{
+    int i;
+
+    for (i = 0; i < n_ip_rules; ++i) {
+        log_error_time();
+        fprintf(stderr, "%sIP %s: %lu hits\n",
+                (ip_rules[i].allow ? "Allow" : "Deny"),
+                ip_rules[i].text, ip_rules[i].hits);
+    }
+}
@@ -30,6 +30,7 @@ int cgi_log_fd;
  * Name: open_logs
  *
  * Description: Opens access log, error log, and if specified, CGI log
+ * and slow request log
  * Ties stderr to error log, except during CGI execution, at which
  * time CGI log is the stderr for CGIs.
  *
@@ -95,6 +96,7 @@ void open_logs(void)
             }
         }
     }
+    open_slow_log();
 #ifdef SETVBUF_REVERSED
     setvbuf(stderr, _IONBF, (char *) NULL, 0);
     setvbuf(stdout, _IOLBF, (char *) NULL, 0);
@@ -105,35 +107,268 @@ void open_logs(void)
 }
 
 
-/* Print the remote IP to the stream FP.  */
-static void
-print_remote_ip (request * req, FILE *fp)
+/* Put the remote IP into BUF (at most LEN bytes, no NUL) and return
+   its length.  */
+unsigned int
+format_remote_ip (request * req, char *buf, unsigned int len)
 {
+    unsigned int n = 0;
+
     if (log_forwarded_for) {
-        const char *s = req->header_forwarded_for;
+        const char *s = req_header(req, H_X_FORWARDED_FOR);
         if (s && *s) {
-            for (; *s; s++) {
+            for (; *s && n < len; s++) {
               /* Take extra care not to write bogus characters.  In
                  particular no spaces.  We know that only IP addresses
                  and a comma are allowed in the XFF header.  */
                 if (strchr ("0123456789.abcdef:ABCDEF,", *s))
-                  putc (*s, fp);
+                  buf[n++] = *s;
                 else
-                  putc ('_', fp);
+                  buf[n++] = '_';
             }
+            return n;
         }
-        else /* Missing - print remote IP in parenthesis.  */
-          fprintf (fp, "(%s)", req->remote_ip_addr);
-      }
+        /* Missing - print remote IP in parenthesis.  */
+        n = snprintf (buf, len, "(%s)", req->remote_ip_addr);
+    }
     else
-      fputs (req->remote_ip_addr, fp);
+      n = snprintf (buf, len, "%s", req->remote_ip_addr);
+    return (n < len ? n : len);
+}
+
+
+/*
+ * LogFormat
+ *
+ * The format is compiled once, when the config is read, into a list
+ * of log_ops, and log_access just runs down the list appending to one
+ * buffer.  Directives:
+ *
+ *  %h  remote address (or X-Forwarded-For, with LogXFF)
+ *  %A  local address         %v  virtual host (Host, or local address)
+ *  %t  [time]                %r  request line
+ *  %m  method                %U  path              %q  query string
+ *  %H  protocol              %s  status
+ *  %b  body bytes sent       %I  request bytes read
+ *  %D  time taken, in us     %F  time to the first response byte, in us
+ *  %k  keepalive requests before this one on the connection
+ *  %C  mmap cache: hit, miss or -
+ *  %{Name}i  request header  %%  a '%'
+ *
+ * Anything else is copied as is.  Times come from current_usec, the
+ * main loop's clock.
+ */
+
+enum LOG_OP { LOG_TEXT, LOG_REMOTE_IP, LOG_LOCAL_IP, LOG_VHOST, LOG_TIME,
+    LOG_REQUEST_LINE, LOG_METHOD, LOG_PATH, LOG_QUERY, LOG_PROTOCOL,
+    LOG_STATUS, LOG_BYTES_SENT, LOG_BYTES_IN, LOG_DURATION, LOG_TTFB,
+    LOG_KEEPALIVE, LOG_CACHE, LOG_HEADER
+};
+
+struct log_op {
+    enum LOG_OP op;
+    char *text;                 /* LOG_TEXT, or the name for LOG_HEADER */
+    unsigned int len;
+};
+
+static struct log_op *log_ops;
+static int n_log_ops;
+
+/* the commonlog time, redone when current_time moves on */
+static time_t log_time_at;
+static char log_time[32];
+static unsigned int log_time_len;
+
+static const struct {
+    char c;
+    enum LOG_OP op;
+} log_directives[] = {
+    {'h', LOG_REMOTE_IP}, {'A', LOG_LOCAL_IP}, {'v', LOG_VHOST},
+    {'t', LOG_TIME}, {'r', LOG_REQUEST_LINE}, {'m', LOG_METHOD},
+    {'U', LOG_PATH}, {'q', LOG_QUERY}, {'H', LOG_PROTOCOL},
+    {'s', LOG_STATUS}, {'b', LOG_BYTES_SENT}, {'I', LOG_BYTES_IN},
+    {'D', LOG_DURATION}, {'F', LOG_TTFB}, {'k', LOG_KEEPALIVE},
+    {'C', LOG_CACHE},
+};
+
+static void add_log_op(enum LOG_OP op, const char *text, unsigned int len)
+{
+    struct log_op *ops;
+
+    /* runs of text that meet (around a "%%") are merged */
+    if (op == LOG_TEXT && n_log_ops && log_ops[n_log_ops - 1].op == LOG_TEXT) {
+        struct log_op *last = &log_ops[n_log_ops - 1];
+
+        last->text = realloc(last->text, last->len + len);
+        if (!last->text) {
+            DIE("out of memory compiling LogFormat");
+        }
+        memcpy(last->text + last->len, text, len);
+        last->len += len;
+        return;
+    }
+
+    ops = realloc(log_ops, (n_log_ops + 1) * sizeof (struct log_op));
+    if (!ops) {
+        DIE("out of memory compiling LogFormat");
+    }
+    log_ops = ops;
+    log_ops[n_log_ops].op = op;
+    log_ops[n_log_ops].len = len;
+    log_ops[n_log_ops].text = NULL;
+    if (len) {
+        log_ops[n_log_ops].text = malloc(len);
+        if (!log_ops[n_log_ops].text) {
+            DIE("out of memory compiling LogFormat");
+        }
+        memcpy(log_ops[n_log_ops].text, text, len);
+    }
+    ++n_log_ops;
+}
+
+/*
+ * Name: compile_log_format
+ *
+ * Description: Turns LogFormat (or, without one, the traditional Boa
+ * format) into log_ops.  Called at the end of read_config_files; exits
+ * on a bad format, like the other config checks.
+ */
+
+void compile_log_format(void)
+{
+    const char *format, *p, *end;
+    unsigned int i;
+
+    for (i = 0; i < (unsigned) n_log_ops; ++i)
+        free(log_ops[i].text);
+    free(log_ops);
+    log_ops = NULL;
+    n_log_ops = 0;
+    log_time_at = 0;
+
+    format = log_format;
+    if (!format) {
+        if (virtualhost)
+            format = "%A " DEFAULT_LOG_FORMAT;
+        else if (vhost_root)
+            format = "%v " DEFAULT_LOG_FORMAT;
+        else
+            format = DEFAULT_LOG_FORMAT;
+    }
+
+    for (p = format; *p;) {
+        if (*p != '%') {
+            end = strchr(p, '%');
+            if (!end)
+                end = p + strlen(p);
+            add_log_op(LOG_TEXT, p, end - p);
+            p = end;
+            continue;
+        }
+        ++p;
+        if (*p == '%') {
+            add_log_op(LOG_TEXT, p++, 1);
+            continue;
+        }
+        if (*p == '{') {
+            end = strchr(p, '}');
+            if (!end || end == p + 1 || end[1] != 'i') {
+                fprintf(stderr, "Invalid LogFormat: \"%s\" "
+                        "(expected %%{Header-Name}i)\n", format);
+                exit(EXIT_FAILURE);
+            }
+            add_log_op(LOG_HEADER, p + 1, end - p - 1);
+            p = end + 2;
+            continue;
+        }
+        for (i = 0; i < sizeof (log_directives) / sizeof (log_directives[0]);
+             ++i) {
+            if (log_directives[i].c == *p)
+                break;
+        }
+        if (i == sizeof (log_directives) / sizeof (log_directives[0])) {
+            fprintf(stderr, "Invalid LogFormat: \"%s\" (unknown %%%c)\n",
+                    format, (*p ? *p : ' '));
+            exit(EXIT_FAILURE);
+        }
+        add_log_op(log_directives[i].op, NULL, 0);
+        ++p;
+    }
+    /* the record always ends with a newline */
+    add_log_op(LOG_TEXT, "\n", 1);
+}
+
+static char *log_string(char *at, char *end, const char *s, unsigned int len)
+{
+    if (len > (unsigned) (end - at))
+        len = end - at;
+    memcpy(at, s, len);
+    return at + len;
 }
 
+static char *log_number(char *at, char *end, uint64_t n)
+{
+    char digits[21], *p = digits + sizeof (digits);
+
+    do {
+        *--p = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    return log_string(at, end, p, digits + sizeof (digits) - p);
+}
+
+/* a piece of the request line, as the client sent it */
+static const char *logline_part(const char *line, enum LOG_OP part,
+                                unsigned int *len)
+{
+    const char *s, *e;
+
+    if (!line)
+        return NULL;
+    s = line;
+    e = strchr(s, ' ');
+    if (part == LOG_METHOD) {
+        *len = (e ? (unsigned) (e - s) : strlen(s));
+        return s;
+    }
+    if (!e)
+        return NULL;
+    s = e + 1;
+    e = strchr(s, ' ');
+    if (part == LOG_PROTOCOL) {
+        if (!e)
+            return NULL;
+        *len = strlen(e + 1);
+        return e + 1;
+    }
+    if (!e)
+        e = s + strlen(s);
+    if (part == LOG_PATH) {
+        const char *q = memchr(s, '?', e - s);
+
+        *len = (q ? q : e) - s;
+        return s;
+    }
+    /* LOG_QUERY */
+    s = memchr(s, '?', e - s);
+    if (!s)
+        return NULL;
+    *len = e - s - 1;
+    return s + 1;
+}
+
+/* a NUL-terminated string, or "-" for none */
+static char *log_cstring(char *at, char *end, const char *s)
+{
+    if (!s)
+        return log_string(at, end, "-", 1);
+    return log_string(at, end, s, strlen(s));
+}
 
 /*
  * Name: log_access
  *
- * Description: Writes log data to access_log.
+ * Description: Writes log data to access_log, as LogFormat says.
  */
 
 /* NOTES on the commonlog format:
@@ -164,46 +399,113 @@ print_remote_ip (request * req, FILE *fp)
 
 void log_access(request * req)
 {
+    static char rec[MAX_LOG_RECORD];
+    /* one byte is kept back for the newline */
+    char *at = rec, *end = rec + sizeof (rec) - 1;
+    struct header_field *field;
+    const struct log_op *op;
+    const char *s;
+    unsigned int len;
+
     if (!access_log_name)
         return;
+    if (access_log_binary) {
+        binlog_access(req);
+        return;
+    }
 
-    if (virtualhost) {
-        printf("%s ", req->local_ip_addr);
-    } else if (vhost_root) {
-        printf("%s ", (req->host ? req->host : "(null)"));
+    for (op = log_ops; op < log_ops + n_log_ops; ++op) {
+        switch (op->op) {
+        case LOG_TEXT:
+            at = log_string(at, end, op->text, op->len);
+            break;
+        case LOG_REMOTE_IP:
+            at += format_remote_ip(req, at, end - at);
+            break;
+        case LOG_LOCAL_IP:
+            at = log_cstring(at, end, req->local_ip_addr);
+            break;
+        case LOG_VHOST:
+            at = log_cstring(at, end, (req->host ? req->host :
+                                       req->local_ip_addr));
+            break;
+        case LOG_TIME:
+            if (log_time_at != current_time) {
+                /* "[27/Feb/1998:20:20:04 +0000] ", minus the blank */
+                s = get_commonlog_time();
+                log_time_len = strlen(s) - 1;
+                memcpy(log_time, s, log_time_len);
+                log_time_at = current_time;
+            }
+            at = log_string(at, end, log_time, log_time_len);
+            break;
+        case LOG_REQUEST_LINE:
+            at = log_cstring(at, end, req->logline);
+            break;
+        case LOG_METHOD:
+        case LOG_PATH:
+        case LOG_QUERY:
+        case LOG_PROTOCOL:
+            s = logline_part(req->logline, op->op, &len);
+            at = (s ? log_string(at, end, s, len) :
+                  log_string(at, end, "-", 1));
+            break;
+        case LOG_STATUS:
+            at = log_number(at, end, req->response_status);
+            break;
+        case LOG_BYTES_SENT:
+            at = log_number(at, end, req->bytes_written);
+            break;
+        case LOG_BYTES_IN:
+            at = log_number(at, end, (req->bytes_in ? req->bytes_in :
+                                      req->client_stream_pos));
+            break;
+        case LOG_DURATION:
+            if (req->time_start)
+                at = log_number(at, end, current_usec - req->time_start);
+            else
+                at = log_string(at, end, "-", 1);
+            break;
+        case LOG_TTFB:
+            if (req->time_start && req->time_first_byte)
+                at = log_number(at, end,
+                                req->time_first_byte - req->time_start);
+            else
+                at = log_string(at, end, "-", 1);
+            break;
+        case LOG_KEEPALIVE:
+            at = log_number(at, end, ka_max - req->kacount);
+            break;
+        case LOG_CACHE:
+            at = log_cstring(at, end, (req->cache_result == CACHE_HIT ? "hit" :
+                                       req->cache_result == CACHE_MISS ?
+                                       "miss" : NULL));
+            break;
+        case LOG_HEADER:
+            field = find_header(req, op->text, op->len);
+            at = log_cstring(at, end, (field ? header_value(req, field) :
+                                       NULL));
+            break;
+        }
     }
-    print_remote_ip (req, stdout);
-    printf(" - - %s\"%s\" %d %zu \"%s\" \"%s\"\n",
-           get_commonlog_time(),
-           req->logline ? req->logline : "-",
-           req->response_status,
-           req->bytes_written,
-           (req->header_referer ? req->header_referer : "-"),
-           (req->header_user_agent ? req->header_user_agent : "-"));
+    if (at == end)
+        *at++ = '\n';           /* truncated, but still one line */
+
+    if (!logring_write(rec, at - rec))
+        fwrite(rec, 1, at - rec, stdout);
 }
 
 static char *escape_pathname(const char *inp)
 {
-    const unsigned char *s;
-    char *escaped, *d;
+    char *escaped;
 
     if (!inp) {
         return NULL;
     }
-    escaped = malloc (4 * strlen(inp) + 1);
+    escaped = escape_alloc(inp, ESCAPE_LOG);
     if (!escaped) {
-    	perror("malloc");
-	return NULL;
+        perror("malloc");
     }
-    for (d = escaped, s = (const unsigned char *)inp; *s; s++) {
-        if (needs_escape (*s)) {
-            snprintf (d, 5, "\\x%02x", *s);
-            d += strlen (d);
-        } else {
-            *d++ = *s;
-        }
-    }
-    *d++ = '\0';
     return escaped;
 }
 
@@ -223,31 +525,51 @@ static char *escape_pathname(const char *inp)
 
 void log_error_doc(request * req)
 {
+    char buf[MAX_LOG_RECORD];
     int errno_save = errno;
-    char *escaped_pathname;
+
+    fwrite(buf, 1, format_error_doc(req, buf, sizeof (buf)), stderr);
+    errno = errno_save;
+}
+
+/*
+ * Name: format_error_doc
+ *
+ * Description: What log_error_doc writes, put into buf (at most len
+ * bytes, no NUL).  Returns its length.
+ */
+
+unsigned int format_error_doc(request * req, char *buf, unsigned int len)
+{
+    char *escaped_pathname, *host = req_header(req, H_HOST);
+    unsigned int n = 0;
+    int r = 0;
 
     if (virtualhost) {
-        fprintf(stderr, "%s ", req->local_ip_addr);
+        r = snprintf(buf, len, "%s ", req->local_ip_addr);
     } else if (vhost_root) {
-        fprintf(stderr, "%s ", (req->host ? req->host : "(null)"));
+        r = snprintf(buf, len, "%s ", (req->host ? req->host : "(null)"));
     }
+    n = (r < 0 ? 0 : (unsigned) r < len ? (unsigned) r : len);
+    n += format_remote_ip(req, buf + n, len - n);
+
     escaped_pathname = escape_pathname(req->pathname);
-    print_remote_ip (req, stderr);
     if (vhost_root) {
-        fprintf(stderr, " - - %srequest [%s] \"%s\" (\"%s\"): ",
-                get_commonlog_time(),
-                (req->header_host ? req->header_host : "(null)"),
-                (req->logline ? req->logline : "(null)"),
-                (escaped_pathname ? escaped_pathname : "(null)"));
+        r = snprintf(buf + n, len - n, " - - %srequest [%s] \"%s\" (\"%s\"): ",
+                     get_commonlog_time(),
+                     (host ? host : "(null)"),
+                     (req->logline ? req->logline : "(null)"),
+                     (escaped_pathname ? escaped_pathname : "(null)"));
     } else {
-        fprintf(stderr, " - - %srequest \"%s\" (\"%s\"): ",
-                get_commonlog_time(),
-                (req->logline ? req->logline : "(null)"),
-                (escaped_pathname ? escaped_pathname : "(null)"));
+        r = snprintf(buf + n, len - n, " - - %srequest \"%s\" (\"%s\"): ",
+                     get_commonlog_time(),
+                     (req->logline ? req->logline : "(null)"),
+                     (escaped_pathname ? escaped_pathname : "(null)"));
     }
     free(escaped_pathname);
-
-    errno = errno_save;
+    if (r > 0)
+        n += ((unsigned) r < len - n ? (unsigned) r : len - n);
+    return n;
 }
 
 /*
@@ -310,6 +632,7 @@ void log_error_mesg(const char *file, int line, const char *func, const char *me
 void log_error_mesg_fatal(const char *file, int line, const char *func, const char *mesg)
 {
     int errno_save = errno;
+    errlog_flush();             /* what came before, first */
     fprintf(stderr, "%s%s:%d (%s) - ", get_commonlog_time(), file, line, func);
     errno = errno_save;
     perror(mesg);
@@ -330,6 +653,7 @@ void log_error_mesg(const char *file, int line, const char *mesg)
 void log_error_mesg_fatal(const char *file, int line, const char *mesg)
 {
     int errno_save = errno;
+    errlog_flush();             /* what came before, first */
     fprintf(stderr, "%s%s:%d - ", get_commonlog_time(), file, line);
     errno = errno_save;
     perror(mesg);
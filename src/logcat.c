@@ -0,0 +1,693 @@
+/*
+ *  Boa, an http server
+ *  Copyright (C) 1995 Paul Phillips <paulp@go2net.com>
+ *  Copyright (C) 1996-2005 Larry Doolittle <ldoolitt@boa.org>
+ *  Copyright (C) 1997-2004 Jon Nelson <jnelson@boa.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 1, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* $Id$ */
+
+/*
+ * boa_logcat: reads binary access logs (AccessLogBinary) and writes
+ * them out as common log format or JSON lines, optionally picking out
+ * some of the records, or counts them up by status, path, etc.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "binlog.h"
+
+struct str {
+    const char *s;              /* not NUL-terminated, NULL for none */
+    unsigned int len;
+};
+
+struct entry {
+    time_t time;
+    char address[64];
+    struct str forwarded;       /* the address, when it was text */
+    struct str vhost;
+    struct str request;
+    unsigned long status;
+    uint64_t sent, received;
+    uint64_t usec, ttfb;        /* + 1, 0 for not known */
+    unsigned long keepalive;
+    int cache;
+    struct str referer;
+    struct str agent;
+};
+
+/* what to print */
+static enum { OUT_CLF, OUT_JSON, OUT_AGGREGATE } output = OUT_CLF;
+
+/* which records */
+static long want_status = -1, want_status_class = -1;
+static const char *want_method, *want_prefix, *want_vhost;
+static uint64_t want_usec;
+
+/* -a */
+enum AGG_KEY { BY_STATUS, BY_PATH, BY_VHOST, BY_ADDRESS, BY_AGENT,
+    BY_REFERER
+};
+static enum AGG_KEY agg_key;
+
+struct agg {
+    char *key;
+    unsigned int len;
+    unsigned long count;
+    uint64_t bytes, usec_sum, usec_max;
+    unsigned long usec_count;
+};
+
+static struct agg *aggs;
+static unsigned long n_aggs, agg_size;
+
+static unsigned long records, bad_bytes;
+
+/* the dictionary of the current block */
+static struct str dict[BINLOG_DICT_ENTRIES];
+static unsigned int dict_entries;
+
+static const unsigned char *get_varint(const unsigned char *p,
+                                       const unsigned char *end,
+                                       uint64_t * v)
+{
+    unsigned int shift = 0;
+
+    *v = 0;
+    while (p < end && shift < 64) {
+        *v |= (uint64_t) (*p & 0x7f) << shift;
+        if (!(*p++ & 0x80))
+            return p;
+        shift += 7;
+    }
+    return NULL;
+}
+
+static const unsigned char *get_string(const unsigned char *p,
+                                       const unsigned char *end,
+                                       struct str *s)
+{
+    uint64_t len;
+
+    p = get_varint(p, end, &len);
+    if (!p || len > (uint64_t) (end - p))
+        return NULL;
+    s->s = (const char *) p;
+    s->len = len;
+    return p + len;
+}
+
+static const unsigned char *get_ref(const unsigned char *p,
+                                    const unsigned char *end,
+                                    struct str *s)
+{
+    uint64_t ref;
+
+    p = get_varint(p, end, &ref);
+    if (!p)
+        return NULL;
+    s->s = NULL;
+    s->len = 0;
+    if (ref == BINLOG_LITERAL)
+        return get_string(p, end, s);
+    if (ref >= BINLOG_DICT && ref - BINLOG_DICT < dict_entries)
+        *s = dict[ref - BINLOG_DICT];
+    return p;
+}
+
+/* the piece of the request line after n blanks */
+static struct str request_word(const struct str *req, int n)
+{
+    struct str w = { NULL, 0 };
+    const char *p, *end;
+
+    if (!req->s)
+        return w;
+    p = req->s;
+    end = req->s + req->len;
+    while (n-- > 0) {
+        p = memchr(p, ' ', end - p);
+        if (!p)
+            return w;
+        ++p;
+    }
+    w.s = p;
+    p = memchr(p, ' ', end - p);
+    w.len = (p ? p : end) - w.s;
+    return w;
+}
+
+static int wanted(const struct entry *e)
+{
+    struct str w;
+    unsigned int n;
+
+    if (want_status != -1 && (long) e->status != want_status)
+        return 0;
+    if (want_status_class != -1 &&
+        (long) e->status / 100 != want_status_class)
+        return 0;
+    if (want_usec && (e->usec == 0 || e->usec - 1 < want_usec))
+        return 0;
+    if (want_method) {
+        w = request_word(&e->request, 0);
+        n = strlen(want_method);
+        if (w.len != n || memcmp(w.s, want_method, n))
+            return 0;
+    }
+    if (want_prefix) {
+        w = request_word(&e->request, 1);
+        n = strlen(want_prefix);
+        if (w.len < n || memcmp(w.s, want_prefix, n))
+            return 0;
+    }
+    if (want_vhost) {
+        n = strlen(want_vhost);
+        if (!e->vhost.s || e->vhost.len != n ||
+            memcmp(e->vhost.s, want_vhost, n))
+            return 0;
+    }
+    return 1;
+}
+
+static void put_str(const struct str *s)
+{
+    if (s->s)
+        fwrite(s->s, 1, s->len, stdout);
+    else
+        putchar('-');
+}
+
+static const char *address(const struct entry *e, unsigned int *len)
+{
+    if (e->forwarded.s) {
+        *len = e->forwarded.len;
+        return e->forwarded.s;
+    }
+    *len = strlen(e->address);
+    return e->address;
+}
+
+static void print_clf(const struct entry *e)
+{
+    static time_t last;
+    static char when[40];
+    const char *a;
+    unsigned int len;
+
+    if (e->time != last || !when[0]) {
+        strftime(when, sizeof (when), "[%d/%b/%Y:%H:%M:%S +0000]",
+                 gmtime(&e->time));
+        last = e->time;
+    }
+    if (e->vhost.s) {
+        put_str(&e->vhost);
+        putchar(' ');
+    }
+    a = address(e, &len);
+    fwrite(a, 1, len, stdout);
+    printf(" - - %s \"", when);
+    put_str(&e->request);
+    printf("\" %lu %llu \"", e->status, (unsigned long long) e->sent);
+    put_str(&e->referer);
+    fputs("\" \"", stdout);
+    put_str(&e->agent);
+    fputs("\"\n", stdout);
+}
+
+static void put_json(const char *name, const char *s, unsigned int len)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned int i;
+    unsigned char c;
+
+    printf(",\"%s\":", name);
+    if (!s) {
+        fputs("null", stdout);
+        return;
+    }
+    putchar('"');
+    for (i = 0; i < len; ++i) {
+        c = s[i];
+        if (c == '"' || c == '\\') {
+            putchar('\\');
+            putchar(c);
+        } else if (c < 0x20 || c == 0x7f) {
+            printf("\\u00%c%c", hex[c >> 4], hex[c & 15]);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static void print_json(const struct entry *e)
+{
+    static const char *const cache[] = { NULL, "hit", "miss" };
+    const char *a;
+    unsigned int len;
+
+    printf("{\"time\":%ld", (long) e->time);
+    a = address(e, &len);
+    put_json("remote", a, len);
+    put_json("vhost", e->vhost.s, e->vhost.len);
+    put_json("request", e->request.s, e->request.len);
+    printf(",\"status\":%lu,\"bytes_sent\":%llu,\"bytes_in\":%llu",
+           e->status, (unsigned long long) e->sent,
+           (unsigned long long) e->received);
+    if (e->usec)
+        printf(",\"usec\":%llu", (unsigned long long) e->usec - 1);
+    if (e->ttfb)
+        printf(",\"ttfb_usec\":%llu", (unsigned long long) e->ttfb - 1);
+    printf(",\"keepalive\":%lu", e->keepalive);
+    if (e->cache > 0 && e->cache < 3)
+        put_json("cache", cache[e->cache], strlen(cache[e->cache]));
+    put_json("referer", e->referer.s, e->referer.len);
+    put_json("user_agent", e->agent.s, e->agent.len);
+    fputs("}\n", stdout);
+}
+
+static void aggregate(const struct entry *e)
+{
+    char status[24];
+    struct str key;
+    struct agg *a;
+    unsigned long i;
+
+    switch (agg_key) {
+    case BY_PATH:
+        key = request_word(&e->request, 1);
+        if (key.s) {
+            const char *q = memchr(key.s, '?', key.len);
+            if (q)
+                key.len = q - key.s;
+        }
+        break;
+    case BY_VHOST:
+        key = e->vhost;
+        break;
+    case BY_ADDRESS:
+        key.s = address(e, &key.len);
+        break;
+    case BY_AGENT:
+        key = e->agent;
+        break;
+    case BY_REFERER:
+        key = e->referer;
+        break;
+    case BY_STATUS:
+    default:
+        key.len = sprintf(status, "%lu", e->status);
+        key.s = status;
+        break;
+    }
+    if (!key.s) {
+        key.s = "-";
+        key.len = 1;
+    }
+
+    /* open addressing over aggs, kept at most half full */
+    if (n_aggs * 2 >= agg_size) {
+        struct agg *old = aggs;
+        unsigned long old_size = agg_size;
+
+        agg_size = (agg_size ? agg_size * 2 : 1024);
+        aggs = calloc(agg_size, sizeof (struct agg));
+        if (!aggs) {
+            perror("boa_logcat");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < old_size; ++i) {
+            unsigned long j;
+            unsigned int h, k;
+
+            if (!old[i].key)
+                continue;
+            for (h = 2166136261u, k = 0; k < old[i].len; ++k)
+                h = (h ^ (unsigned char) old[i].key[k]) * 16777619u;
+            for (j = h & (agg_size - 1); aggs[j].key;
+                 j = (j + 1) & (agg_size - 1));
+            aggs[j] = old[i];
+        }
+        free(old);
+    }
+    {
+        unsigned int h, k;
+
+        for (h = 2166136261u, k = 0; k < key.len; ++k)
+            h = (h ^ (unsigned char) key.s[k]) * 16777619u;
+        for (i = h & (agg_size - 1); aggs[i].key;
+             i = (i + 1) & (agg_size - 1)) {
+            if (aggs[i].len == key.len &&
+                !memcmp(aggs[i].key, key.s, key.len))
+                break;
+        }
+    }
+    a = &aggs[i];
+    if (!a->key) {
+        a->key = malloc(key.len + 1);
+        if (!a->key) {
+            perror("boa_logcat");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(a->key, key.s, key.len);
+        a->key[key.len] = '\0';
+        a->len = key.len;
+        ++n_aggs;
+    }
+    a->count++;
+    a->bytes += e->sent;
+    if (e->usec) {
+        a->usec_sum += e->usec - 1;
+        a->usec_count++;
+        if (e->usec - 1 > a->usec_max)
+            a->usec_max = e->usec - 1;
+    }
+}
+
+static int by_count(const void *a, const void *b)
+{
+    const struct agg *x = a, *y = b;
+
+    if (x->count != y->count)
+        return (x->count < y->count ? 1 : -1);
+    return strcmp(x->key ? x->key : "", y->key ? y->key : "");
+}
+
+static void print_aggregates(void)
+{
+    unsigned long i;
+
+    qsort(aggs, agg_size, sizeof (struct agg), by_count);
+    printf("%10s %14s %10s %10s  %s\n", "requests", "bytes", "avg usec",
+           "max usec", "key");
+    for (i = 0; i < n_aggs; ++i) {
+        printf("%10lu %14llu %10llu %10llu  %s\n", aggs[i].count,
+               (unsigned long long) aggs[i].bytes,
+               (unsigned long long) (aggs[i].usec_count ?
+                                     aggs[i].usec_sum /
+                                     aggs[i].usec_count : 0),
+               (unsigned long long) aggs[i].usec_max, aggs[i].key);
+    }
+}
+
+/* Returns NULL if the record is damaged */
+static const unsigned char *decode_access(const unsigned char *p,
+                                          const unsigned char *end,
+                                          time_t base, struct entry *e)
+{
+    uint64_t v;
+    int kind;
+
+    memset(e, 0, sizeof (struct entry));
+    if (!(p = get_varint(p, end, &v)))
+        return NULL;
+    e->time = base + (time_t) ((int64_t) (v >> 1) ^ -(int64_t) (v & 1));
+
+    if (p >= end)
+        return NULL;
+    kind = *p++;
+    if (kind == 4 || kind == 16) {
+        if (end - p < kind)
+            return NULL;
+        inet_ntop((kind == 4 ? AF_INET : AF_INET6), p, e->address,
+                  sizeof (e->address));
+        p += kind;
+    } else if (!(p = get_string(p, end, &e->forwarded))) {
+        return NULL;
+    }
+
+    if (!(p = get_ref(p, end, &e->vhost)) ||
+        !(p = get_string(p, end, &e->request)))
+        return NULL;
+    if (!e->request.len)
+        e->request.s = NULL;
+    if (!(p = get_varint(p, end, &v)))
+        return NULL;
+    e->status = v;
+    if (!(p = get_varint(p, end, &e->sent)) ||
+        !(p = get_varint(p, end, &e->received)) ||
+        !(p = get_varint(p, end, &e->usec)) ||
+        !(p = get_varint(p, end, &e->ttfb)) ||
+        !(p = get_varint(p, end, &v)))
+        return NULL;
+    e->keepalive = v;
+    if (p >= end)
+        return NULL;
+    e->cache = *p++;
+    if (!(p = get_ref(p, end, &e->referer)) ||
+        !(p = get_ref(p, end, &e->agent)))
+        return NULL;
+    return p;
+}
+
+static const unsigned char *find_sync(const unsigned char *p,
+                                      const unsigned char *end)
+{
+    while (end - p >= BINLOG_MAGIC_LEN) {
+        p = memchr(p, BINLOG_MAGIC[0], end - p - BINLOG_MAGIC_LEN + 1);
+        if (!p)
+            break;
+        if (!memcmp(p, BINLOG_MAGIC, BINLOG_MAGIC_LEN))
+            return p;
+        ++p;
+    }
+    return end;
+}
+
+/*
+ * Name: read_log
+ * Description: Decodes a whole binary log, from one sync marker to the
+ * next.  Damage costs the records up to the next sync marker.
+ */
+
+static void read_log(const unsigned char *p, const unsigned char *end)
+{
+    const unsigned char *next, *body, *rec_end;
+    uint64_t v, len;
+    time_t base = 0;
+    int in_block = 0;
+    struct entry e;
+
+    while (p < end) {
+        if (!in_block || (end - p >= BINLOG_MAGIC_LEN &&
+                          !memcmp(p, BINLOG_MAGIC, BINLOG_MAGIC_LEN))) {
+            next = find_sync(p, end);
+            bad_bytes += next - p;
+            p = next;
+            if (p == end)
+                break;
+            p += BINLOG_MAGIC_LEN;
+            if (!(p = get_varint(p, end, &v)) || v != BINLOG_VERSION ||
+                !(p = get_varint(p, end, &v))) {
+                in_block = 0;
+                if (!p)
+                    break;
+                continue;
+            }
+            base = (time_t) v;
+            dict_entries = 0;
+            in_block = 1;
+            continue;
+        }
+
+        body = get_varint(p, end, &len);
+        if (!body || len == 0 || len > (uint64_t) (end - body)) {
+            in_block = 0;
+            continue;
+        }
+        rec_end = body + len;
+        switch (*body) {
+        case BINLOG_DEFINE:
+            if (dict_entries < BINLOG_DICT_ENTRIES &&
+                get_string(body + 1, rec_end, &dict[dict_entries]))
+                ++dict_entries;
+            break;
+        case BINLOG_ACCESS:
+            if (!decode_access(body + 1, rec_end, base, &e)) {
+                bad_bytes += rec_end - p;
+                break;
+            }
+            ++records;
+            if (!wanted(&e))
+                break;
+            if (output == OUT_JSON)
+                print_json(&e);
+            else if (output == OUT_AGGREGATE)
+                aggregate(&e);
+            else
+                print_clf(&e);
+            break;
+        default:
+            /* something newer: skip it */
+            break;
+        }
+        p = rec_end;
+    }
+}
+
+static int read_file(const char *name)
+{
+    struct stat st;
+    unsigned char *data;
+    size_t size = 0, room = 0;
+    ssize_t n;
+    int fd;
+
+    if (!strcmp(name, "-")) {
+        fd = STDIN_FILENO;
+    } else if ((fd = open(name, O_RDONLY)) == -1) {
+        perror(name);
+        return 0;
+    }
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED) {
+#ifdef HAVE_MADVISE
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+#endif
+            read_log(data, data + st.st_size);
+            munmap(data, st.st_size);
+            if (fd != STDIN_FILENO)
+                close(fd);
+            return 1;
+        }
+    }
+
+    /* a pipe, or something else that can't be mapped */
+    data = NULL;
+    do {
+        if (size == room) {
+            unsigned char *more;
+
+            room = (room ? room * 2 : 1 << 20);
+            more = realloc(data, room);
+            if (!more) {
+                perror(name);
+                free(data);
+                return 0;
+            }
+            data = more;
+        }
+        n = read(fd, data + size, room - size);
+        if (n > 0)
+            size += n;
+    } while (n > 0);
+    if (n == -1)
+        perror(name);
+    read_log(data, data + size);
+    free(data);
+    if (fd != STDIN_FILENO)
+        close(fd);
+    return n == 0;
+}
+
+static void usage(const char *me)
+{
+    fprintf(stderr,
+            "usage: %s [-j | -a status|path|vhost|address|agent|referer]\n"
+            "       [-s status|Nxx] [-m method] [-p path-prefix] "
+            "[-v vhost] [-t usec]\n"
+            "       [file ...]\n"
+            "Writes binary Boa access logs (AccessLogBinary) as common log\n"
+            "format, JSON lines (-j), or counts by a key (-a).  Only\n"
+            "records with the given status, method, path prefix, virtual\n"
+            "host, or taking at least usec microseconds are used.\n", me);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *const keys[] = { "status", "path", "vhost",
+        "address", "agent", "referer"
+    };
+    int c, ok = 1;
+    unsigned int i;
+    char *end;
+
+    while ((c = getopt(argc, argv, "ja:s:m:p:v:t:")) != -1) {
+        switch (c) {
+        case 'j':
+            output = OUT_JSON;
+            break;
+        case 'a':
+            for (i = 0; i < sizeof (keys) / sizeof (keys[0]); ++i)
+                if (!strcmp(optarg, keys[i]))
+                    break;
+            if (i == sizeof (keys) / sizeof (keys[0]))
+                usage(argv[0]);
+            agg_key = (enum AGG_KEY) i;
+            output = OUT_AGGREGATE;
+            break;
+        case 's':
+            if (optarg[0] >= '1' && optarg[0] <= '5' &&
+                !strcmp(optarg + 1, "xx")) {
+                want_status_class = optarg[0] - '0';
+            } else {
+                want_status = strtol(optarg, &end, 10);
+                if (*end || want_status < 0)
+                    usage(argv[0]);
+            }
+            break;
+        case 'm':
+            want_method = optarg;
+            break;
+        case 'p':
+            want_prefix = optarg;
+            break;
+        case 'v':
+            want_vhost = optarg;
+            break;
+        case 't':
+            want_usec = strtoull(optarg, &end, 10);
+            if (*end)
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind == argc) {
+        ok = read_file("-");
+    } else {
+        for (; optind < argc; ++optind)
+            ok &= read_file(argv[optind]);
+    }
+
+    if (output == OUT_AGGREGATE)
+        print_aggregates();
+    fflush(stdout);
+    if (bad_bytes)
+        fprintf(stderr, "%s: skipped %lu damaged bytes (%lu records read)\n",
+                argv[0], bad_bytes, records);
+    return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
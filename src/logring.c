@@ -0,0 +1,366 @@
+/*
+ *  Boa, an http server
+ *  Copyright (C) 1995 Paul Phillips <paulp@go2net.com>
+ *  Copyright (C) 1996-2005 Larry Doolittle <ldoolitt@boa.org>
+ *  Copyright (C) 1997-2004 Jon Nelson <jnelson@boa.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 1, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* $Id$ */
+
+/*
+ * Asynchronous access logging.
+ *
+ * With AccessLogBuffer set, log_access hands each formatted record to
+ * logring_write instead of writing it to stdout itself.  The records
+ * go into a byte ring with one producer (the server) and one consumer
+ * (a writer thread), so neither side ever takes a lock: the server
+ * only advances ring_head and the writer only advances ring_tail.
+ * The writer sends everything that has piled up with one writev(), so
+ * a slow log disk (or log pipe) holds up the writer, not the server.
+ *
+ * When the writer sleeps it says so in writer_idle, and the server
+ * wakes it with a byte down wake_pipe.  Each side stores its own
+ * variable before it looks at the other's, so a record can't slip in
+ * unnoticed between the writer's last look and its going to sleep.
+ *
+ * What happens when the ring is full is up to AccessLogFull:
+ *  block - the server waits for room (the record is "delayed")
+ *  drop  - the record is thrown away and counted
+ *  spill - the record is kept in memory, in order, until there is
+ *          room (up to LOGRING_SPILL_FACTOR times the ring size)
+ */
+
+#include "boa.h"
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#include <sys/uio.h>
+#include <signal.h>
+
+enum LOGRING_FULL { LOGRING_BLOCK, LOGRING_DROP, LOGRING_SPILL };
+
+static char *ring;
+static unsigned long ring_size;     /* a power of 2 */
+static unsigned long ring_head;     /* bytes ever put in, by the server */
+static unsigned long ring_tail;     /* bytes ever written, by the writer */
+static int writer_idle;
+static int writer_stop;
+static int wake_pipe[2];
+static pthread_t writer;
+static int running;
+static pid_t running_pid;       /* not in forked children */
+static enum LOGRING_FULL when_full;
+
+/* records that found the ring full, oldest first */
+struct spilled {
+    struct spilled *next;
+    unsigned int len;
+    char data[1];
+};
+
+static struct spilled *spill_head, *spill_tail;
+static unsigned long spill_bytes;
+
+/* kept by the server */
+static unsigned long records, dropped, delayed, spilled;
+/* kept by the writer */
+static unsigned long batches, write_errors;
+
+static void *logring_writer(void *dummy)
+{
+    unsigned long head, tail, at, len;
+    struct iovec iov[2];
+    char junk[64];
+    ssize_t n;
+
+    while (1) {
+        tail = ring_tail;
+        head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE))
+                break;
+            __atomic_store_n(&writer_idle, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&ring_head, __ATOMIC_SEQ_CST) != tail ||
+                __atomic_load_n(&writer_stop, __ATOMIC_SEQ_CST)) {
+                __atomic_store_n(&writer_idle, 0, __ATOMIC_SEQ_CST);
+                continue;
+            }
+            if (read(wake_pipe[0], junk, sizeof (junk)) == -1 &&
+                errno != EINTR)
+                break;          /* can't happen */
+            continue;
+        }
+
+        len = head - tail;
+        at = tail & (ring_size - 1);
+        iov[0].iov_base = ring + at;
+        iov[0].iov_len = (len < ring_size - at ? len : ring_size - at);
+        iov[1].iov_base = ring;
+        iov[1].iov_len = len - iov[0].iov_len;
+        n = writev(STDOUT_FILENO, iov, (iov[1].iov_len ? 2 : 1));
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            /* nothing sensible to do but skip these */
+            __atomic_add_fetch(&write_errors, 1, __ATOMIC_RELAXED);
+            n = len;
+        }
+        __atomic_add_fetch(&batches, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&ring_tail, tail + n, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static unsigned long logring_room(void)
+{
+    return ring_size -
+        (ring_head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE));
+}
+
+static void logring_put(const char *rec, unsigned int len)
+{
+    unsigned long at = ring_head & (ring_size - 1);
+    unsigned long first = ring_size - at;
+
+    if (first >= len) {
+        memcpy(ring + at, rec, len);
+    } else {
+        memcpy(ring + at, rec, first);
+        memcpy(ring, rec + first, len - first);
+    }
+    __atomic_store_n(&ring_head, ring_head + len, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&writer_idle, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&writer_idle, 0, __ATOMIC_SEQ_CST)) {
+        if (write(wake_pipe[1], "", 1) == -1) {
+            /* the pipe is full, so the writer will wake anyway */
+        }
+    }
+}
+
+/* moves what was spilled into the ring, as far as it fits */
+static void logring_unspill(void)
+{
+    struct spilled *s;
+
+    while ((s = spill_head) != NULL && logring_room() >= s->len) {
+        logring_put(s->data, s->len);
+        spill_head = s->next;
+        spill_bytes -= s->len;
+        free(s);
+    }
+    if (!spill_head)
+        spill_tail = NULL;
+}
+
+/* returns 0 if the record had to be dropped after all */
+static int logring_spill(const char *rec, unsigned int len)
+{
+    struct spilled *s;
+
+    if (spill_bytes + len > ring_size * LOGRING_SPILL_FACTOR ||
+        (s = malloc(sizeof (struct spilled) + len)) == NULL) {
+        ++dropped;
+        return 0;
+    }
+    memcpy(s->data, rec, len);
+    s->len = len;
+    s->next = NULL;
+    if (spill_tail)
+        spill_tail->next = s;
+    else
+        spill_head = s;
+    spill_tail = s;
+    spill_bytes += len;
+    ++spilled;
+    return 1;
+}
+
+static void logring_atexit(void)
+{
+    /* a forked child has the ring, but no writer to join */
+    if (getpid() == running_pid)
+        logring_stop();
+}
+
+/*
+ * Name: logring_start
+ *
+ * Description: Sets up the ring and starts the writer thread, if
+ * AccessLogBuffer asks for it.  Called once, after Boa has put itself
+ * in the background (a thread doesn't survive the fork).  The ring is
+ * written out however the server exits, not just on SIGTERM.
+ */
+
+void logring_start(void)
+{
+    sigset_t all, old;
+    int err;
+
+    if (!access_log_name || access_log_buffer <= 0)
+        return;
+
+    for (ring_size = LOGRING_MIN_SIZE;
+         ring_size < (unsigned long) access_log_buffer; ring_size <<= 1);
+    ring = malloc(ring_size);
+    if (!ring) {
+        DIE("unable to allocate access log buffer");
+    }
+    if (pipe(wake_pipe) == -1) {
+        DIE("unable to create access log pipe");
+    }
+    if (fcntl(wake_pipe[0], F_SETFD, 1) == -1 ||
+        fcntl(wake_pipe[1], F_SETFD, 1) == -1 ||
+        fcntl(wake_pipe[1], F_SETFL, NOBLOCK) == -1) {
+        DIE("fcntl on access log pipe");
+    }
+
+    if (!access_log_full || !strcasecmp(access_log_full, "block"))
+        when_full = LOGRING_BLOCK;
+    else if (!strcasecmp(access_log_full, "drop"))
+        when_full = LOGRING_DROP;
+    else
+        when_full = LOGRING_SPILL;
+
+    /* the writer takes no signals, they are all for the main loop */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    err = pthread_create(&writer, NULL, logring_writer, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err) {
+        errno = err;
+        DIE("unable to start access log writer");
+    }
+    running = 1;
+    running_pid = getpid();
+    if (atexit(logring_atexit) != 0)
+        WARN("atexit logring");
+}
+
+/*
+ * Name: logring_stop
+ * Description: Lets the writer write out what is left and stop, then
+ * writes whatever was spilled.  Called on SIGTERM, and at exit.
+ */
+
+void logring_stop(void)
+{
+    struct spilled *s;
+
+    if (!running)
+        return;
+    running = 0;
+    __atomic_store_n(&writer_stop, 1, __ATOMIC_SEQ_CST);
+    if (write(wake_pipe[1], "", 1) == -1) {
+        /* the pipe is full, so the writer will wake anyway */
+    }
+    pthread_join(writer, NULL);
+    while ((s = spill_head) != NULL) {
+        if (write(STDOUT_FILENO, s->data, s->len) == -1)
+            ++write_errors;
+        spill_head = s->next;
+        free(s);
+    }
+    spill_tail = NULL;
+    spill_bytes = 0;
+}
+
+/*
+ * Name: logring_write
+ *
+ * Description: Queues one access log record of len bytes for the
+ * writer thread.
+ * Returns: 0 if there is no writer thread (write it yourself), 1 if
+ * the record has been taken care of, -1 if it was dropped because the
+ * buffer was full (AccessLogFull drop or spill).
+ */
+
+int logring_write(const char *rec, unsigned int len)
+{
+    struct timespec pause = { 0, LOGRING_BLOCK_NSEC };
+
+    if (!running)
+        return 0;
+
+    ++records;
+    if (spill_head)
+        logring_unspill();
+    if (!spill_head && logring_room() >= len) {
+        logring_put(rec, len);
+        return 1;
+    }
+
+    switch (when_full) {
+    case LOGRING_DROP:
+        ++dropped;
+        return -1;
+    case LOGRING_SPILL:
+        if (!logring_spill(rec, len))
+            return -1;
+        break;
+    case LOGRING_BLOCK:
+        ++delayed;
+        while (logring_room() < len)
+            nanosleep(&pause, NULL);
+        logring_put(rec, len);
+        break;
+    }
+    return 1;
+}
+
+/*
+ * Name: logring_show_stats
+ * Description: Logs the access log writer's counters.
+ */
+
+void logring_show_stats(void)
+{
+    if (!running)
+        return;
+    log_error_time();
+    fprintf(stderr, "access log: %lu records, %lu batches, "
+            "%lu delayed, %lu spilled (%lu bytes held), %lu dropped, "
+            "%lu write errors\n", records,
+            __atomic_load_n(&batches, __ATOMIC_RELAXED), delayed, spilled,
+            spill_bytes, dropped,
+            __atomic_load_n(&write_errors, __ATOMIC_RELAXED));
+}
+
+#else                           /* HAVE_PTHREAD_H */
+
+void logring_start(void)
+{
+    if (access_log_name && access_log_buffer > 0) {
+        log_error_time();
+        fputs("AccessLogBuffer needs threads, which this build of Boa "
+              "doesn't have; logging synchronously.\n", stderr);
+    }
+}
+
+void logring_stop(void)
+{
+}
+
+int logring_write(const char *rec, unsigned int len)
+{
+    return 0;
+}
+
+void logring_show_stats(void)
+{
+}
+#endif                          /* HAVE_PTHREAD_H */
@@ -0,0 +1,250 @@
+/*
+ *  Boa, an http server
+ *  Copyright (C) 1995 Paul Phillips <paulp@go2net.com>
+ *  Copyright (C) 1996-2005 Larry Doolittle <ldoolitt@boa.org>
+ *  Copyright (C) 1997-2004 Jon Nelson <jnelson@boa.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 1, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* $Id$ */
+
+/*
+ * LogNever / LogAlways / LogSample
+ *
+ * Decides, for each finished request, whether it goes in the access
+ * log.  The rules are tried in this order:
+ *
+ *  1. LogNever <prefix>: a request for a path starting with prefix
+ *     (a health check, say) is not logged.
+ *  2. LogAlways status <n> / LogAlways time <ms>: a request with a
+ *     status of n or more, or one that took longer than ms, is logged.
+ *  3. LogSample <match> <rate>: the first rule that matches the
+ *     request logs one in every rate of the requests it matches.
+ *     <match> is a status class ("2xx"), a path prefix ("/images/"),
+ *     a virtual host ("host:www.example.com"), or "*".
+ *  4. Anything else is logged.
+ *
+ * Sampling is by count, not at random: the 1st, the rate+1th and so
+ * on of the requests a rule matches are logged.  Every rule counts the
+ * requests it matched and the ones it logged, and SIGALRM shows the
+ * counts, so the real totals can be worked out from a sampled log.
+ */
+
+#include "boa.h"
+
+enum MATCH { MATCH_ANY, MATCH_CLASS, MATCH_PREFIX, MATCH_HOST };
+
+struct log_rule {
+    char *text;                 /* as given in boa.conf */
+    enum LOG_RULE kind;
+    enum MATCH match;
+    char *arg;                  /* prefix or host */
+    unsigned int arg_len;
+    int status_class;           /* MATCH_CLASS: 2 for 2xx */
+    int by_time;                /* LogAlways time, not status */
+    unsigned long n;            /* LogAlways limit, LogSample rate */
+    unsigned long matched, logged;
+};
+
+static struct log_rule *log_rules;
+static int n_log_rules;
+
+static int parse_number(const char *s, unsigned long *n)
+{
+    char *end;
+
+    errno = 0;
+    *n = strtoul(s, &end, 10);
+    return !(errno || end == s || *end != '\0');
+}
+
+static int rule_matches(struct log_rule *r, request * req)
+{
+    const char *host;
+
+    switch (r->match) {
+    case MATCH_ANY:
+        return 1;
+    case MATCH_CLASS:
+        return req->response_status / 100 == r->status_class;
+    case MATCH_PREFIX:
+        /* no request line, no URI: it can't be the prefix's */
+        return req->logline && req->request_uri[0] &&
+            !strncmp(req->request_uri, r->arg, r->arg_len);
+    case MATCH_HOST:
+        host = request_host(req);
+        return host && !strncasecmp(host, r->arg, r->arg_len) &&
+            (host[r->arg_len] == '\0' || host[r->arg_len] == ':');
+    }
+    return 0;
+}
+
+/*
+ * Name: log_rule_add
+ * Description: Adds a LogNever (v1 is the prefix), LogAlways (v1 is
+ * "status" or "time", v2 the limit) or LogSample (v1 is the match, v2
+ * the rate, "N" or "1/N") rule.
+ * Returns 0 if the rule can't be parsed.
+ */
+
+int log_rule_add(enum LOG_RULE kind, const char *v1, const char *v2)
+{
+    struct log_rule r, *rules;
+    unsigned int len;
+
+    memset(&r, 0, sizeof (r));
+    r.kind = kind;
+    switch (kind) {
+    case LOG_NEVER:
+        if (*v1 != '/')
+            return 0;
+        r.match = MATCH_PREFIX;
+        r.arg = (char *) v1;
+        break;
+    case LOG_ALWAYS:
+        if (!v2 || !parse_number(v2, &r.n))
+            return 0;
+        if (!strcasecmp(v1, "time"))
+            r.by_time = 1;
+        else if (strcasecmp(v1, "status"))
+            return 0;
+        break;
+    case LOG_SAMPLE:
+        if (!v2 || !parse_number((strncmp(v2, "1/", 2) ? v2 : v2 + 2),
+                                 &r.n) || r.n == 0)
+            return 0;
+        len = strlen(v1);
+        if (!strcmp(v1, "*")) {
+            r.match = MATCH_ANY;
+        } else if (*v1 == '/') {
+            r.match = MATCH_PREFIX;
+            r.arg = (char *) v1;
+        } else if (!strncasecmp(v1, "host:", 5) && v1[5]) {
+            r.match = MATCH_HOST;
+            r.arg = (char *) v1 + 5;
+        } else if (len == 3 && v1[0] >= '1' && v1[0] <= '5' &&
+                   (v1[1] == 'x' || v1[1] == 'X') &&
+                   (v1[2] == 'x' || v1[2] == 'X')) {
+            r.match = MATCH_CLASS;
+            r.status_class = v1[0] - '0';
+        } else {
+            return 0;
+        }
+        break;
+    }
+
+    len = strlen(v1) + (v2 ? strlen(v2) + 1 : 0);
+    r.text = malloc(len + 1);
+    if (!r.text) {
+        DIE("out of memory adding log rule");
+    }
+    if (v2)
+        sprintf(r.text, "%s %s", v1, v2);
+    else
+        strcpy(r.text, v1);
+    if (r.arg) {
+        /* point into our own copy */
+        r.arg = r.text + (r.arg - v1);
+        r.arg_len = (r.match == MATCH_HOST ? strlen(v1) - 5 : strlen(v1));
+    }
+
+    rules = realloc(log_rules, (n_log_rules + 1) * sizeof (struct log_rule));
+    if (!rules) {
+        DIE("out of memory adding log rule");
+    }
+    log_rules = rules;
+    log_rules[n_log_rules++] = r;
+    return 1;
+}
+
+/*
+ * Name: log_rule_clear
+ * Description: Forgets all the logging rules, before a reload.
+ */
+
+void log_rule_clear(void)
+{
+    int i;
+
+    for (i = 0; i < n_log_rules; ++i)
+        free(log_rules[i].text);
+    free(log_rules);
+    log_rules = NULL;
+    n_log_rules = 0;
+}
+
+/*
+ * Name: log_rule_wanted
+ * Description: Returns 1 if req should be logged, 0 if not.  Called
+ * from free_request, just before log_access.
+ */
+
+int log_rule_wanted(request * req)
+{
+    struct log_rule *r, *end = log_rules + n_log_rules;
+    unsigned long ms;
+
+    if (!n_log_rules)
+        return 1;
+
+    for (r = log_rules; r < end; ++r) {
+        if (r->kind == LOG_NEVER && rule_matches(r, req)) {
+            r->matched++;
+            return 0;
+        }
+    }
+
+    ms = (req->time_start ? (current_usec - req->time_start) / 1000 : 0);
+    for (r = log_rules; r < end; ++r) {
+        if (r->kind == LOG_ALWAYS &&
+            (r->by_time ? ms > r->n :
+             (unsigned long) req->response_status >= r->n)) {
+            r->matched++;
+            r->logged++;
+            return 1;
+        }
+    }
+
+    for (r = log_rules; r < end; ++r) {
+        if (r->kind == LOG_SAMPLE && rule_matches(r, req)) {
+            if (r->matched++ % r->n)
+                return 0;
+            r->logged++;
+            return 1;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Name: log_rule_show_stats
+ * Description: Logs how many requests each logging rule matched, and
+ * how many of those it logged.
+ */
+
+void log_rule_show_stats(void)
+{
+    static const char *name[] = { "LogNever", "LogAlways", "LogSample" };
+    int i;
+
+    for (i = 0; i < n_log_rules; ++i) {
+        log_error_time();
+        fprintf(stderr, "%s %s: %lu matched, %lu logged\n",
+                name[log_rules[i].kind], log_rules[i].text,
+                log_rules[i].matched, log_rules[i].logged);
+    }
+}
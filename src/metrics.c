@@ -0,0 +1,503 @@
+/*
+ *  Boa, an http server
+ *  Copyright (C) 1995 Paul Phillips <paulp@go2net.com>
+ *  Copyright (C) 1996-2005 Larry Doolittle <ldoolitt@boa.org>
+ *  Copyright (C) 1997-2004 Jon Nelson <jnelson@boa.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 1, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* $Id$ */
+
+/*
+ * StatusURI
+ *
+ * A request for StatusURI is answered from the counters in 'status'
+ * and the request lists, without looking at the filesystem: Prometheus
+ * text format, or JSON if the query string is "json" or "format=json".
+ * It isn't logged, and it answers 503 once Boa is shutting down, so a
+ * load balancer can use it as a health check.
+ *
+ * The body is built in memory and then copied into an anonymous
+ * mapping, which process_get sends like any mmapped file, and
+ * free_request unmaps.
+ *
+ * Latency histograms
+ *
+ * Every finished request adds its times (microseconds) to a histogram
+ * per phase: header complete, init_get/init_cgi, first response byte
+ * and total, all from the first read; and time spent in WRITE,
+ * IOSHUFFLE and PIPE_READ.  The buckets are log-linear, as in
+ * HdrHistogram: exact below 2^HIST_SUB_BITS, then 2^(HIST_SUB_BITS-1)
+ * buckets per power of two, so a bucket is never more than 1/16 of
+ * its value wide.  Adding a value is a count of leading zeros and an
+ * increment.
+ */
+
+#include "boa.h"
+#include <stdarg.h>
+
+static const char *state_name[] = {
+    "read_header", "one_cr", "one_lf", "two_cr",
+    "body_read", "body_write",
+    "write",
+    "pipe_read", "pipe_write",
+    "ioshuffle",
+    "http2",
+    "done",
+    "timed_out",
+    "dead"
+};
+
+#define STATES (sizeof (state_name) / sizeof (state_name[0]))
+
+const char *request_state_name(enum REQ_STATUS s)
+{
+    return ((unsigned) s < STATES ? state_name[s] : "unknown");
+}
+
+/* connections accepted, by second, for the accept rate */
+static long accept_count[STATUS_RATE_SECONDS];
+static time_t accept_second[STATUS_RATE_SECONDS];
+
+static char *out;
+static unsigned int out_len, out_size;
+static int out_failed;
+
+static void out_printf(const char *fmt, ...)
+{
+    va_list ap;
+    char *bigger;
+    int n;
+
+    while (!out_failed) {
+        va_start(ap, fmt);
+        n = vsnprintf(out + out_len, out_size - out_len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            out_failed = 1;
+        } else if ((unsigned) n < out_size - out_len) {
+            out_len += n;
+            return;
+        } else {
+            bigger = realloc(out, out_size + (n < 4096 ? 4096 : n + 1));
+            if (!bigger) {
+                out_failed = 1;
+            } else {
+                out = bigger;
+                out_size += (n < 4096 ? 4096 : n + 1);
+            }
+        }
+    }
+}
+
+/*
+ * Name: note_accept
+ * Description: Counts a newly accepted connection.
+ */
+
+void note_accept(void)
+{
+    unsigned int i = current_time % STATUS_RATE_SECONDS;
+
+    if (accept_second[i] != current_time) {
+        accept_second[i] = current_time;
+        accept_count[i] = 0;
+    }
+    accept_count[i]++;
+    status.connections++;
+}
+
+/* connections a second, over the last STATUS_RATE_SECONDS whole ones */
+static double accept_rate(void)
+{
+    long total = 0;
+    unsigned int i;
+
+    for (i = 0; i < STATUS_RATE_SECONDS; ++i) {
+        if (accept_second[i] < current_time &&
+            accept_second[i] >= current_time - STATUS_RATE_SECONDS)
+            total += accept_count[i];
+    }
+    return (double) total / STATUS_RATE_SECONDS;
+}
+
+#define HIST_HALF (1 << (HIST_SUB_BITS - 1))
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 2) * HIST_HALF)
+#define HIST_MAX_VALUE ((((uint64_t) 1) << HIST_MAX_BITS) - 1)
+
+struct histogram {
+    uint64_t count, sum, max;
+    unsigned long bucket[HIST_BUCKETS];
+};
+
+static const char *phase_name[LAT_PHASES] = {
+    "header", "init", "first_byte", "write", "ioshuffle", "pipe_read",
+    "total"
+};
+
+static struct histogram latency[LAT_PHASES];
+
+static unsigned int hist_index(uint64_t v)
+{
+    unsigned int msb, e;
+
+    if (v < (1 << HIST_SUB_BITS))
+        return v;
+#ifdef __GNUC__
+    msb = 63 - __builtin_clzll(v);
+#else
+    for (msb = HIST_SUB_BITS; v >> (msb + 1); ++msb);
+#endif
+    e = msb - (HIST_SUB_BITS - 1);
+    return e * HIST_HALF + (unsigned int) (v >> e);
+}
+
+/* the largest value that goes in bucket i */
+static uint64_t hist_value(unsigned int i)
+{
+    unsigned int e;
+
+    if (i < (1 << HIST_SUB_BITS))
+        return i;
+    e = i / HIST_HALF - 1;
+    return (((uint64_t) (i % HIST_HALF + HIST_HALF) + 1) << e) - 1;
+}
+
+static void hist_add(struct histogram *h, uint64_t v)
+{
+    if (v > HIST_MAX_VALUE)
+        v = HIST_MAX_VALUE;
+    h->bucket[hist_index(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+}
+
+/* q is in thousandths: 500 for the median */
+static uint64_t hist_quantile(struct histogram *h, unsigned int q)
+{
+    uint64_t want, seen = 0;
+    unsigned int i;
+
+    if (!h->count)
+        return 0;
+    want = (h->count * q + 999) / 1000;
+    if (!want)
+        want = 1;
+    for (i = 0; i < HIST_BUCKETS; ++i) {
+        seen += h->bucket[i];
+        if (seen >= want)
+            return (hist_value(i) < h->max ? hist_value(i) : h->max);
+    }
+    return h->max;
+}
+
+static const unsigned int quantiles[] = { 500, 900, 990, 999 };
+
+#define QUANTILES (sizeof (quantiles) / sizeof (quantiles[0]))
+
+/* which of req->state_usec, or -1 */
+static int state_slot(enum REQ_STATUS s)
+{
+    switch (s) {
+    case WRITE:
+        return 0;
+    case IOSHUFFLE:
+        return 1;
+    case PIPE_READ:
+        return 2;
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Name: note_state
+ * Description: req's status has just changed from was: adds the time
+ * spent in was, if that is one of the states that are timed.
+ */
+
+void note_state(request * req, enum REQ_STATUS was)
+{
+    int slot = state_slot(was);
+
+    if (slot != -1 && req->state_since) {
+        req->state_usec[slot] += current_usec - req->state_since;
+        req->states_seen |= 1 << slot;
+    }
+    req->state_since = current_usec;
+}
+
+/*
+ * Name: latency_record
+ * Description: Adds a finished request's times to the histograms.
+ * Called from free_request.
+ */
+
+void latency_record(request * req)
+{
+    int slot;
+
+    if (!req->time_start)
+        return;
+    note_state(req, req->status);
+    if (req->time_header) {
+        hist_add(&latency[LAT_HEADER], req->time_header - req->time_start);
+        hist_add(&latency[LAT_INIT], req->time_init);
+    }
+    if (req->time_first_byte)
+        hist_add(&latency[LAT_FIRST_BYTE],
+                 req->time_first_byte - req->time_start);
+    for (slot = 0; slot < 3; ++slot) {
+        if (req->states_seen & (1 << slot))
+            hist_add(&latency[LAT_WRITE + slot], req->state_usec[slot]);
+    }
+    hist_add(&latency[LAT_TOTAL], current_usec - req->time_start);
+}
+
+/*
+ * Name: latency_show_stats
+ * Description: Logs a summary of each latency histogram.
+ */
+
+void latency_show_stats(void)
+{
+    struct histogram *h;
+    unsigned int i;
+
+    for (i = 0; i < LAT_PHASES; ++i) {
+        h = &latency[i];
+        if (!h->count)
+            continue;
+        log_error_time();
+        fprintf(stderr, "latency %s: %llu requests, mean %llu us, "
+                "p50 %llu, p90 %llu, p99 %llu, p99.9 %llu, max %llu\n",
+                phase_name[i], (unsigned long long) h->count,
+                (unsigned long long) (h->sum / h->count),
+                (unsigned long long) hist_quantile(h, 500),
+                (unsigned long long) hist_quantile(h, 900),
+                (unsigned long long) hist_quantile(h, 990),
+                (unsigned long long) hist_quantile(h, 999),
+                (unsigned long long) h->max);
+    }
+}
+
+static void count_states(request * list, long *states, long *length)
+{
+    for (; list; list = list->next) {
+        if ((unsigned) list->status < STATES)
+            states[list->status]++;
+        (*length)++;
+    }
+}
+
+static void status_prometheus(long *states, long ready, long blocked)
+{
+    unsigned int i;
+
+    out_printf("# HELP boa_up Whether Boa is taking new connections.\n"
+               "# TYPE boa_up gauge\n"
+               "boa_up %d\n", (sigterm_flag ? 0 : 1));
+    out_printf("# TYPE boa_uptime_seconds gauge\n"
+               "boa_uptime_seconds %ld\n",
+               (long) (current_time - start_time));
+
+    out_printf("# HELP boa_connections Connections, by state.\n"
+               "# TYPE boa_connections gauge\n");
+    for (i = 0; i < STATES; ++i)
+        out_printf("boa_connections{state=\"%s\"} %ld\n",
+                   state_name[i], states[i]);
+    out_printf("# TYPE boa_queue_length gauge\n"
+               "boa_queue_length{queue=\"ready\"} %ld\n"
+               "boa_queue_length{queue=\"blocked\"} %ld\n", ready, blocked);
+
+    out_printf("# TYPE boa_accepted_connections_total counter\n"
+               "boa_accepted_connections_total %ld\n"
+               "# HELP boa_accept_rate Connections accepted per second, "
+               "over the last %d seconds.\n"
+               "# TYPE boa_accept_rate gauge\n"
+               "boa_accept_rate %.2f\n",
+               status.connections, STATUS_RATE_SECONDS, accept_rate());
+    out_printf("# TYPE boa_requests_total counter\n"
+               "boa_requests_total %ld\n", status.requests);
+
+    out_printf("# TYPE boa_mmap_cache_hits_total counter\n"
+               "boa_mmap_cache_hits_total %ld\n"
+               "# TYPE boa_mmap_cache_misses_total counter\n"
+               "boa_mmap_cache_misses_total %ld\n"
+               "# HELP boa_mmap_cache_bytes Bytes of files mapped.\n"
+               "# TYPE boa_mmap_cache_bytes gauge\n"
+               "boa_mmap_cache_bytes %lld\n",
+               status.mmap_hits, status.mmap_misses,
+               (long long) status.mmap_bytes);
+    out_printf("# TYPE boa_cgi_spawns_total counter\n"
+               "boa_cgi_spawns_total %ld\n", status.cgi_spawns);
+
+    out_printf("# TYPE boa_responses_total counter\n");
+    for (i = 0; i < MAX_STATUS_CODE; ++i) {
+        if (status.responses[i])
+            out_printf("boa_responses_total{code=\"%u\"} %ld\n",
+                       i, status.responses[i]);
+    }
+    out_printf("# HELP boa_sent_bytes_total Response body bytes sent.\n"
+               "# TYPE boa_sent_bytes_total counter\n"
+               "boa_sent_bytes_total %llu\n",
+               (unsigned long long) status.bytes_sent);
+
+    out_printf("# HELP boa_latency_seconds Time taken, by request phase.\n"
+               "# TYPE boa_latency_seconds summary\n");
+    for (i = 0; i < LAT_PHASES; ++i) {
+        unsigned int q;
+
+        for (q = 0; q < QUANTILES; ++q)
+            out_printf("boa_latency_seconds{phase=\"%s\","
+                       "quantile=\"%g\"} %.6f\n", phase_name[i],
+                       quantiles[q] / 1000.0,
+                       hist_quantile(&latency[i], quantiles[q]) / 1e6);
+        out_printf("boa_latency_seconds_sum{phase=\"%s\"} %.6f\n"
+                   "boa_latency_seconds_count{phase=\"%s\"} %llu\n",
+                   phase_name[i], latency[i].sum / 1e6, phase_name[i],
+                   (unsigned long long) latency[i].count);
+    }
+    out_printf("# TYPE boa_latency_max_seconds gauge\n");
+    for (i = 0; i < LAT_PHASES; ++i)
+        out_printf("boa_latency_max_seconds{phase=\"%s\"} %.6f\n",
+                   phase_name[i], latency[i].max / 1e6);
+}
+
+static void status_json(long *states, long ready, long blocked)
+{
+    unsigned int i;
+    const char *sep;
+
+    out_printf("{\"up\":%s,\"uptime\":%ld,\"connections\":{",
+               (sigterm_flag ? "false" : "true"),
+               (long) (current_time - start_time));
+    for (i = 0; i < STATES; ++i)
+        out_printf("%s\"%s\":%ld", (i ? "," : ""), state_name[i],
+                   states[i]);
+    out_printf("},\"queues\":{\"ready\":%ld,\"blocked\":%ld},"
+               "\"accepted\":%ld,\"accept_rate\":%.2f,\"requests\":%ld,"
+               "\"mmap_cache\":{\"hits\":%ld,\"misses\":%ld,\"bytes\":%lld},"
+               "\"cgi_spawns\":%ld,\"responses\":{",
+               ready, blocked, status.connections, accept_rate(),
+               status.requests, status.mmap_hits, status.mmap_misses,
+               (long long) status.mmap_bytes, status.cgi_spawns);
+    for (sep = "", i = 0; i < MAX_STATUS_CODE; ++i) {
+        if (status.responses[i]) {
+            out_printf("%s\"%u\":%ld", sep, i, status.responses[i]);
+            sep = ",";
+        }
+    }
+    out_printf("},\"bytes_sent\":%llu,\"latency_us\":{",
+               (unsigned long long) status.bytes_sent);
+    for (i = 0; i < LAT_PHASES; ++i) {
+        struct histogram *h = &latency[i];
+
+        out_printf("%s\"%s\":{\"count\":%llu,\"sum\":%llu,\"max\":%llu,"
+                   "\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu}",
+                   (i ? "," : ""), phase_name[i],
+                   (unsigned long long) h->count,
+                   (unsigned long long) h->sum,
+                   (unsigned long long) h->max,
+                   (unsigned long long) hist_quantile(h, 500),
+                   (unsigned long long) hist_quantile(h, 900),
+                   (unsigned long long) hist_quantile(h, 990),
+                   (unsigned long long) hist_quantile(h, 999));
+    }
+    out_printf("}}\n");
+}
+
+/*
+ * Name: init_status
+ * Description: Answers a request for StatusURI.  Called from
+ * process_header_end, in place of init_get.
+ */
+
+int init_status(request * req)
+{
+    long states[STATES], ready = 0, blocked = 0;
+    int json;
+
+    req->no_log = 1;
+    req->status = WRITE;
+    if (req->method != M_GET && req->method != M_HEAD) {
+        send_r_not_implemented(req);
+        return 0;
+    }
+    if (sigterm_flag) {
+        send_r_service_unavailable(req);
+        return 0;
+    }
+
+    json = (req->query_string &&
+            (!strcmp(req->query_string, "json") ||
+             !strcmp(req->query_string, "format=json")));
+
+    memset(states, 0, sizeof (states));
+    count_states(request_ready, states, &ready);
+    count_states(request_block, states, &blocked);
+
+    out_len = 0;
+    out_failed = 0;
+    if (json)
+        status_json(states, ready, blocked);
+    else
+        status_prometheus(states, ready, blocked);
+    if (out_failed) {
+        log_error_doc(req);
+        fputs("out of memory building status page\n", stderr);
+        send_r_error(req);
+        return 0;
+    }
+
+    req->data_mem = mmap(0, out_len, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (req->data_mem == MAP_FAILED) {
+        req->data_mem = NULL;
+        boa_perror(req, "mmap for status page");
+        return 0;
+    }
+    memcpy(req->data_mem, out, out_len);
+    req->filesize = out_len;
+    req->last_modified = current_time;
+
+    /* it's made afresh each time, so a Range would be no use: 200 */
+    ranges_reset(req);
+    req->ranges = range_pool_pop();
+    req->ranges->start = 0;
+    req->ranges->stop = -1;
+    if (!ranges_fixup(req))
+        return 0;
+
+    req->response_status = R_REQUEST_OK;
+    if (req->http_version != HTTP09) {
+        req_write(req, http_ver_string(req->http_version));
+        req_write(req, " 200 OK" CRLF);
+        print_http_headers(req);
+        req_write(req, (json ? "Content-Type: application/json" CRLF :
+                        "Content-Type: text/plain; version=0.0.4" CRLF));
+        req_write(req, "Cache-Control: no-cache" CRLF);
+        print_content_length(req);
+        req_write(req, CRLF);
+    }
+
+    if (req->method == M_HEAD)
+        return complete_response(req);
+    return 1;
+}
@@ -44,6 +44,7 @@ struct mmap_entry *find_mmap(int data_fd, struct stat *s)
             mmap_list[i].ino == s->st_ino &&
             mmap_list[i].len == s->st_size) {
             mmap_list[i].use_count++;
+            status.mmap_hits++;
             DEBUG(DEBUG_MMAP_CACHE) {
                 fprintf(stderr,
                         "Old mmap_list entry %d use_count now %d (hash was %d)\n",
@@ -65,9 +66,11 @@ struct mmap_entry *find_mmap(int data_fd, struct stat *s)
              * match. Thus, there is no room for a new entry.
              */
 /*        WARN("mmap hash table is full. Consider enlarging."); */
+            status.mmap_misses++;
             return NULL;
         }
     }
+    status.mmap_misses++;
 
     /* Enforce a size limit here */
     /* Disallow more entries than MMAP_LIST_USE_MAX, despite
@@ -110,6 +113,7 @@ struct mmap_entry *find_mmap(int data_fd, struct stat *s)
         fprintf(stderr, "New mmap_list entry %d (hash was %d)\n", i, start);
     }
     mmap_list_entries_used++;
+    status.mmap_bytes += s->st_size;
     mmap_list[i].dev = s->st_dev;
     mmap_list[i].ino = s->st_ino;
     mmap_list[i].len = s->st_size;
@@ -131,6 +135,7 @@ void release_mmap(struct mmap_entry *e)
     if (!--(e->use_count)) {
         munmap(e->mmap, e->len);
         mmap_list_entries_used--;
+        status.mmap_bytes -= e->len;
     }
 }
 
@@ -97,20 +97,8 @@ int read_from_pipe(request * req)
 
     if (req->cgi_status != CGI_PARSE)
         return write_from_pipe(req); /* why not try and flush the buffer now? */
-    else {
-        char *c, *buf;
-
-        buf = req->header_line;
-
-        c = strstr(buf, "\n\r\n");
-        if (c == NULL) {
-            c = strstr(buf, "\n\n");
-            if (c == NULL) {
-                return 1;
-            }
-        }
+    else if (parse_cgi_header(req)) { /* only looks at the new lines */
         req->cgi_status = CGI_DONE;
-        *req->header_end = '\0'; /* points to end of read data */
         return process_cgi_header(req); /* cgi_status will change */
     }
     return 1;
@@ -155,8 +143,10 @@ int write_from_pipe(request * req)
         }
     }
 
+    BOA_PROBE3(write, req, req->fd, bytes_written);
     req->header_line += bytes_written;
     req->bytes_written += bytes_written;
+    note_first_byte(req);
 
     /* if there won't be anything to write next time, switch state */
     if ((unsigned) bytes_written == bytes_to_write) {
@@ -230,8 +220,7 @@ retrysendfile:
                 if (errno != EPIPE && errno != ECONNRESET)
 #endif
                 {
-                    log_error_doc(req);
-                    perror("sendfile write");
+                    errlog_doc(req, ERRLOG_SENDFILE, errno);
                 }
             }
             return 0;
@@ -247,6 +236,7 @@ retrysendfile:
      * don't touch!
      * req->ranges->start += bytes_written;
      */
+    BOA_PROBE3(sendfile, req, req->fd, bytes_written);
     req->bytes_written += bytes_written;
 
     if (req->ranges->stop + 1 <= req->ranges->start) {
@@ -358,8 +348,10 @@ int io_shuffle(request * req)
     } else if (bytes_written == 0) {
     }
 
+    BOA_PROBE3(write, req, req->fd, bytes_written);
     req->buffer_start += bytes_written;
     req->bytes_written += bytes_written;
+    note_first_byte(req);
 
     if (bytes_to_write == bytes_written) {
         req->buffer_end = req->buffer_start = 0;
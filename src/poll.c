@@ -41,9 +41,9 @@ void loop(int server_s)
     watch_server = 1;
 
     while (1) {
-        int timeout;
+        int timeout, timer;
 
-        time(&current_time);
+        update_clock();
 
         if (sighup_flag)
             sighup_run();
@@ -95,11 +95,15 @@ void loop(int server_s)
          *  timeout is ka_timeout ? ka_timeout * 1000, otherwise
          *  REQUEST_TIMEOUT * 1000.
          * -1 means forever
+         * A timer (see run_timers) may be due sooner than that.
          */
         pending_requests = 0;
+        timer = run_timers();
         if (pfd_len) {
             timeout = (request_ready ? 0 :
                       (request_block ? default_timeout : -1));
+            if (timer >= 0 && (timeout == -1 || timeout > timer * 1000))
+                timeout = timer * 1000;
 
             if (poll(pfds, pfd_len, timeout) == -1) {
                 if (errno == EINTR)
@@ -117,7 +121,7 @@ void loop(int server_s)
                     pending_requests = 1;
                 }
             }
-            time(&current_time);
+            update_clock();
             /* if pfd_len is 0, we didn't poll, so the current time
              * should be up-to-date, and we *won't* be accepting anyway
              */
@@ -184,14 +188,18 @@ void update_blocked(struct pollfd pfd1[])
                     revents & POLLERR ? "POLLERR ":"");
             current->status = DEAD;
         } else if (time_since > REQUEST_TIMEOUT) {
-            log_error_doc(current);
-            fputs("connection timed out\n", stderr);
+            errlog_doc(current, ERRLOG_TIMEOUT, 0);
             current->status = TIMED_OUT; /* connection timed out */
         } else if (current->kacount < ka_max && /* we *are* in a keepalive */
             (time_since >= ka_timeout) && /* ka timeout has passed */
             !current->logline) { /* haven't read anything yet */
-            log_error_doc(current);
-            fputs("connection timed out\n", stderr);
+            errlog_doc(current, ERRLOG_TIMEOUT, 0);
+            current->status = TIMED_OUT; /* connection timed out */
+        } else if (current->status == HTTP2 && h2_idle(current) &&
+                   (sigterm_flag ||
+                    (ka_timeout && time_since >= ka_timeout))) {
+            /* an HTTP/2 connection with no streams open */
+            errlog_doc(current, ERRLOG_TIMEOUT, 0);
             current->status = TIMED_OUT; /* connection timed out */
         } else if (revents == 0) {                /* still blocked */
             pfd1[pfd_len].fd = pfds[current->pollfd_id].fd;
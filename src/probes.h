@@ -0,0 +1,60 @@
+/*
+ *  Boa, an http server
+ *  Copyright (C) 1995 Paul Phillips <paulp@go2net.com>
+ *  Copyright (C) 1996-2005 Larry Doolittle <ldoolitt@boa.org>
+ *  Copyright (C) 1997-2004 Jon Nelson <jnelson@boa.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 1, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* $Id$ */
+
+/*
+ * USDT probes, for bpftrace, perf and SystemTap: provider "boa".
+ * Built in whenever configure finds <sys/sdt.h>; an untraced probe is
+ * a single nop, so they stay in release builds.  The first argument of
+ * the per-request probes is the request pointer, good for telling
+ * requests apart.
+ *
+ *   accept (req, fd, remote ip)
+ *   header_done (req, method, uri)        enum HTTP_METHOD
+ *   translate_done (req, pathname)
+ *   cache_hit, cache_miss (req, pathname, file size)
+ *   cgi_fork (req, pid, pathname)
+ *   cgi_exit (pid, wait status)
+ *   state (req, old, new)                 enum REQ_STATUS
+ *   write, sendfile (req, fd, bytes)      to the client
+ *   request_free (req, status, bytes, usec)
+ *
+ * See contrib/bpftrace for some scripts.
+ */
+
+#ifndef _PROBES_H
+#define _PROBES_H
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define BOA_PROBE2(name, a, b) DTRACE_PROBE2(boa, name, a, b)
+#define BOA_PROBE3(name, a, b, c) DTRACE_PROBE3(boa, name, a, b, c)
+#define BOA_PROBE4(name, a, b, c, d) DTRACE_PROBE4(boa, name, a, b, c, d)
+#else
+#define BOA_PROBE2(name, a, b) do { } while (0)
+#define BOA_PROBE3(name, a, b, c) do { } while (0)
+#define BOA_PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+#endif                          /* _PROBES_H */
@@ -60,6 +60,13 @@ void block_request(request * req)
         case BODY_WRITE:
             BOA_FD_SET(req, req->post_data_fd, BOA_WRITE);
             break;
+        case HTTP2:
+            if (h2_writing(req)) {
+                BOA_FD_SET(req, req->fd, BOA_WRITE);
+            } else {
+                BOA_FD_SET(req, req->fd, BOA_READ);
+            }
+            break;
         default:
             BOA_FD_SET(req, req->fd, BOA_READ);
             break;
@@ -100,6 +107,13 @@ void ready_request(request * req)
         case BODY_WRITE:
             BOA_FD_CLR(req, req->post_data_fd, BOA_WRITE);
             break;
+        case HTTP2:
+            if (h2_writing(req)) {
+                BOA_FD_CLR(req, req->fd, BOA_WRITE);
+            } else {
+                BOA_FD_CLR(req, req->fd, BOA_READ);
+            }
+            break;
         default:
             BOA_FD_CLR(req, req->fd, BOA_READ);
         }
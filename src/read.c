@@ -23,6 +23,11 @@
 /* $Id: read.c,v 1.49.2.14 2005/02/23 15:41:55 jnelson Exp $*/
 
 #include "boa.h"
+#ifdef HAVE_SPLICE
+#include <sys/ioctl.h>          /* FIONREAD */
+#endif
+
+static int decode_chunked(request * req, char *p, int len);
 
 /*
  * Name: read_header
@@ -42,6 +47,9 @@ int read_header(request * req)
     char *check, *buffer;
     unsigned char uc;
 
+    if (!req->time_start)
+        req->time_start = current_usec;
+
     check = req->client_stream + req->parse_pos;
     buffer = req->client_stream;
     bytes = req->client_stream_pos;
@@ -55,6 +63,18 @@ int read_header(request * req)
         }
     }
     while (check < (buffer + bytes)) {
+        /* Inside a header line only CR, LF and illegal characters
+         * matter, so jump straight to the next one of those.
+         */
+        if (req->status == READ_HEADER) {
+            char *next = (char *) scan_header(check, buffer + bytes);
+
+            req->parse_pos += next - check;
+            check = next;
+            if (check == buffer + bytes)
+                break;
+        }
+
         /* check for illegal characters here
          * Anything except CR, LF, and US-ASCII - control is legal
          * We accept tab but don't do anything special with it.
@@ -137,20 +157,28 @@ int read_header(request * req)
                 if (process_logline(req) == 0)
                     /* errors already logged */
                     return 0;
-                if (req->http_version == HTTP09)
+                if (req->status == HTTP2)
+                    return 1;   /* the preface, h2_process takes over */
+                if (req->http_version == HTTP09) {
+                    req->bytes_in = req->parse_pos;
                     return process_header_end(req);
+                }
             }
             /* set header_line to point to beginning of new header */
             req->header_line = check;
         } else if (req->status == BODY_READ) {
 #ifdef VERY_FASCIST_LOGGING
             int retval;
+            req->bytes_in = req->parse_pos;
             log_error_time();
             fprintf(stderr, "%s:%d -- got to body read.\n",
                     __FILE__, __LINE__);
             retval = process_header_end(req);
 #else
-            int retval = process_header_end(req);
+            int retval;
+
+            req->bytes_in = req->parse_pos;
+            retval = process_header_end(req);
 #endif
             /* process_header_end inits non-POST CGIs */
 
@@ -168,48 +196,20 @@ int read_header(request * req)
                  * filesize is less than we have already read.
                  */
 
-                /*
-
-                   As quoted from RFC1945:
-
-                   A valid Content-Length is required on all HTTP/1.0 POST requests. An
-                   HTTP/1.0 server should respond with a 400 (bad request) message if it
-                   cannot determine the length of the request message's content.
-
-                 */
+                /* Content-Length was validated in process_header_end */
+                if (req->chunked_body) {
+                    int len;
 
-                if (req->content_length) {
-                    off_t content_length;
-
-                    content_length = boa_atoi(req->content_length);
-                    /* Is a content-length of 0 legal? */
-                    if (content_length < 0) {
-                        log_error_doc(req);
-                        fprintf(stderr,
-                                "Invalid Content-Length [%s] on POST!\n",
-                                req->content_length);
-                        send_r_bad_request(req);
+                    req->bytes_in += req->header_end - req->header_line;
+                    len = decode_chunked(req, req->header_line,
+                                         req->header_end - req->header_line);
+                    if (len < 0)
                         return 0;
-                    }
-                    if (single_post_limit
-                        && content_length > single_post_limit) {
-                        log_error_doc(req);
-                        fprintf(stderr,
-                                "Content-Length [" PRINTF_OFF_T_ARG "] > SinglePostLimit [%d] on POST!\n",
-                                content_length, single_post_limit);
-                        send_r_bad_request(req);
-                        return 0;
-                    }
-                    req->filesize = content_length;
-                    req->filepos = 0;
-                    if ((unsigned) (req->header_end - req->header_line) > req->filesize) {
-                        req->header_end = req->header_line + req->filesize;
-                    }
+                    req->header_end = req->header_line + len;
                 } else {
-                    log_error_doc(req);
-                    fprintf(stderr, "Unknown Content-Length POST!\n");
-                    send_r_bad_request(req);
-                    return 0;
+                    if ((unsigned) (req->header_end - req->header_line) > req->filesize)
+                        req->header_end = req->header_line + req->filesize;
+                    req->bytes_in += req->header_end - req->header_line;
                 }
             }                   /* either process_header_end failed or req->method != POST */
             return retval;      /* 0 - close it done, 1 - keep on ready */
@@ -288,6 +288,118 @@ int read_header(request * req)
     return 1;
 }
 
+#ifdef HAVE_SPLICE
+/* shared by all spooled bodies, always drained before splice_body returns */
+static int spool_pipe[2] = { -1, -1 };
+
+static void close_spool_pipe(void)
+{
+    close(spool_pipe[0]);
+    close(spool_pipe[1]);
+    spool_pipe[0] = spool_pipe[1] = -1;
+}
+
+/*
+ * Name: splice_body
+ * Description: Moves up to SPLICE_SIZE bytes of a POST body from the
+ * socket to req->post_data_fd without copying them through user space.
+ *
+ * A StreamScriptAlias body goes straight into the CGI's stdin pipe.
+ * EAGAIN from splice doesn't say which side is stuck, so FIONREAD
+ * tells a full pipe (wait in BODY_WRITE) from an empty socket (wait
+ * in BODY_READ).
+ *
+ * A spooled body has to bounce through spool_pipe, since splice needs a
+ * pipe on one side; writing a regular file doesn't block, so the pipe is
+ * emptied into the spool file right away.
+ *
+ * Return values: as read_body, or -2 to fall back to read()/write()
+ */
+
+static int splice_body(request * req)
+{
+    off_t bytes_to_read;
+    ssize_t bytes_read, bytes_written;
+    int target;
+
+    bytes_to_read = req->filesize - req->filepos;
+    if (bytes_to_read <= 0) {
+        req->status = BODY_WRITE;
+        return 1;
+    }
+    if (bytes_to_read > SPLICE_SIZE)
+        bytes_to_read = SPLICE_SIZE;
+
+    if (req->stream_body) {
+        target = req->post_data_fd;
+    } else {
+        if (spool_pipe[1] == -1) {
+            if (pipe(spool_pipe) == -1) {
+                spool_pipe[0] = spool_pipe[1] = -1;
+                return -2;
+            }
+            if (fcntl(spool_pipe[0], F_SETFD, 1) == -1 ||
+                fcntl(spool_pipe[1], F_SETFD, 1) == -1) {
+                close_spool_pipe();
+                return -2;
+            }
+        }
+        target = spool_pipe[1];
+    }
+
+    bytes_read = splice(req->fd, NULL, target, NULL, bytes_to_read,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (bytes_read == -1) {
+        int pending = 0;
+
+        if (errno == EINTR)
+            return 1;
+        if (errno == EPIPE && req->stream_body) /* CGI quit reading */
+            return discard_cgi_body(req);
+        if (errno == EINVAL && !req->stream_body)
+            return -2;          /* spool file can't be spliced to */
+        if (errno != EWOULDBLOCK && errno != EAGAIN) {
+            boa_perror(req, "splice body");
+            req->response_status = 400;
+            return 0;
+        }
+        if (req->stream_body &&
+            ioctl(req->fd, FIONREAD, &pending) == 0 && pending > 0)
+            req->status = BODY_WRITE; /* wait for the pipe */
+        return -1;
+    } else if (bytes_read == 0) {
+        log_error_doc(req);
+        fprintf(stderr, "%s:%d - Premature end of body!!\n",
+                __FILE__, __LINE__);
+        send_r_bad_request(req);
+        return 0;
+    }
+
+    if (!req->stream_body) {
+        ssize_t bytes_left = bytes_read;
+
+        while (bytes_left > 0) {
+            bytes_written = splice(spool_pipe[0], NULL, req->post_data_fd,
+                                   NULL, bytes_left, SPLICE_F_MOVE);
+            if (bytes_written == -1 && errno == EINTR)
+                continue;
+            if (bytes_written <= 0) {
+                /* don't leave stale bytes for the next request */
+                close_spool_pipe();
+                boa_perror(req, "splice body");
+                return 0;
+            }
+            bytes_left -= bytes_written;
+        }
+    }
+
+    req->filepos += bytes_read;
+    req->bytes_in += bytes_read;
+    req->status = BODY_WRITE;
+    return 1;
+}
+#endif
+
 /*
  * Name: read_body
  * Description: Reads body from a request socket for POST CGI
@@ -312,8 +424,22 @@ int read_body(request * req)
     off_t bytes_read;
     off_t bytes_to_read, bytes_free;
 
+#ifdef HAVE_SPLICE
+    /* a chunked body has to be looked at, so it can't be spliced */
+    if (!req->chunked_body && !req->discard_body &&
+        req->header_end == req->header_line) {
+        int retval = splice_body(req);
+
+        if (retval != -2)
+            return retval;
+    }
+#endif
+
     bytes_free = BUFFER_SIZE - (req->header_end - req->header_line);
-    bytes_to_read = req->filesize - req->filepos;
+    if (req->chunked_body)
+        bytes_to_read = (req->chunk_state == CHUNK_DONE ? 0 : bytes_free);
+    else
+        bytes_to_read = req->filesize - req->filepos;
 
     if (bytes_to_read > bytes_free)
         bytes_to_read = bytes_free;
@@ -343,6 +469,7 @@ int read_body(request * req)
     }
 
     req->status = BODY_WRITE;
+    req->bytes_in += bytes_read;
 
 #ifdef FASCIST_LOGGING1
     log_error_time();
@@ -350,6 +477,11 @@ int read_body(request * req)
             __FILE__, __LINE__, bytes_to_read);
 #endif
 
+    if (req->chunked_body) {
+        bytes_read = decode_chunked(req, req->header_end, bytes_read);
+        if (bytes_read < 0)
+            return 0;
+    }
     req->header_end += bytes_read;
 
     return 1;
@@ -357,7 +489,8 @@ int read_body(request * req)
 
 /*
  * Name: write_body
- * Description: Writes a chunk of data to a file
+ * Description: Writes a chunk of data to a file, or to the stdin pipe
+ * of an already running CGI (StreamScriptAlias)
  *
  * Return values:
  *  -1: request blocked, move to blocked queue
@@ -375,21 +508,31 @@ int write_body(request * req)
 
     if (bytes_to_write == 0) {  /* nothing left in buffer to write */
         req->header_line = req->header_end = req->buffer;
-        if (req->filepos >= req->filesize)
+        if (req->filepos >= req->filesize &&
+            (!req->chunked_body || req->chunk_state == CHUNK_DONE)) {
+            if (req->stream_body)
+                return finish_cgi_body(req);
             return init_cgi(req);
+        }
         /* if here, we can safely assume that there is more to read */
         req->status = BODY_READ;
         return 1;
     }
-    bytes_written = write(req->post_data_fd,
-                          req->header_line, bytes_to_write);
+    if (req->discard_body)
+        bytes_written = bytes_to_write;
+    else
+        bytes_written = write(req->post_data_fd,
+                              req->header_line, bytes_to_write);
 
     if (bytes_written < 0) {
         if (errno == EWOULDBLOCK || errno == EAGAIN)
             return -1;          /* request blocked at the pipe level, but keep going */
         else if (errno == EINTR)
             return 1;
-        else if (errno == ENOSPC) {
+        else if (errno == EPIPE && req->stream_body) {
+            /* the CGI didn't want (the rest of) the body */
+            return discard_cgi_body(req);
+        } else if (errno == ENOSPC) {
             /* 20010520 - Alfred Fluckiger */
             /* No test was originally done in this case, which might  */
             /* lead to a "no space left on device" error.             */
@@ -426,3 +569,152 @@ int write_body(request * req)
 
     return 1;                   /* more to do */
 }
+
+/*
+ * Name: decode_chunked
+ * Description: Strips the chunked transfer-coding (RFC 2616, 3.6.1) from
+ * the len bytes just read at p.  Works in place, since the data never
+ * grows: the decoded bytes end up at p.  The decoder state lives in the
+ * request, so a chunk-size line or CRLF may be split across reads.
+ *
+ * req->filesize is kept at the sum of the chunk sizes seen so far, which
+ * is how SinglePostLimit is enforced before the data even arrives.
+ * Chunk extensions and trailers are skipped.  Bytes following the last
+ * chunk are dropped.
+ *
+ * The framing is checked strictly, since a body two parsers read
+ * differently is a way to smuggle requests: the size may only be
+ * followed by whitespace, a ';' extension or CR, extensions may not
+ * hold control characters, and every line must end in CRLF.
+ *
+ * Return values:
+ *  -1: malformed or oversized body, error response already sent
+ *  otherwise the number of decoded bytes at p
+ */
+
+static int decode_chunked(request * req, char *p, int len)
+{
+    char *in = p, *out = p, *end = p + len;
+    unsigned char c;
+    off_t n;
+
+    while (in < end && req->chunk_state != CHUNK_DONE) {
+        c = *in;
+        if (req->chunk_state == CHUNK_DATA) {
+            n = end - in;
+            if (n > req->chunk_left)
+                n = req->chunk_left;
+            if (out != in)
+                memmove(out, in, n);
+            out += n;
+            in += n;
+            req->chunk_left -= n;
+            if (req->chunk_left == 0)
+                req->chunk_state = CHUNK_DATA_CR;
+            continue;
+        }
+
+        in++;
+        switch (req->chunk_state) {
+        case CHUNK_SIZE_START:
+        case CHUNK_SIZE:
+            if (isxdigit(c)) {
+                req->chunk_left = req->chunk_left * 16 +
+                    (c >= 'A' ? (c & 0xdf) - 'A' + 10 : c - '0');
+                if (req->chunk_left > INT_MAX) {
+                    log_error_doc(req);
+                    fputs("Chunk size too large on POST!\n", stderr);
+                    send_r_bad_request(req);
+                    return -1;
+                }
+                req->chunk_state = CHUNK_SIZE;
+                break;
+            }
+            if (req->chunk_state == CHUNK_SIZE_START)
+                goto BAD_CHUNK;
+            /* FALLTHROUGH */
+        case CHUNK_SIZE_WS:
+            if (c == ' ' || c == '\t')
+                req->chunk_state = CHUNK_SIZE_WS;
+            else if (c == ';')
+                req->chunk_state = CHUNK_EXT;
+            else if (c == '\r')
+                req->chunk_state = CHUNK_SIZE_LF;
+            else
+                goto BAD_CHUNK;
+            break;
+
+        case CHUNK_EXT:
+            if (c == '\r')
+                req->chunk_state = CHUNK_SIZE_LF;
+            else if ((c < ' ' && c != '\t') || c == 127)
+                goto BAD_CHUNK;
+            break;
+
+        case CHUNK_SIZE_LF:
+            if (c != '\n')
+                goto BAD_CHUNK;
+            if (single_post_limit &&
+                req->filesize + req->chunk_left > single_post_limit) {
+                log_error_doc(req);
+                fprintf(stderr,
+                        "Chunked body > SinglePostLimit [%d] on POST!\n",
+                        single_post_limit);
+                send_r_bad_request(req);
+                return -1;
+            }
+            req->filesize += req->chunk_left;
+            req->chunk_state = (req->chunk_left ? CHUNK_DATA : CHUNK_TRAILER);
+            break;
+
+        case CHUNK_DATA_CR:
+            if (c != '\r')
+                goto BAD_CHUNK;
+            req->chunk_state = CHUNK_DATA_LF;
+            break;
+
+        case CHUNK_DATA_LF:
+            if (c != '\n')
+                goto BAD_CHUNK;
+            req->chunk_state = CHUNK_SIZE_START;
+            break;
+
+        case CHUNK_TRAILER:
+            if (c == '\r')
+                req->chunk_state = CHUNK_END_LF;
+            else if (c == '\n')
+                goto BAD_CHUNK;
+            else
+                req->chunk_state = CHUNK_TRAILER_LINE;
+            break;
+
+        case CHUNK_TRAILER_LINE:
+            if (c == '\r')
+                req->chunk_state = CHUNK_TRAILER_LF;
+            else if (c == '\n')
+                goto BAD_CHUNK;
+            break;
+
+        case CHUNK_TRAILER_LF:
+        case CHUNK_END_LF:
+            if (c != '\n')
+                goto BAD_CHUNK;
+            req->chunk_state = (req->chunk_state == CHUNK_END_LF ?
+                                CHUNK_DONE : CHUNK_TRAILER);
+            break;
+
+        case CHUNK_DATA:
+        case CHUNK_DONE:
+            break;
+        }
+    }
+
+    return out - p;
+
+  BAD_CHUNK:
+    log_error_doc(req);
+    fprintf(stderr, "Malformed chunked body (char %d) on POST!\n",
+            (unsigned int) c);
+    send_r_bad_request(req);
+    return -1;
+}
@@ -24,6 +24,7 @@
 
 #include "boa.h"
 #include <stddef.h>             /* for offsetof */
+#include "access.h"
 
 #define TUNE_SNDBUF
 /*
@@ -39,7 +40,6 @@ struct status status;
 static unsigned int sockbufsize = SOCKETBUF_SIZE;
 
 /* function prototypes located in this file only */
-static void free_request(request * req);
 static void sanitize_request(request * req, int make_new_request);
 
 /*
@@ -108,6 +108,11 @@ void get_request(int server_sock)
         close(fd);
         return;
     }
+    if (!ip_acl_allow(&remote_addr)) {
+        /* DenyIP, no questions asked */
+        close(fd);
+        return;
+    }
 #ifdef DEBUGNONINET
     /* This shows up due to race conditions in some Linux kernels
        when the client closes the socket sometime between
@@ -228,6 +233,9 @@ void get_request(int server_sock)
     conn->remote_port = net_port(&remote_addr);
 
     status.requests++;
+    note_accept();
+    BOA_PROBE3(accept, conn, conn->fd,
+               (const char *) conn->remote_ip_addr);
 
 #ifdef USE_TCPNODELAY
     /* Thanks to Jef Poskanzer <jef@acme.com> for this tweak */
@@ -287,6 +295,8 @@ static void sanitize_request(request * req, int new_req)
     }
 
     memset(req, 0, bytes_to_zero);
+    /* not in the zeroed part, but the log rules look at it */
+    req->request_uri[0] = '\0';
 
     req->status = READ_HEADER;
     req->header_line = req->client_stream;
@@ -296,14 +306,15 @@ static void sanitize_request(request * req, int new_req)
  * Name: free_request
  *
  * Description: Deallocates memory for a finished request and closes
- * down socket.
+ * down socket.  An HTTP/2 stream (h2_id) only goes back on the free
+ * list, the socket is its connection's.
  */
 
-static void free_request(request * req)
+void free_request(request * req)
 {
     int i;
     /* free_request should *never* get called by anything but
-       process_requests */
+       process_requests (and h2.c, for its streams) */
 
     if (req->buffer_end && req->status < TIMED_OUT) {
         /*
@@ -325,13 +336,17 @@ static void free_request(request * req)
         }
     }
     /* put request on the free list */
-    dequeue(&request_ready, req); /* dequeue from ready or block list */
+    if (!req->h2_id)
+        dequeue(&request_ready, req); /* dequeue from ready or block list */
 
     /* set response status to 408 if the client has timed out */
     if (req->status == TIMED_OUT && req->response_status == 0)
         req->response_status = 408;
 
-    if (req->kacount < ka_max &&
+    if (req->h2) {
+        /* its streams were logged, one by one */
+        h2_close(req);
+    } else if (req->kacount < ka_max &&
         !req->logline &&
         req->client_stream_pos == 0) {
         /* A keepalive request wherein we've read
@@ -340,7 +355,19 @@ static void free_request(request * req)
          */
         ;
     } else {
-        log_access(req);
+        if (req->response_status < MAX_STATUS_CODE)
+            status.responses[req->response_status]++;
+        status.bytes_sent += req->bytes_written;
+        latency_record(req);
+        BOA_PROBE4(request_free, req, req->response_status,
+                   req->bytes_written, (req->time_start ?
+                                        current_usec - req->time_start : 0));
+        if (slow_request_threshold && req->time_start &&
+            current_usec - req->time_start >
+            (uint64_t) slow_request_threshold * 1000)
+            slow_log(req);
+        if (!req->no_log && log_rule_wanted(req))
+            log_access(req);
     }
 
     if (req->mmap_entry_var)
@@ -384,6 +411,11 @@ static void free_request(request * req)
     if (req->ranges)
         ranges_reset(req);
 
+    if (req->h2_id) {
+        enqueue(&request_free, req);
+        return;
+    }
+
     if (req->status < TIMED_OUT && (req->keepalive == KA_ACTIVE) &&
         (req->response_status < 500 && req->response_status != 0) && req->kacount > 0) {
         sanitize_request(req, 0);
@@ -459,6 +491,7 @@ void process_requests(int server_sock)
 {
     int retval = 0;
     request *current, *trailer;
+    enum REQ_STATUS was;
 
     if (pending_requests) {
         get_request(server_sock);
@@ -470,7 +503,8 @@ void process_requests(int server_sock)
     current = request_ready;
 
     while (current) {
-        time(&current_time);
+        update_clock();
+        was = current->status;
         retval = 1;             /* emulate "success" in case we don't have to flush */
 
         if (current->buffer_end && /* there is data in the buffer */
@@ -521,6 +555,9 @@ void process_requests(int server_sock)
                 retval = io_shuffle(current);
 #endif
                 break;
+            case HTTP2:
+                retval = h2_process(current);
+                break;
             case DONE:
                 /* a non-status that will terminate the request */
                 retval = req_flush(current);
@@ -550,6 +587,13 @@ void process_requests(int server_sock)
 
         }
 
+        if (current->status != was) {
+            BOA_PROBE3(state, current, was, current->status);
+            note_state(current, was);
+            if (slow_request_threshold)
+                slow_trace(current);
+        }
+
         if (sigterm_flag)
             SQUASH_KA(current);
 
@@ -564,6 +608,7 @@ void process_requests(int server_sock)
         case -1:               /* request blocked */
             trailer = current;
             current = current->next;
+            trailer->blocks++;
             block_request(trailer);
             break;
         case 0:                /* request complete */
@@ -618,7 +663,10 @@ int process_logline(request * req)
         req->method = M_HEAD;
     else if (!memcmp(req->logline, "POST ", 5))
         req->method = M_POST;
-    else {
+    else if (!strcmp(req->logline, "PRI * HTTP/2.0")) {
+        /* HTTP/2 connection preface, the client assumed we speak it */
+        return h2_preface(req);
+    } else {
         log_error_doc(req);
         fprintf(stderr, "malformed request: \"%s\"\n", req->logline);
         send_r_not_implemented(req);
@@ -716,7 +764,9 @@ int process_logline(request * req)
            well, we rock!
 
          */
-        req->header_host = host; /* this includes the port! (if any) */
+        /* this includes the port! (if any) */
+        req->headers[H_HOST].offset = host - req->client_stream;
+        req->headers[H_HOST].length = stop - host;
     } else {
         /* copy the URI */
         memcpy(req->request_uri, stop, stop2 - stop);
@@ -760,6 +810,9 @@ int process_logline(request * req)
                      * used if the expect header was sent.
                      */
                     /* send_r_continue(req); */
+                } else if (p1 == 2 && p2 == 0 && req->h2_id) {
+                    /* an HTTP/2 stream's, made up by h2.c */
+                    req->http_version = HTTP11;
                 } else {
                     goto BAD_VERSION;
                 }
@@ -786,14 +839,14 @@ int process_logline(request * req)
 }
 
 /*
- * Name: process_header_end
+ * Name: header_end
  *
  * Description: takes a request and performs some final checking before
  * init_cgi or init_get
  * Returns 0 for error or NPH, or 1 for success
  */
 
-int process_header_end(request * req)
+static int header_end(request * req)
 {
     if (!req->logline) {
         log_error_doc(req);
@@ -802,17 +855,17 @@ int process_header_end(request * req)
         return 0;
     }
 
-    /* Percent-decode request */
-    if (unescape_uri(req->request_uri, &(req->query_string)) == 0) {
+    if (http2 && h2_upgrade(req))
+        return 1;
+
+    /* Percent-decode and clean the request */
+    if (normalize_uri(req->request_uri, &(req->query_string)) == 0) {
         log_error_doc(req);
         fputs("URI contains bogus characters\n", stderr);
         send_r_bad_request(req);
         return 0;
     }
 
-    /* clean pathname */
-    clean_pathname(req->request_uri);
-
     if (req->request_uri[0] != '/') {
         log_error("URI does not begin with '/'\n");
         send_r_bad_request(req);
@@ -838,11 +891,11 @@ int process_header_end(request * req)
     }
 
     if (vhost_root) {
-        char *c;
-        if (!req->header_host) {
+        char *c, *host = req_header(req, H_HOST);
+        if (!host) {
             req->host = strdup(default_vhost);
         } else {
-            req->host = strdup(req->header_host);
+            req->host = strdup(host);
         }
         if (!req->host) {
             log_error_doc(req);
@@ -868,24 +921,138 @@ int process_header_end(request * req)
         }
     }
 
+#ifdef SERVER_TIMING
+    timing_check(req);
+#endif
+
+    if (status_uri && !strcmp(req->request_uri, status_uri))
+        return init_status(req);
+
+    timing_begin(req);
     if (translate_uri(req) == 0) { /* unescape, parse uri */
         /* errors already logged */
         SQUASH_KA(req);
         return 0;               /* failure, close down */
     }
+    timing_end(req, TIMING_TRANSLATE);
+    BOA_PROBE2(translate_done, req, req->pathname);
+
+#ifdef ACCESS_CONTROL
+    /* init_get does this for documents; scripts have to be refused
+     * here, before any request body is accepted for them
+     */
+    if (req->cgi_type && !access_allow(req->pathname)) {
+        send_r_forbidden(req);
+        return 0;
+    }
+#endif
 
     if (req->method == M_POST) {
-        req->post_data_fd = create_temporary_file(1, NULL, 0);
-        if (req->post_data_fd == 0) {
-            /* errors already logged */
-            send_r_error(req);
+        char *coding = req_header(req, H_TRANSFER_ENCODING);
+
+        /*
+
+           As quoted from RFC1945:
+
+           A valid Content-Length is required on all HTTP/1.0 POST requests. An
+           HTTP/1.0 server should respond with a 400 (bad request) message if it
+           cannot determine the length of the request message's content.
+
+         */
+
+        if (coding) {
+            if (strcasecmp(coding, "chunked")) {
+                log_error_doc(req);
+                fprintf(stderr,
+                        "Unsupported Transfer-Encoding [%s] on POST!\n",
+                        coding);
+                send_r_not_implemented(req);
+                return 0;
+            }
+            /* both at once is a classic request smuggling trick */
+            if (req_header(req, H_CONTENT_LENGTH) ||
+                req->http_version != HTTP11) {
+                log_error_doc(req);
+                fputs("Chunked POST with Content-Length or before HTTP/1.1!\n",
+                      stderr);
+                send_r_bad_request(req);
+                return 0;
+            }
+            /* filesize grows with every chunk, see decode_chunked */
+            req->chunked_body = 1;
+            req->filesize = 0;
+            req->filepos = 0;
+        } else if (req_header(req, H_CONTENT_LENGTH)) {
+            off_t content_length;
+
+            content_length = boa_atoi(req_header(req, H_CONTENT_LENGTH));
+            /* Is a content-length of 0 legal? */
+            if (content_length < 0) {
+                log_error_doc(req);
+                fprintf(stderr,
+                        "Invalid Content-Length [%s] on POST!\n",
+                        req_header(req, H_CONTENT_LENGTH));
+                send_r_bad_request(req);
+                return 0;
+            }
+            if (single_post_limit
+                && content_length > single_post_limit) {
+                log_error_doc(req);
+                fprintf(stderr,
+                        "Content-Length [" PRINTF_OFF_T_ARG "] > SinglePostLimit [%d] on POST!\n",
+                        content_length, single_post_limit);
+                send_r_bad_request(req);
+                return 0;
+            }
+            req->filesize = content_length;
+            req->filepos = 0;
+        } else {
+            log_error_doc(req);
+            fprintf(stderr, "Unknown Content-Length POST!\n");
+            send_r_bad_request(req);
             return 0;
         }
-        if (fcntl(req->post_data_fd, F_SETFD, 1) == -1) {
-            boa_perror(req, "unable to set close-on-exec for req->post_data_fd!");
-            close(req->post_data_fd);
-            req->post_data_fd = 0;
-            return 0;
+
+        /* StreamScriptAlias: start the CGI now, the body follows
+         * through its stdin pipe (see init_cgi and write_body)
+         */
+        if (req->stream_body) {
+            if (init_cgi(req) == 0)
+                return 0;
+        } else {
+            req->post_data_fd =
+                create_spool_file(req->chunked_body ? -1 : req->filesize);
+            if (req->post_data_fd == 0) {
+                /* errors already logged */
+                send_r_error(req);
+                return 0;
+            }
+            if (fcntl(req->post_data_fd, F_SETFD, 1) == -1) {
+                boa_perror(req, "unable to set close-on-exec for req->post_data_fd!");
+                close(req->post_data_fd);
+                req->post_data_fd = 0;
+                return 0;
+            }
+        }
+
+        /* Everything that could refuse this upload has had its say
+         * (the URI, the script, Allow/Deny, SinglePostLimit), so a
+         * client waiting on "Expect: 100-continue" may go ahead.
+         */
+        if (req->expect_continue && req->http_version == HTTP11) {
+            int ret;
+
+            send_r_continue(req);
+            ret = req_flush(req);
+            if (ret != 0) {
+                /* -2 is already logged; a fresh socket can't be full */
+                if (ret != -2) {
+                    log_error_doc(req);
+                    fputs("unable to send 100 Continue\n", stderr);
+                }
+                return 0;
+            }
+            req->response_status = 0; /* interim, don't log it */
         }
         return 1;             /* success */
     }
@@ -899,18 +1066,193 @@ int process_header_end(request * req)
     return init_get(req);       /* get and head */
 }
 
+/*
+ * Name: process_header_end
+ *
+ * Description: header_end, timed for the latency histograms: when the
+ * header was complete, and how long init_get or init_cgi took.
+ */
+
+int process_header_end(request * req)
+{
+    int retval;
+
+    req->time_header = current_usec;
+    BOA_PROBE3(header_done, req, req->method,
+               (const char *) req->request_uri);
+    retval = header_end(req);
+    update_clock();
+    req->time_init = current_usec - req->time_header;
+    return retval;
+}
+
+/*
+ * The headers we act on, looked up by a perfect hash of the first and
+ * last letters and the length of the name.  Every name has its own
+ * slot; if you add one, check that it still does (and pick another
+ * multiplier if not).  "cgi" says which of its lines a CGI still gets
+ * as HTTP_ variables: ENV_ALL of them, ENV_NONE, or ENV_REPEATS, all
+ * but the one Boa acted on (complete_env passes that one under its own
+ * name).  Repeats went to CGIs before the index existed, so they still
+ * do.
+ */
+
+#define HEADER_HASH(name, len) \
+    ((((name)[0] | 0x20) + ((name)[(len) - 1] | 0x20) * 15 + (len)) & 31)
+
+static const struct {
+    const char *name;
+    unsigned int len;
+    enum HEADER id;
+    enum { ENV_NONE, ENV_ALL, ENV_REPEATS } cgi;
+} known_headers[32] = {
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 0 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 1 */
+    {"Range", 5, H_RANGE, ENV_ALL},                             /* 2 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 3 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 4 */
+    {"If-Modified-Since", 17, H_IF_MODIFIED_SINCE, ENV_REPEATS},/* 5 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 6 */
+    {"Referer", 7, H_REFERER, ENV_ALL},                         /* 7 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 8 */
+    {"Content-Length", 14, H_CONTENT_LENGTH, ENV_REPEATS},      /* 9 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 10 */
+    {"User-Agent", 10, H_USER_AGENT, ENV_ALL},                  /* 11 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 12 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 13 */
+    {"Transfer-Encoding", 17, H_TRANSFER_ENCODING, ENV_NONE},   /* 14 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 15 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 16 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 17 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 18 */
+    {"Accept", 6, H_ACCEPT, ENV_NONE},                          /* 19 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 20 */
+    {"X-Forwarded-For", 15, H_X_FORWARDED_FOR, ENV_NONE},       /* 21 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 22 */
+    {"Expect", 6, H_EXPECT, ENV_ALL},                           /* 23 */
+    {"Host", 4, H_HOST, ENV_REPEATS},                           /* 24 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 25 */
+    {"Content-Type", 12, H_CONTENT_TYPE, ENV_REPEATS},          /* 26 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 27 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 28 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 29 */
+    {NULL, 0, H_COUNT, ENV_NONE},                               /* 30 */
+    {"Connection", 10, H_CONNECTION, ENV_NONE},                 /* 31 */
+};
+
+/*
+ * Name: header_lookup
+ * Description: Returns the slot of a known header name (which is not
+ * NUL-terminated and may be in any case), or -1.
+ */
+
+static int header_lookup(const char *name, unsigned int len)
+{
+    int h;
+
+    if (len == 0)
+        return -1;
+    h = HEADER_HASH(name, len);
+    if (known_headers[h].len != len ||
+        strncasecmp(name, known_headers[h].name, len))
+        return -1;
+    return h;
+}
+
+/*
+ * Every header line goes into req->header_fields, in order, and
+ * req->header_index finds the first with a given name (any case) by
+ * open addressing; the rest with that name are chained with "next".
+ */
+
+static unsigned int header_name_hash(const char *name, unsigned int len)
+{
+    unsigned int hash = 2166136261U;
+
+    while (len--)
+        hash = (hash ^ (*name++ | 0x20)) * 16777619U;
+    return hash & (HEADER_INDEX_SIZE - 1);
+}
+
+static int same_header_name(request * req, struct header_field *field,
+                            const char *name, unsigned int len)
+{
+    return field->name.length == len &&
+        !strncasecmp(req->client_stream + field->name.offset, name, len);
+}
+
+static int index_header(request * req, const char *name, unsigned int len,
+                        const char *value)
+{
+    struct header_field *field, *other;
+    unsigned int i;
+
+    if (req->header_count == MAX_HEADER_FIELDS) {
+        log_error_doc(req);
+        fprintf(stderr, "more than %d header lines\n", MAX_HEADER_FIELDS);
+        send_r_bad_request(req);
+        return 0;
+    }
+    field = &req->header_fields[req->header_count++];
+    field->name.offset = name - req->client_stream;
+    field->name.length = len;
+    field->value.offset = value - req->client_stream;
+    field->value.length = req->header_end - value;
+    field->next = 0;
+
+    for (i = header_name_hash(name, len); req->header_index[i];
+         i = (i + 1) & (HEADER_INDEX_SIZE - 1)) {
+        other = &req->header_fields[req->header_index[i] - 1];
+        if (same_header_name(req, other, name, len)) {
+            while (other->next)
+                other = &req->header_fields[other->next - 1];
+            other->next = req->header_count;
+            return 1;
+        }
+    }
+    req->header_index[i] = req->header_count;
+    return 1;
+}
+
+/*
+ * Name: find_header
+ *
+ * Description: Finds the first header line called name (len bytes,
+ * any case), known to Boa or not.  Its value is NUL-terminated, see
+ * header_value(); any further lines with the same name follow from
+ * its "next".
+ * Returns: the field, or NULL if the client didn't send one.
+ */
+
+struct header_field *find_header(request * req, const char *name,
+                                 unsigned int len)
+{
+    struct header_field *field;
+    unsigned int i;
+
+    for (i = header_name_hash(name, len); req->header_index[i];
+         i = (i + 1) & (HEADER_INDEX_SIZE - 1)) {
+        field = &req->header_fields[req->header_index[i] - 1];
+        if (same_header_name(req, field, name, len))
+            return field;
+    }
+    return NULL;
+}
+
 /*
  * Name: process_option_line
  *
- * Description: Parses the contents of req->header_line and takes
- * appropriate action.
+ * Description: Parses the contents of req->header_line, adds it to
+ * the header index and takes appropriate action.  The line is left as
+ * it is, a CGI gets it from the index in add_header_env.
  */
 
 int process_option_line(request * req)
 {
     char c, *value, *line = req->header_line;
-
-    /* Start by aggressively hacking the in-place copy of the header line */
+    struct slice *slice;
+    unsigned int len;
+    int h;
 
 #ifdef FASCIST_LOGGING
     log_error_time();
@@ -923,10 +1265,11 @@ int process_option_line(request * req)
         fprintf(stderr, "header \"%s\" does not contain ':'\n", line);
         return 0;
     }
-    *value++ = '\0';            /* overwrite the : */
-    to_upper(line);             /* header types are case-insensitive */
+
+    len = value - line;
 
     /* the code below *does* catch '\0' due to the c = *value test */
+    value++;                    /* skip the : */
     while ((c = *value) && (c == ' ' || c == '\t'))
         value++;
 
@@ -936,87 +1279,96 @@ int process_option_line(request * req)
         return 1;
     }
 
-    switch (line[0]) {
-    case 'A':
-        if (!memcmp(line, "ACCEPT", 7)) {
+    if (!index_header(req, line, len, value))
+        return 0;
+
+    h = header_lookup(line, len);
+    if (h < 0)
+        return 1;               /* only interesting to CGIs */
+
+    slice = &req->headers[known_headers[h].id];
+    switch (known_headers[h].id) {
+    case H_ACCEPT:
 #ifdef ACCEPT_ON
-            add_accept_header(req, value);
+        add_accept_header(req, value);
 #endif
-            return 1;
-        }
-        break;
-    case 'C':
-        if (!memcmp(line, "CONTENT_TYPE", 13) && !req->content_type) {
-            req->content_type = value;
-            return 1;
-        } else if (!memcmp(line, "CONTENT_LENGTH", 15)
-                   && !req->content_length) {
-            req->content_length = value;
-            return 1;
-        } else if (!memcmp(line, "CONNECTION", 11) &&
-                   ka_max && req->keepalive != KA_STOPPED) {
+        return 1;
+    case H_CONNECTION:
+        if (ka_max && req->keepalive != KA_STOPPED)
             req->keepalive = (!strncasecmp(value, "Keep-Alive", 10) ?
                               KA_ACTIVE : KA_STOPPED);
+        return 1;
+    case H_EXPECT:
+        if (!strcasecmp(value, "100-continue"))
+            req->expect_continue = 1;
+        return 1;
+    case H_RANGE:
+        if (req->ranges && req->ranges->stop == INT_MAX) {
+            /* there was an error parsing, ignore */
             return 1;
-        }
-        break;
-    case 'H':
-        if (!memcmp(line, "HOST", 5) && !req->header_host) {
-            req->header_host = value; /* may be complete garbage! */
-            return 1;
-        }
-        break;
-    case 'I':
-        if (!memcmp(line, "IF_MODIFIED_SINCE", 18)
-            && !req->if_modified_since) {
-            req->if_modified_since = value;
-            return 1;
-        }
-        break;
-    case 'R':
-        /* Need agent and referer for logs */
-        if (!memcmp(line, "REFERER", 8)) {
-            req->header_referer = value;
-            if (!add_cgi_env(req, "REFERER", value, 1)) {
-                /* errors already logged */
-                return 0;
-            }
-        } else if (!memcmp(line, "RANGE", 6)) {
-            if (req->ranges && req->ranges->stop == INT_MAX) {
-                /* there was an error parsing, ignore */
-                return 1;
-            } else if (!range_parse(req, value)) {
-                /* unable to parse range */
-                send_r_invalid_range(req);
-                return 0;
-            }                   /* req->ranges */
-        }
-        break;
-    case 'U':
-        if (!memcmp(line, "USER_AGENT", 11)) {
-            req->header_user_agent = value;
-            if (!add_cgi_env(req, "USER_AGENT", value, 1)) {
-                /* errors already logged */
-                return 0;
-            }
-            return 1;
-        }
-        break;
-    case 'X':
-        if (!memcmp(line, "X_FORWARDED_FOR", 16)) {
-            /* Note that pound(8) simply inserts a new header instead
-               of appending the source IP to an existing header.  Thus
-               taking the last header should give us the appropriate
-               address for logging.  */
-            req->header_forwarded_for = value;
+        } else if (!range_parse(req, value)) {
+            /* unable to parse range */
+            send_r_invalid_range(req);
+            return 0;
+        }                       /* req->ranges */
+        return 1;
+    case H_CONTENT_TYPE:
+    case H_CONTENT_LENGTH:
+    case H_HOST:               /* may be complete garbage! */
+    case H_IF_MODIFIED_SINCE:
+        /* the first one counts */
+        if (slice->length)
             return 1;
-        }
         break;
-    default:                   /* no default */
+    default:
+        /* Note that pound(8) simply inserts a new X-Forwarded-For
+           instead of appending the source IP to an existing header.
+           Thus taking the last header should give us the appropriate
+           address for logging.  Transfer-Encoding is removed, so the
+           CGI must not see it.  */
         break;
-    }                           /* switch */
+    }
 
-    return add_cgi_env(req, line, value, 1);
+    slice->offset = value - req->client_stream;
+    slice->length = req->header_end - value;
+    return 1;
+}
+
+/*
+ * Name: add_header_env
+ *
+ * Description: Adds the request headers to the environment of a CGI,
+ * as HTTP_ variables.  Only called once we know there is a CGI, so
+ * plain requests never pay for it.
+ */
+
+int add_header_env(request * req)
+{
+    char name[MAX_HEADER_LENGTH + 1];
+    const char *line;
+    struct header_field *field;
+    unsigned int i, len;
+    int h;
+
+    for (field = req->header_fields;
+         field < req->header_fields + req->header_count; ++field) {
+        line = req->client_stream + field->name.offset;
+        len = field->name.length;
+        h = header_lookup(line, len);
+        if (h >= 0 && (known_headers[h].cgi == ENV_NONE ||
+                       (known_headers[h].cgi == ENV_REPEATS &&
+                        field->value.offset ==
+                        req->headers[known_headers[h].id].offset)))
+            continue;
+
+        for (i = 0; i < len; ++i)
+            name[i] = (line[i] == '-' ? '_' :
+                       toupper((unsigned char) line[i]));
+        name[len] = '\0';
+        if (!add_cgi_env(req, name, header_value(req, field), 1))
+            return 0;           /* errors already logged */
+    }
+    return 1;
 }
 
 #ifdef ACCEPT_ON
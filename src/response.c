@@ -46,20 +46,11 @@ const char *http_ver_string(enum HTTP_VERSION ver)
 
 void print_content_type(request * req)
 {
-    char * mime_type = get_mime_type(req->request_uri);
+    unsigned int len;
+    const char *line = get_content_type(req->request_uri, &len);
 
-    if (mime_type != NULL) {
-        req_write(req, "Content-Type: ");
-        req_write(req, mime_type);
-        if (default_charset != NULL &&
-            strncasecmp( mime_type, "text", 4)==0) {
-
-            /* add default charset */
-            req_write( req, "; charset=");
-            req_write( req, default_charset);
-        }
-        req_write(req, CRLF);
-    }
+    /* the whole line, charset and all, is made by build_mime_table */
+    req_write_len(req, line, len);
 }
 
 void print_content_length(request * req)
@@ -109,6 +100,10 @@ void print_http_headers(request * req)
        req_write(req, CRLF);
     }
     req_write(req, "Accept-Ranges: bytes" CRLF);
+#ifdef SERVER_TIMING
+    if (req->server_timing)
+        print_server_timing(req);
+#endif
     print_ka_phrase(req);
 }
 
@@ -633,3 +628,28 @@ void send_r_bad_version(request * req, const char *version)
     }
     req_flush(req);
 }
+
+/*
+ * Clients that open with the HTTP/2 preface (prior knowledge, RFC 7540
+ * section 3.4) when HTTP2 is off (see h2_preface) get the server
+ * preface, an empty SETTINGS frame, followed by
+ * GOAWAY(HTTP_1_1_REQUIRED).  That's the HTTP/2 way of
+ * saying "ask me again in HTTP/1.1", see RFC 7540 section 7.
+ * Logged as a 505.
+ */
+void send_r_http2_required(request * req)
+{
+    static const char frames[] = {
+        0, 0, 0, 0x4, 0, 0, 0, 0, 0, /* SETTINGS, no parameters */
+        0, 0, 8, 0x7, 0, 0, 0, 0, 0, /* GOAWAY on stream 0, */
+        0, 0, 0, 0,             /* last stream id 0, */
+        0, 0, 0, 0xd            /* HTTP_1_1_REQUIRED */
+    };
+
+    SQUASH_KA(req);
+    req->response_status = R_BAD_VERSION;
+    /* req_write stops at NUL; nothing else is buffered yet */
+    memcpy(req->buffer + req->buffer_end, frames, sizeof frames);
+    req->buffer_end += sizeof frames;
+    req_flush(req);
+}
@@ -0,0 +1,716 @@
+/*
+ *  Boa, an http server
+ *  Copyright (C) 1995 Paul Phillips <paulp@go2net.com>
+ *  Copyright (C) 1996-2005 Larry Doolittle <ldoolitt@boa.org>
+ *  Copyright (C) 1997-2004 Jon Nelson <jnelson@boa.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 1, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* $Id$ */
+
+/*
+ * Header and request-URI scanning.
+ *
+ * Almost every byte of a request header is "ordinary": printable
+ * US-ASCII or a tab.  The read_header state machine only has work to
+ * do at CR, LF and illegal (control or 8-bit) bytes, so scan_header
+ * skips over runs of ordinary bytes 16 (SSE2) or 32 (AVX2) at a time.
+ *
+ * Likewise most request URIs have no '%', no query string and no
+ * "//", "/./" or "/../" in them, so normalize_uri first looks for the
+ * first byte that needs any work and starts decoding and cleaning
+ * from there, in one pass.
+ *
+ * The variants are picked on first use from what the CPU supports;
+ * any other architecture or compiler gets the plain C loops.
+ *
+ * Build the benchmark with
+ *   gcc -O2 -DSTANDALONE_TEST -I<builddir>/src -Isrc src/scan.c
+ * and run it with one or more files of raw request headers, or with
+ * -u and files of URIs (one per line, or access_log lines).  -u also
+ * checks normalize_uri against unescape_uri + clean_pathname on a
+ * few million random URIs first.
+ */
+
+#include "boa.h"
+
+#if defined(__GNUC__) && BOA_GCC_VERSION >= 40900 && \
+    (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+/* an ordinary byte is a tab or 32..127, just like read_header says */
+#define ORDINARY(c) ((c) == '\t' || ((c) >= 32 && (c) <= 127))
+
+static const char *scan_header_c(const char *p, const char *end)
+{
+    while (p < end && ORDINARY((unsigned char) *p))
+        ++p;
+    return p;
+}
+
+#ifdef SCAN_X86
+/* As signed chars, 32..127 is "greater than 31", and 128..255 is not. */
+
+__attribute__ ((target("sse2")))
+static const char *scan_header_sse2(const char *p, const char *end)
+{
+    const __m128i space = _mm_set1_epi8(31);
+    const __m128i tab = _mm_set1_epi8('\t');
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        unsigned int ok = _mm_movemask_epi8(_mm_or_si128
+                                            (_mm_cmpgt_epi8(v, space),
+                                             _mm_cmpeq_epi8(v, tab)));
+        if (ok != 0xffff)
+            return p + __builtin_ctz(~ok);
+        p += 16;
+    }
+    return scan_header_c(p, end);
+}
+
+__attribute__ ((target("avx2")))
+static const char *scan_header_avx2(const char *p, const char *end)
+{
+    const __m256i space = _mm256_set1_epi8(31);
+    const __m256i tab = _mm256_set1_epi8('\t');
+
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        unsigned int ok = _mm256_movemask_epi8(_mm256_or_si256
+                                               (_mm256_cmpgt_epi8(v, space),
+                                                _mm256_cmpeq_epi8(v, tab)));
+        if (ok != 0xffffffffU)
+            return p + __builtin_ctz(~ok);
+        p += 32;
+    }
+    return scan_header_sse2(p, end);
+}
+#endif
+
+/*
+ * The first byte of uri that normalize_uri can't leave as it is:
+ * '%', '?', '#', a '/' followed by '/' or '.', or the terminating NUL.
+ */
+
+#define URI_SPECIAL(c) ((c) == '%' || (c) == '?' || (c) == '#' || !(c))
+
+static const char *scan_uri_c(const char *uri)
+{
+    const char *p = uri;
+
+    while (!URI_SPECIAL(*p) &&
+           !(*p == '/' && (p[1] == '/' || p[1] == '.')))
+        ++p;
+    return p;
+}
+
+#ifdef SCAN_X86
+/*
+ * The string's length isn't known, so these only do aligned loads,
+ * which can't run into the next page; bits for the bytes before uri
+ * in the first block are masked off.  "'/' then '/' or '.'" may span
+ * two blocks, hence the carry.
+ */
+
+__attribute__ ((target("sse2")))
+static const char *scan_uri_sse2(const char *uri)
+{
+    const char *p = (const char *) ((unsigned long) uri & ~15UL);
+    unsigned int skip = ~0U << (uri - p), carry = 0;
+    unsigned int slash, next, hit;
+
+    while (1) {
+        __m128i v = _mm_load_si128((const __m128i *) p);
+        __m128i s = _mm_cmpeq_epi8(v, _mm_set1_epi8('/'));
+
+        slash = _mm_movemask_epi8(s) & skip;
+        next = _mm_movemask_epi8(_mm_or_si128
+                                 (s, _mm_cmpeq_epi8(v, _mm_set1_epi8('.'))));
+        hit = _mm_movemask_epi8(_mm_or_si128
+                                (_mm_or_si128
+                                 (_mm_cmpeq_epi8(v, _mm_setzero_si128()),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('%'))),
+                                 _mm_or_si128
+                                 (_mm_cmpeq_epi8(v, _mm_set1_epi8('?')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('#')))));
+        if (carry && (next & 1))
+            return p - 1;
+        hit = (hit & skip) | (slash & (next >> 1));
+        if (hit)
+            return p + __builtin_ctz(hit);
+        carry = slash >> 15;
+        skip = ~0U;
+        p += 16;
+    }
+}
+
+__attribute__ ((target("avx2")))
+static const char *scan_uri_avx2(const char *uri)
+{
+    const char *p = (const char *) ((unsigned long) uri & ~31UL);
+    unsigned int skip = ~0U << (uri - p), carry = 0;
+    unsigned int slash, next, hit;
+
+    while (1) {
+        __m256i v = _mm256_load_si256((const __m256i *) p);
+        __m256i s = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/'));
+
+        slash = _mm256_movemask_epi8(s) & skip;
+        next = _mm256_movemask_epi8(_mm256_or_si256
+                                    (s, _mm256_cmpeq_epi8
+                                     (v, _mm256_set1_epi8('.'))));
+        hit = _mm256_movemask_epi8(_mm256_or_si256
+                                   (_mm256_or_si256
+                                    (_mm256_cmpeq_epi8
+                                     (v, _mm256_setzero_si256()),
+                                     _mm256_cmpeq_epi8
+                                     (v, _mm256_set1_epi8('%'))),
+                                    _mm256_or_si256
+                                    (_mm256_cmpeq_epi8
+                                     (v, _mm256_set1_epi8('?')),
+                                     _mm256_cmpeq_epi8
+                                     (v, _mm256_set1_epi8('#')))));
+        if (carry && (next & 1))
+            return p - 1;
+        hit = (hit & skip) | (slash & (next >> 1));
+        if (hit)
+            return p + __builtin_ctz(hit);
+        carry = slash >> 31;
+        skip = ~0U;
+        p += 32;
+    }
+}
+#endif
+
+static void scan_init(void);
+
+static const char *scan_header_init(const char *p, const char *end)
+{
+    scan_init();
+    return scan_header(p, end);
+}
+
+static const char *scan_uri_init(const char *uri)
+{
+    scan_init();
+    return scan_uri(uri);
+}
+
+static const char *(*scan_header_fn) (const char *, const char *) =
+    scan_header_init;
+static const char *(*scan_uri_fn) (const char *) = scan_uri_init;
+
+static void scan_init(void)
+{
+    scan_header_fn = scan_header_c;
+    scan_uri_fn = scan_uri_c;
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scan_header_fn = scan_header_avx2;
+        scan_uri_fn = scan_uri_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        scan_header_fn = scan_header_sse2;
+        scan_uri_fn = scan_uri_sse2;
+    }
+#endif
+}
+
+/*
+ * Name: scan_header
+ * Description: Returns the first byte in [p, end) that is not an
+ * ordinary header byte (CR, LF, a control character other than tab,
+ * or anything above 127), or end if there is none.
+ */
+
+const char *scan_header(const char *p, const char *end)
+{
+    return scan_header_fn(p, end);
+}
+
+/*
+ * Name: scan_uri
+ * Description: Returns the first byte of uri that normalize_uri has
+ * to look at, or the terminating NUL if the URI is fine as it is.
+ */
+
+const char *scan_uri(const char *uri)
+{
+    return scan_uri_fn(uri);
+}
+
+/*
+ * Name: normalize_uri
+ *
+ * Description: Does what unescape_uri followed by clean_pathname
+ * does, in one pass: decodes %xx, splits off the query string (and
+ * drops any fragment), and replaces "//", "/./" and "/../" after a
+ * '/' with just the '/'.  The result is the same byte for byte,
+ * quirks included: a decoded NUL ends the path, but the query string
+ * is still looked for after it.
+ *
+ * Return values:
+ *  1: success
+ *  0: illegal string (a '%' without two characters after it)
+ */
+
+int normalize_uri(char *uri, char **query_string)
+{
+    char *in, *out, c, d;
+    int dots;                   /* -1: not after a '/'; else dots seen */
+    int done = 0;               /* a decoded NUL ended the path */
+
+    in = out = (char *) scan_uri(uri);
+    if (!*in)
+        return 1;
+    dots = (in > uri && in[-1] == '/' ? 0 : -1);
+
+    while ((c = *in)) {
+        if (c == '%') {
+            if ((c = in[1]) && (d = in[2])) {
+                c = HEX_TO_DECIMAL(c, d);
+                in += 3;
+            } else {
+                *out = '\0';
+                return 0;
+            }
+        } else if (c == '?') {
+            if (query_string)
+                *query_string = in + 1;
+            break;
+        } else if (c == '#') {
+            if (query_string) {
+                while (*++in) {
+                    if (*in == '?') {
+                        *query_string = in + 1;
+                        break;
+                    }
+                }
+            }
+            break;
+        } else {
+            ++in;
+        }
+
+        if (done)
+            continue;
+        if (!c) {
+            done = 1;
+            continue;
+        }
+        /* clean_pathname, a byte at a time */
+        if (dots == 0) {
+            if (c == '/')
+                continue;
+            if (c == '.') {
+                dots = 1;
+                continue;
+            }
+        } else if (dots == 1) {
+            if (c == '/') {
+                dots = 0;
+                continue;
+            }
+            if (c == '.') {
+                dots = 2;
+                continue;
+            }
+            *out++ = '.';
+        } else if (dots == 2) {
+            if (c == '/') {
+                dots = 0;
+                continue;
+            }
+            *out++ = '.';
+            *out++ = '.';
+        }
+        *out++ = c;
+        dots = (c == '/' ? 0 : -1);
+    }
+
+    while (dots-- > 0)
+        *out++ = '.';
+    *out = '\0';
+    return 1;
+}
+
+#ifdef STANDALONE_TEST
+#include <sys/time.h>
+
+/* the per-byte part of read_header, as it was before scan_header */
+static int state_machine(const char *buf, int len)
+{
+    int status = READ_HEADER, lines = 0, i;
+    unsigned char uc;
+
+    for (i = 0; i < len; i++) {
+        uc = buf[i];
+        if (uc != '\r' && uc != '\n' && uc != '\t' &&
+            (uc < 32 || uc > 127))
+            return -1;
+        switch (status) {
+        case READ_HEADER:
+            if (uc == '\r')
+                status = ONE_CR;
+            else if (uc == '\n')
+                status = ONE_LF;
+            break;
+        case ONE_CR:
+            if (uc == '\n')
+                status = ONE_LF;
+            else if (uc != '\r')
+                status = READ_HEADER;
+            break;
+        case ONE_LF:
+            status = (uc == '\r' ? TWO_CR : uc == '\n' ? BODY_READ :
+                      READ_HEADER);
+            break;
+        case TWO_CR:
+            if (uc == '\n')
+                status = BODY_READ;
+            else if (uc != '\r')
+                status = READ_HEADER;
+            break;
+        default:
+            break;
+        }
+        if (status == ONE_LF)
+            lines++;
+    }
+    return lines;
+}
+
+/* the same, skipping ordinary runs with fn first */
+static int skipping_state_machine(const char *(*fn) (const char *,
+                                                      const char *),
+                                  const char *buf, int len)
+{
+    int status = READ_HEADER, lines = 0;
+    const char *p = buf, *end = buf + len;
+    unsigned char uc;
+
+    while (p < end) {
+        if (status == READ_HEADER) {
+            p = fn(p, end);
+            if (p == end)
+                break;
+        }
+        uc = *p++;
+        if (uc != '\r' && uc != '\n' && uc != '\t' &&
+            (uc < 32 || uc > 127))
+            return -1;
+        switch (status) {
+        case READ_HEADER:
+            if (uc == '\r')
+                status = ONE_CR;
+            else if (uc == '\n')
+                status = ONE_LF;
+            break;
+        case ONE_CR:
+            if (uc == '\n')
+                status = ONE_LF;
+            else if (uc != '\r')
+                status = READ_HEADER;
+            break;
+        case ONE_LF:
+            status = (uc == '\r' ? TWO_CR : uc == '\n' ? BODY_READ :
+                      READ_HEADER);
+            break;
+        case TWO_CR:
+            if (uc == '\n')
+                status = BODY_READ;
+            else if (uc != '\r')
+                status = READ_HEADER;
+            break;
+        default:
+            break;
+        }
+        if (status == ONE_LF)
+            lines++;
+    }
+    return lines;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int bench_headers(int argc, char *argv[])
+{
+    static char buf[CLIENT_STREAM_SIZE];
+    const struct {
+        const char *name;
+        const char *(*fn) (const char *, const char *);
+    } *v, variants[] = {
+        {"c", scan_header_c},
+#ifdef SCAN_X86
+        {"sse2", scan_header_sse2},
+        {"avx2", scan_header_avx2},
+#endif
+        {NULL, NULL}
+    };
+    int i, j, len, iterations = 200000, expect;
+    volatile int sink = 0;
+    double t;
+    FILE *f;
+
+    for (i = 0; i < argc; i++) {
+        f = fopen(argv[i], "r");
+        if (!f) {
+            perror(argv[i]);
+            return 1;
+        }
+        len = fread(buf, 1, sizeof buf, f);
+        fclose(f);
+
+        expect = state_machine(buf, len);
+        printf("%s: %d bytes, %d lines\n", argv[i], len, expect);
+
+        t = now();
+        for (j = 0; j < iterations; j++)
+            sink += state_machine(buf, len);
+        t = now() - t;
+        printf("  %-14s %8.1f ns/header\n", "state machine",
+               t * 1e9 / iterations);
+
+        for (v = variants; v->name; v++) {
+#ifdef SCAN_X86
+            if (v->fn == scan_header_avx2 &&
+                !__builtin_cpu_supports("avx2"))
+                continue;
+#endif
+            if (skipping_state_machine(v->fn, buf, len) != expect) {
+                printf("  %s disagrees!\n", v->name);
+                return 1;
+            }
+            t = now();
+            for (j = 0; j < iterations; j++)
+                sink += skipping_state_machine(v->fn, buf, len);
+            t = now() - t;
+            printf("  %-14s %8.1f ns/header\n", v->name,
+                   t * 1e9 / iterations);
+        }
+    }
+    return 0;
+}
+
+/* unescape_uri and clean_pathname from util.c, for comparison */
+static int ref_unescape_uri(char *uri, char **query_string)
+{
+    char c, d;
+    char *uri_old;
+
+    uri_old = uri;
+
+    while ((c = *uri_old)) {
+        if (c == '%') {
+            uri_old++;
+            if ((c = *uri_old++) && (d = *uri_old++)) {
+                *uri = HEX_TO_DECIMAL(c, d);
+            } else {
+                *uri = '\0';
+                return 0;
+            }
+            ++uri;
+        } else if (c == '?') {
+            if (query_string)
+                *query_string = ++uri_old;
+            *uri = '\0';
+            return (1);
+        } else if (c == '#') {
+            if (query_string) {
+                ++uri_old;
+                while ((c = *uri_old)) {
+                    if (c == '?') {
+                        *query_string = ++uri_old;
+                        break;
+                    }
+                    ++uri_old;
+                }
+            }
+            break;
+        } else {
+            *uri++ = c;
+            uri_old++;
+        }
+    }
+
+    *uri = '\0';
+    return 1;
+}
+
+static void ref_clean_pathname(char *pathname)
+{
+    char *cleanpath, c;
+
+    cleanpath = pathname;
+    while ((c = *pathname++)) {
+        if (c == '/') {
+            while (1) {
+                if (*pathname == '/')
+                    pathname++;
+                else if (*pathname == '.' && *(pathname + 1) == '/')
+                    pathname += 2;
+                else if (*pathname == '.' && *(pathname + 1) == '.' &&
+                         *(pathname + 2) == '/') {
+                    pathname += 3;
+                } else
+                    break;
+            }
+            c = '/';
+        }
+        *cleanpath++ = c;
+    }
+
+    *cleanpath = '\0';
+}
+
+static int ref_normalize(char *uri, char **query_string)
+{
+    if (!ref_unescape_uri(uri, query_string))
+        return 0;
+    ref_clean_pathname(uri);
+    return 1;
+}
+
+/* random URIs made of the interesting bytes, at random alignments */
+static int fuzz_uris(int rounds)
+{
+    static const char alphabet[] = "//..%%?#a2F0fE";
+    char a[128], b[128], in[128], *qa, *qb;
+    int i, j, len, offset, ra, rb;
+
+    srandom(1);
+    for (i = 0; i < rounds; i++) {
+        offset = random() % 32;
+        len = random() % 64;
+        for (j = 0; j < len; j++)
+            a[offset + j] = alphabet[random() % (sizeof alphabet - 1)];
+        a[offset + len] = '\0';
+        memcpy(b, a, sizeof a);
+        memcpy(in, a, sizeof a);
+        qa = qb = NULL;
+        ra = ref_normalize(a + offset, &qa);
+        rb = normalize_uri(b + offset, &qb);
+        if (ra != rb || (qa ? qb - b != qa - a : qb != NULL) ||
+            (ra && strcmp(a + offset, b + offset))) {
+            printf("mismatch on input \"%s\": %d \"%s\" vs %d \"%s\"\n",
+                   in + offset, ra, a + offset, rb, b + offset);
+            return 1;
+        }
+        if (scan_uri_c(a + offset) != scan_uri(a + offset)
+#ifdef SCAN_X86
+            || scan_uri_c(a + offset) != scan_uri_sse2(a + offset)
+#endif
+            ) {
+            printf("scan_uri disagrees on \"%s\"\n", a + offset);
+            return 1;
+        }
+    }
+    printf("%d random URIs: normalize_uri agrees\n", rounds);
+    return 0;
+}
+
+static int bench_uris(int argc, char *argv[])
+{
+    static char line[4096], buf[4096];
+    char **uris = NULL, *p, *q, *qs;
+    int n = 0, alloc = 0, i, j, iterations, done;
+    volatile int sink = 0;
+    double t;
+    FILE *f;
+
+    if (fuzz_uris(2000000))
+        return 1;
+
+    for (i = 0; i < argc; i++) {
+        f = fopen(argv[i], "r");
+        if (!f) {
+            perror(argv[i]);
+            return 1;
+        }
+        while (fgets(line, sizeof line, f)) {
+            /* access_log: "GET /uri HTTP/1.1"; otherwise the whole line */
+            p = strchr(line, '"');
+            if (p && (p = strchr(p, ' ')) != NULL)
+                ++p;
+            else
+                p = line;
+            q = p + strcspn(p, " \r\n\"");
+            *q = '\0';
+            if (*p != '/')
+                continue;
+            if (n == alloc) {
+                alloc = alloc ? alloc * 2 : 1024;
+                uris = realloc(uris, alloc * sizeof (char *));
+            }
+            uris[n++] = strdup(p);
+        }
+        fclose(f);
+    }
+    if (!n) {
+        fprintf(stderr, "no URIs found\n");
+        return 1;
+    }
+    for (i = done = 0; i < n; i++) {
+        strcpy(buf, uris[i]);
+        if (*scan_uri(buf))
+            done++;
+    }
+    printf("%d URIs, %d need decoding or cleaning\n", n, done);
+
+    iterations = 20000000 / n + 1;
+    t = now();
+    for (j = 0; j < iterations; j++)
+        for (i = 0; i < n; i++) {
+            strcpy(buf, uris[i]);
+            sink += ref_normalize(buf, &qs);
+        }
+    t = now() - t;
+    printf("  %-24s %8.1f ns/uri\n", "unescape+clean_pathname",
+           t * 1e9 / iterations / n);
+
+    t = now();
+    for (j = 0; j < iterations; j++)
+        for (i = 0; i < n; i++) {
+            strcpy(buf, uris[i]);
+            sink += normalize_uri(buf, &qs);
+        }
+    t = now() - t;
+    printf("  %-24s %8.1f ns/uri\n", "normalize_uri",
+           t * 1e9 / iterations / n);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && !strcmp(argv[1], "-u"))
+        return bench_uris(argc - 2, argv + 2);
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s header-file [header-file ...]\n"
+                "       %s -u uri-file [uri-file ...]\n", argv[0], argv[0]);
+        return 1;
+    }
+    return bench_headers(argc - 1, argv + 1);
+}
+#endif
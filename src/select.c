@@ -51,6 +51,8 @@ void loop(int server_s)
     max_fd = -1;
 
     while (1) {
+        int timer;
+
         /* handle signals here */
         if (sighup_flag)
             sighup_run();
@@ -86,15 +88,20 @@ void loop(int server_s)
         pending_requests = 0;
         /* max_fd is > 0 when something is blocked */
 
+        timer = run_timers();
         if (max_fd) {
             struct timeval req_timeout; /* timeval for select */
 
             req_timeout.tv_sec = (request_ready ? 0 : default_timeout);
             req_timeout.tv_usec = 0l; /* reset timeout */
+            /* a timer (see run_timers) may be due sooner than that */
+            if (timer >= 0 && !request_ready &&
+                (!request_block || (unsigned) timer < default_timeout))
+                req_timeout.tv_sec = timer;
 
             if (select(max_fd + 1, BOA_READ,
                        BOA_WRITE, NULL,
-                       (request_ready || request_block ?
+                       (request_ready || request_block || timer >= 0 ?
                         &req_timeout : NULL)) == -1) {
                 /* what is the appropriate thing to do here on EBADF */
                 if (errno == EINTR)
@@ -110,7 +117,7 @@ void loop(int server_s)
             if (!sigterm_flag && FD_ISSET(server_s, BOA_READ)) {
                 pending_requests = 1;
             }
-            time(&current_time); /* for "new" requests if we've been in
+            update_clock(); /* for "new" requests if we've been in
             * select too long */
             /* if we skip this section (for example, if max_fd == 0),
              * then we aren't listening anyway, so we can't accept
@@ -164,12 +171,16 @@ static void fdset_update(void)
         if (current->kacount < ka_max && /* we *are* in a keepalive */
             (time_since >= ka_timeout) && /* ka timeout */
             !current->logline) { /* haven't read anything yet */
-            log_error_doc(current);
-            fputs("connection timed out\n", stderr);
+            errlog_doc(current, ERRLOG_TIMEOUT, 0);
+            current->status = TIMED_OUT; /* connection timed out */
+        } else if (current->status == HTTP2 && h2_idle(current) &&
+                   (sigterm_flag ||
+                    (ka_timeout && time_since >= ka_timeout))) {
+            /* an HTTP/2 connection with no streams open */
+            errlog_doc(current, ERRLOG_TIMEOUT, 0);
             current->status = TIMED_OUT; /* connection timed out */
         } else if (time_since > REQUEST_TIMEOUT) {
-            log_error_doc(current);
-            fputs("connection timed out\n", stderr);
+            errlog_doc(current, ERRLOG_TIMEOUT, 0);
             current->status = TIMED_OUT; /* connection timed out */
         }
         if (current->buffer_end && /* there is data to write */
@@ -197,6 +208,19 @@ static void fdset_update(void)
                     BOA_FD_SET(current, current->fd, BOA_WRITE);
                 }
                 break;
+            case HTTP2:
+                if (h2_writing(current)) {
+                    if (FD_ISSET(current->fd, BOA_WRITE))
+                        ready_request(current);
+                    else {
+                        BOA_FD_SET(current, current->fd, BOA_WRITE);
+                    }
+                } else if (FD_ISSET(current->fd, BOA_READ))
+                    ready_request(current);
+                else {
+                    BOA_FD_SET(current, current->fd, BOA_READ);
+                }
+                break;
             case BODY_WRITE:
                 if (FD_ISSET(current->post_data_fd, BOA_WRITE))
                     ready_request(current);
@@ -167,6 +167,7 @@ void sigterm_stage1_run(void)
 
 void sigterm_stage2_run(void)
 {                               /* lame duck mode */
+    errlog_flush();
     log_error_time();
     fprintf(stderr,
             "exiting Boa normally (uptime %d seconds)\n",
@@ -179,6 +180,7 @@ void sigterm_stage2_run(void)
     dump_alias();
     free_requests();
     range_pool_empty();
+    logring_stop();
     free(server_root);
     free(server_name);
     server_root = NULL;
@@ -210,7 +212,7 @@ void sighup_run(void)
     /* clear_common_env(); NEVER DO THIS */
     dump_mime();
     dump_passwd();
-    dump_alias();
+    /* the aliases are replaced by read_config_files */
     free_requests();
     range_pool_empty();
 
@@ -244,13 +246,17 @@ void sigchld_run(void)
 
     sigchld_flag = 0;
 
-    while ((pid = waitpid(-1, &child_status, WNOHANG)) > 0)
+    while ((pid = waitpid(-1, &child_status, WNOHANG)) > 0) {
+        BOA_PROBE2(cgi_exit, pid, child_status);
+        if (slow_request_threshold)
+            slow_reaped(pid, child_status);
         if (verbose_cgi_logs) {
             time(&current_time);
             log_error_time();
             fprintf(stderr, "reaping child %d: status %d\n", (int) pid,
                     child_status);
         }
+    }
     return;
 }
 
@@ -266,5 +272,40 @@ void sigalrm_run(void)
     fprintf(stderr, "%ld requests, %ld errors\n",
             status.requests, status.errors);
     hash_show_stats();
+    alias_show_stats();
+    ip_acl_show_stats();
+    log_rule_show_stats();
+    logring_show_stats();
+    errlog_show_stats();
+    latency_show_stats();
     sigalrm_flag = 0;
 }
+
+/*
+ * Name: run_timers
+ *
+ * Description: Does whatever the main loop has to do every so often:
+ * flushing the error log, and the StatsInterval dump (what SIGALRM
+ * logs).  Returns how many seconds the loop may sleep before calling
+ * it again, or -1 for as long as it likes.
+ */
+
+int run_timers(void)
+{
+    static time_t next_stats;
+    int wait, left;
+
+    wait = errlog_timeout();
+    if (stats_interval > 0) {
+        if (!next_stats)
+            next_stats = current_time + stats_interval;
+        if (current_time >= next_stats) {
+            sigalrm_run();
+            next_stats = current_time + stats_interval;
+        }
+        left = next_stats - current_time;
+        if (wait == -1 || left < wait)
+            wait = left;
+    }
+    return wait;
+}
@@ -0,0 +1,266 @@
+/*
+ *  Boa, an http server
+ *  Copyright (C) 1995 Paul Phillips <paulp@go2net.com>
+ *  Copyright (C) 1996-2005 Larry Doolittle <ldoolitt@boa.org>
+ *  Copyright (C) 1997-2004 Jon Nelson <jnelson@boa.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 1, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* $Id$ */
+
+/*
+ * SlowRequestThreshold / SlowRequestLog
+ *
+ * A request that takes longer than SlowRequestThreshold milliseconds
+ * gets one line in the slow request log, saying where the time went:
+ *
+ *   <error log prefix> 2301.512ms status 200 in 97 out 1048576
+ *   cache miss cgi - sendq 87380 trace: read_header@0.000 0.211ms
+ *   in 97 out 0 blocked 1, ioshuffle@0.211 2301.301ms in 0 out
+ *   1048576 blocked 41
+ *
+ * (one line).  Each step of the trace is a state the request was in,
+ * when it got there and how long it stayed, the bytes it read from the
+ * client and sent to it meanwhile, and how many times it had to wait
+ * for the socket (or pipe, or file).  A slow disk shows up as time in
+ * ioshuffle with few blocks, a slow client as many blocks and a full
+ * send queue.  For CGIs the pid is given, with its exit status if it
+ * has exited (it is left for sigchld_run to reap).
+ *
+ * While the threshold is set, process_requests calls slow_trace on
+ * each change of state, which copies four numbers into the request;
+ * only requests over the threshold are formatted and written.  Past
+ * SLOW_TRACE_STEPS steps, the last but one step takes in the extra ones.
+ */
+
+#include "boa.h"
+#include <stdarg.h>
+#include <sys/ioctl.h>          /* TIOCOUTQ */
+#include <sys/wait.h>           /* waitid */
+
+/* children reaped by sigchld_run, newest last */
+static struct {
+    pid_t pid;
+    int status;
+} reaped[SLOW_REAPED];
+static unsigned int reaped_next;
+
+static int slow_log_fd = -1;
+static char line[MAX_LOG_RECORD];
+static unsigned int line_len;
+
+static void line_printf(const char *fmt, ...)
+{
+    va_list ap;
+    int r;
+
+    if (line_len >= sizeof (line) - 1)
+        return;
+    va_start(ap, fmt);
+    r = vsnprintf(line + line_len, sizeof (line) - 1 - line_len, fmt, ap);
+    va_end(ap);
+    if (r < 0)
+        return;
+    line_len += ((unsigned) r < sizeof (line) - 1 - line_len ? (unsigned) r :
+                 sizeof (line) - 1 - line_len);
+}
+
+static void line_ms(uint64_t usec)
+{
+    line_printf("%lu.%03lu", (unsigned long) (usec / 1000),
+                (unsigned long) (usec % 1000));
+}
+
+/* the states read_header sits in are all one step */
+static enum REQ_STATUS trace_state(enum REQ_STATUS s)
+{
+    return (s <= TWO_CR ? READ_HEADER : s);
+}
+
+/*
+ * Name: open_slow_log
+ * Description: Opens SlowRequestLog, if there is one, from open_logs.
+ * Without one, slow requests go to the error log.
+ */
+
+void open_slow_log(void)
+{
+    if (!slow_log_name)
+        return;
+    slow_log_fd = open_gen_fd(slow_log_name);
+    if (slow_log_fd == -1) {
+        WARN("open slow_log");
+    } else if (fcntl(slow_log_fd, F_SETFD, 1) == -1) {
+        WARN("unable to set close-on-exec flag for slow_log");
+        close(slow_log_fd);
+        slow_log_fd = -1;
+    }
+}
+
+/*
+ * Name: slow_trace
+ * Description: Notes that req has gone into a new state.  Called from
+ * process_requests, only while SlowRequestThreshold is set.
+ */
+
+void slow_trace(request * req)
+{
+    struct slow_step *step;
+    enum REQ_STATUS s = trace_state(req->status);
+
+    if (s == (req->slow_steps ?
+              req->slow_trace[req->slow_steps - 1].status : READ_HEADER))
+        return;
+    if (req->slow_steps == SLOW_TRACE_STEPS) {
+        /* keep the latest step in the last slot */
+        req->slow_lost++;
+        step = &req->slow_trace[SLOW_TRACE_STEPS - 1];
+    } else {
+        step = &req->slow_trace[req->slow_steps++];
+    }
+    step->status = s;
+    step->at = current_usec;
+    step->bytes_in = req->bytes_in;
+    step->bytes_out = req->bytes_written;
+    step->blocks = req->blocks;
+}
+
+/*
+ * Name: slow_reaped
+ * Description: Remembers a child's exit status, for the slow request
+ * log.  Called from sigchld_run.
+ */
+
+void slow_reaped(pid_t pid, int child_status)
+{
+    reaped[reaped_next].pid = pid;
+    reaped[reaped_next].status = child_status;
+    reaped_next = (reaped_next + 1) % SLOW_REAPED;
+}
+
+static void line_cgi(pid_t pid)
+{
+    unsigned int i, j;
+    int child_status;
+    siginfo_t info;
+
+    for (i = 0; i < SLOW_REAPED; ++i) {
+        j = (reaped_next + SLOW_REAPED - 1 - i) % SLOW_REAPED;
+        if (reaped[j].pid == pid)
+            break;
+    }
+    if (i < SLOW_REAPED) {
+        child_status = reaped[j].status;
+    } else {
+        /* only look: sigchld_run still has to reap it, for its probe
+         * and verbose_cgi_logs, and so that the pid isn't reused first */
+        info.si_pid = 0;
+        if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == -1 ||
+            info.si_pid != pid) {
+            line_printf(" cgi %d running", (int) pid);
+            return;
+        }
+        if (info.si_code == CLD_EXITED) {
+            line_printf(" cgi %d exit %d", (int) pid, info.si_status);
+        } else if (info.si_code == CLD_KILLED || info.si_code == CLD_DUMPED) {
+            line_printf(" cgi %d signal %d", (int) pid, info.si_status);
+        } else {
+            line_printf(" cgi %d status %d", (int) pid, info.si_status);
+        }
+        return;
+    }
+    if (WIFEXITED(child_status))
+        line_printf(" cgi %d exit %d", (int) pid, WEXITSTATUS(child_status));
+    else if (WIFSIGNALED(child_status))
+        line_printf(" cgi %d signal %d", (int) pid, WTERMSIG(child_status));
+    else
+        line_printf(" cgi %d status %d", (int) pid, child_status);
+}
+
+static void line_step(request * req, const struct slow_step *step,
+                      const struct slow_step *next)
+{
+    line_printf("%s@", request_state_name(step->status));
+    line_ms(step->at - req->time_start);
+    line_printf(" ");
+    line_ms(next->at - step->at);
+    line_printf("ms in " PRINTF_OFF_T_ARG " out %lu blocked %u",
+                next->bytes_in - step->bytes_in,
+                (unsigned long) (next->bytes_out - step->bytes_out),
+                next->blocks - step->blocks);
+}
+
+/*
+ * Name: slow_log
+ * Description: Writes req's line to the slow request log.  Called from
+ * free_request for requests that took longer than SlowRequestThreshold.
+ */
+
+void slow_log(request * req)
+{
+    struct slow_step first, now;
+    int i, sendq = -1;
+
+    now.at = current_usec;
+    now.bytes_in = req->bytes_in;
+    now.bytes_out = req->bytes_written;
+    now.blocks = req->blocks;
+    first.status = READ_HEADER;
+    first.at = req->time_start;
+    first.bytes_in = 0;
+    first.bytes_out = 0;
+    first.blocks = 0;
+
+#ifdef TIOCOUTQ
+    if (ioctl(req->fd, TIOCOUTQ, &sendq) == -1)
+        sendq = -1;
+#endif
+
+    line_len = format_error_doc(req, line, sizeof (line) - 1);
+    line_ms(now.at - req->time_start);
+    line_printf("ms status %d in " PRINTF_OFF_T_ARG " out %lu cache %s",
+                req->response_status, req->bytes_in,
+                (unsigned long) req->bytes_written,
+                (req->cache_result == CACHE_HIT ? "hit" :
+                 req->cache_result == CACHE_MISS ? "miss" : "-"));
+    if (req->cgi_pid)
+        line_cgi(req->cgi_pid);
+    else
+        line_printf(" cgi -");
+    if (sendq == -1)
+        line_printf(" sendq -");
+    else
+        line_printf(" sendq %d", sendq);
+
+    line_printf(" trace: ");
+    for (i = 0; i <= req->slow_steps; ++i) {
+        if (i)
+            line_printf(", ");
+        if (i == SLOW_TRACE_STEPS && req->slow_lost)
+            line_printf("(%d more in the last), ", req->slow_lost);
+        line_step(req, (i ? &req->slow_trace[i - 1] : &first),
+                  (i < req->slow_steps ? &req->slow_trace[i] : &now));
+    }
+    line[line_len++] = '\n';
+
+    if (slow_log_fd == -1) {
+        fwrite(line, 1, line_len, stderr);
+    } else if (write(slow_log_fd, line, line_len) == -1) {
+        log_error_time();
+        perror("slow_log write");
+    }
+}
@@ -0,0 +1,158 @@
+/*
+ *  Boa, an http server
+ *  Copyright (C) 1995 Paul Phillips <paulp@go2net.com>
+ *  Copyright (C) 1996-2005 Larry Doolittle <ldoolitt@boa.org>
+ *  Copyright (C) 1997-2004 Jon Nelson <jnelson@boa.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 1, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* $Id$ */
+
+/*
+ * ServerTiming (only built with --enable-server-timing)
+ *
+ * Requests for a path under a ServerTiming prefix, or for a
+ * ServerTiming virtual host, get a Server-Timing header saying how
+ * long the parts of the request done so far took:
+ *
+ *   Server-Timing: parse;dur=0.052, translate;dur=0.004,
+ *       open;dur=0.013, cache;dur=0.002;desc="hit", cgi;dur=0.745
+ *
+ * (one line, durations in milliseconds).  The phases are timed with
+ * timing_begin/timing_end (see globals.h), which do nothing for other
+ * requests, and nothing at all in a build without SERVER_TIMING.
+ */
+
+#include "boa.h"
+
+struct timing_rule {
+    char *match;                /* path prefix, host, or "*" */
+    unsigned int len;
+    int host;
+    struct timing_rule *next;
+};
+
+static struct timing_rule *timing_rules;
+
+static const char *timing_name[TIMING_PHASES] = {
+    "translate", "open", "cache", "cgi"
+};
+
+/*
+ * Name: timing_add
+ * Description: Adds a ServerTiming rule: a path prefix ("/app/"), a
+ * virtual host ("host:www.example.com") or "*".
+ * Returns 0 if the rule can't be parsed.
+ */
+
+int timing_add(const char *v1)
+{
+    struct timing_rule *r;
+    int host = 0;
+
+    if (!strncasecmp(v1, "host:", 5) && v1[5]) {
+        v1 += 5;
+        host = 1;
+    } else if (*v1 != '/' && strcmp(v1, "*")) {
+        return 0;
+    }
+
+    r = malloc(sizeof (struct timing_rule));
+    if (!r || !(r->match = strdup(v1))) {
+        DIE("out of memory adding ServerTiming rule");
+    }
+    r->len = strlen(v1);
+    r->host = host;
+    r->next = timing_rules;
+    timing_rules = r;
+    return 1;
+}
+
+/*
+ * Name: timing_clear
+ * Description: Forgets the ServerTiming rules, before a reload.
+ */
+
+void timing_clear(void)
+{
+    struct timing_rule *r;
+
+    while ((r = timing_rules) != NULL) {
+        timing_rules = r->next;
+        free(r->match);
+        free(r);
+    }
+}
+
+/*
+ * Name: timing_check
+ * Description: Decides whether req gets a Server-Timing header.
+ * Called from header_end, once the path and host are known.
+ */
+
+void timing_check(request * req)
+{
+    struct timing_rule *r;
+    const char *host;
+
+    for (r = timing_rules; r; r = r->next) {
+        if (r->host) {
+            host = request_host(req);
+            if (host && !strncasecmp(host, r->match, r->len) &&
+                (host[r->len] == '\0' || host[r->len] == ':'))
+                break;
+        } else if (r->match[0] == '*' ||
+                   !strncmp(req->request_uri, r->match, r->len)) {
+            break;
+        }
+    }
+    req->server_timing = (r != NULL);
+}
+
+static void print_dur(request * req, const char *name, uint64_t usec,
+                      int *first)
+{
+    char buf[64];
+
+    sprintf(buf, "%s%s;dur=%lu.%03lu", (*first ? "" : ", "), name,
+            (unsigned long) (usec / 1000), (unsigned long) (usec % 1000));
+    req_write(req, buf);
+    *first = 0;
+}
+
+/*
+ * Name: print_server_timing
+ * Description: Writes the Server-Timing header, for print_http_headers.
+ */
+
+void print_server_timing(request * req)
+{
+    int i, first = 1;
+
+    req_write(req, "Server-Timing: ");
+    /* timing_check comes after time_header is set, so this is there */
+    print_dur(req, "parse", req->time_header - req->time_start, &first);
+    for (i = 0; i < TIMING_PHASES; ++i) {
+        if (!req->timing[i])
+            continue;
+        print_dur(req, timing_name[i], req->timing[i] - 1, &first);
+        if (i == TIMING_CACHE)
+            req_write(req, (req->cache_result == CACHE_HIT ?
+                            ";desc=\"hit\"" : ";desc=\"miss\""));
+    }
+    req_write(req, CRLF);
+}
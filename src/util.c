@@ -126,6 +126,58 @@ char *new_clean_pathname(char *pathname)
 }
 #endif
 
+/*
+ * Name: monotonic_usec
+ * Description: Returns a monotonic microsecond count (the wall clock,
+ * where there is no monotonic one).
+ */
+
+uint64_t monotonic_usec(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+/*
+ * Name: update_clock
+ *
+ * Description: Reads the clocks, once per trip around the main loop.
+ * current_time is the wall clock (seconds), for logs and timeouts;
+ * current_usec is a monotonic microsecond count, for measuring how
+ * long requests take.
+ */
+
+void update_clock(void)
+{
+    current_usec = monotonic_usec();
+    time(&current_time);
+}
+
+/*
+ * Name: request_host
+ * Description: The host req was for, as far as anyone can tell: the
+ * VHostRoot host, the local address with VirtualHost, or else the
+ * Host header (which may have a port).  NULL if there is none.
+ */
+
+const char *request_host(request * req)
+{
+    if (req->host)
+        return req->host;
+    if (virtualhost)
+        return req->local_ip_addr;
+    return req_header(req, H_HOST);
+}
+
 /*
  * Name: get_commonlog_time
  *
@@ -580,6 +632,48 @@ int create_temporary_file(short want_unlink, char *storage, unsigned int size)
     return (fd);
 }
 
+/*
+ * Name: create_spool_file
+ *
+ * Description: Returns an anonymous file to hold a POST body of 'size'
+ * bytes (-1 if not known up front).  Bodies up to MemorySpoolLimit live
+ * in a memfd, others in an O_TMPFILE inode in tempdir, which never shows
+ * up in the namespace.
+ * Falls back to create_temporary_file where neither is available.
+ *
+ * Returns: fd, or 0 on error (already logged)
+ */
+
+int create_spool_file(off_t size)
+{
+    int fd;
+#ifdef O_TMPFILE
+    static int no_tmpfile = 0;
+#endif
+
+#ifdef HAVE_MEMFD_CREATE
+    if (size >= 0 && size <= memory_spool_limit) {
+        fd = memfd_create("boa-post", MFD_CLOEXEC);
+        if (fd != -1)
+            return fd;
+        /* ENOSYS and friends: try the filesystem instead */
+    }
+#endif
+
+#ifdef O_TMPFILE
+    if (!no_tmpfile) {
+        fd = open(tempdir, O_TMPFILE | O_RDWR | O_CLOEXEC,
+                  S_IRUSR | S_IWUSR);
+        if (fd != -1)
+            return fd;
+        if (errno == EISDIR || errno == EOPNOTSUPP || errno == EINVAL)
+            no_tmpfile = 1;     /* kernel or filesystem can't do it */
+    }
+#endif
+
+    return create_temporary_file(1, NULL, 0);
+}
+
 int real_set_block_fd(int fd)
 {
     int flags;